@@ -1,7 +1,130 @@
+#include <stdint.h>
+
 // Declaración anticipada de estructuras
 typedef struct Lsystem Lsystem;
 typedef struct Rule Rule;
 typedef struct State State;
+typedef struct Prod Prod;
+typedef struct Frame Frame;
+typedef struct Iter Iter;
+typedef struct Lentab Lentab;
+typedef struct Seg Seg;
+typedef struct Image Image;
+typedef struct Poly Poly;
+typedef struct Arena Arena;
+typedef struct Reader Reader;
+typedef struct Simd Simd;
+typedef struct Node Node;
+typedef struct Dag Dag;
+typedef struct Visit Visit;
+typedef struct Dagiter Dagiter;
+typedef struct Mark Mark;
+typedef struct Ctx Ctx;
+typedef struct Brackets Brackets;
+typedef struct Op Op;
+typedef struct Expr Expr;
+typedef struct Prule Prule;
+typedef struct Pool Pool;
+typedef struct Catalog Catalog;
+typedef struct Growth Growth;
+typedef struct Cliopts Cliopts;
+
+// Acciones de la tortuga asociadas a cada símbolo
+enum { T_NONE, T_FORWARD, T_LEFT, T_RIGHT, T_PUSH, T_POP };
+
+// Fases medidas por la instrumentación (LSYSTEM_PROF=1)
+enum { P_PARSE, P_COUNT, P_SCAN, P_WRITE, P_TURTLE, P_DRAW, NPHASES };
+#define NEVENTS 4	// Ciclos, instrucciones, fallos de caché y de predicción de saltos
+#define MAXPAR 8	// Parámetros de un módulo, como en A(t, s)
+#define EXPRSTACK 32	// Altura máxima de la pila al evaluar una expresión
+#define MAXMODULE (2 + MAXPAR * 24)	// Caracteres de un módulo escrito con fmtmodule()
+
+/**
+ * Entrada de la tabla de reglas compilada.
+ *
+ * La tabla tiene 256 entradas indexadas por símbolo. Para los símbolos sin
+ * regla (identidad) succ apunta al propio símbolo y len vale 1, de modo que
+ * la expansión copia igual todos los símbolos sin recorrer la lista de reglas.
+ */
+struct Prod
+{
+	char*	succ;     // Sucesor (o el propio símbolo si es identidad)
+	size_t	len;      // Longitud del sucesor
+	char	ident;    // 1 si el símbolo no tiene regla
+	char	op;       // Acción de la tortuga (T_*)
+	int	nalt;         // Alternativas si la regla es estocástica (0 si no)
+	uint64_t	cut;  // En una alternativa: probabilidad acumulada sobre 2^32
+	Prod*	alt;      // Alternativas de la regla estocástica, o NULL
+	int	nctx;         // Reglas con contexto del símbolo (0 si no tiene)
+	Ctx*	ctx;      // Reglas con contexto en el orden del archivo, o NULL
+	int	nprule;       // Reglas paramétricas del símbolo (0 si no tiene)
+	Prule*	prule;    // Reglas paramétricas en el orden del archivo, o NULL
+};
+
+/**
+ * Regla con contexto compilada: se aplica prod si los símbolos anteriores
+ * a uno dado terminan en left y los siguientes empiezan por right.
+ */
+struct Ctx
+{
+	const char*	left;     // Contexto izquierdo ("" si no hay)
+	const char*	right;    // Contexto derecho ("" si no hay)
+	size_t	llen, rlen;   // Longitudes de left y right
+	Prod	prod;         // Sucesor de la regla
+};
+
+/**
+ * Corchetes de una generación con su pareja, para que el contexto salte una
+ * rama "[...]" entera sin recorrerla (reglas con contexto y skipbranch).
+ *
+ * Se emparejan la primera vez que hace falta saltar una rama larga: pos
+ * guarda en orden las posiciones de los '[' y ']' de la generación y
+ * mate[k] la de la pareja de pos[k], o SIZE_MAX si no tiene.
+ */
+struct Brackets
+{
+	const char*	gen;      // Generación
+	size_t	len;          // Longitud de gen
+	int	ready;            // 1 cuando pos y mate están calculados
+	size_t	n;            // Número de corchetes
+	size_t*	pos;          // Posición de cada corchete, en orden
+	size_t*	mate;         // Posición de su pareja, o SIZE_MAX
+};
+
+/**
+ * Instrucción de una expresión compilada (máquina de pila).
+ */
+struct Op
+{
+	int	op;               // Operación (X_* en expr.c)
+	int	arg;              // Parámetro que lee X_PARAM
+	double	val;          // Valor de X_CONST
+};
+
+/**
+ * Expresión compilada por mkexpr(): condición o argumento de una regla.
+ */
+struct Expr
+{
+	int	n;                // Instrucciones
+	int	depth;            // Altura máxima de la pila
+	Op*	code;
+};
+
+/**
+ * Regla paramétrica compilada: A(t) : t > 2 -> F(t * 0.7)[+A(t - 1)].
+ *
+ * prod.succ son solo los símbolos del sucesor ("F[+A]"); args tiene, en
+ * orden, la expresión de cada parámetro de esos módulos, que se evalúa con
+ * los parámetros del módulo que se reescribe.
+ */
+struct Prule
+{
+	Expr*	cond;         // Condición, o NULL si se aplica siempre
+	Prod	prod;         // Símbolos del sucesor
+	Expr**	args;         // Expresiones de los parámetros del sucesor
+	int	nargs;
+};
 
 /**
  * Representa un sistema de Lindenmayer (L-system).
@@ -14,6 +137,16 @@ typedef struct State State;
  * - initangle: Ángulo inicial del cursor de dibujo.
  * - leftangle: Ángulo de rotación hacia la izquierda (para el símbolo '-').
  * - rightangle: Ángulo de rotación hacia la derecha (para el símbolo '+').
+ * - table: Tabla de reglas compilada por parse(), indexada por símbolo.
+ * - code, sym, nsyms, bits: Alfabeto compilado por parse() para guardar las
+ *   generaciones empaquetadas con pocos bits por símbolo.
+ * - simd: Núcleos vectoriales de expansión, o NULL si se usa el bucle escalar.
+ * - seed, stoch: Semilla de las reglas estocásticas y si hay alguna.
+ * - ctx, ignore, skipbranch: Si hay reglas con contexto, los símbolos que no
+ *   cuentan como contexto y si el contexto salta las ramas entre corchetes.
+ * - param, arity, npar, axpar: Si los módulos llevan parámetros, cuántos
+ *   lleva cada símbolo, el máximo y los valores de los del axioma.
+ * - pool: Memoria del catálogo que guarda sus cadenas y reglas (loadcatalog()).
  */
 struct Lsystem
 {
@@ -24,18 +157,45 @@ struct Lsystem
 	double	initangle;   // Ángulo inicial del cursor
 	double	leftangle;   // Rotación hacia la izquierda
 	double	rightangle;  // Rotación hacia la derecha
+	Prod	table[256];  // Reglas compiladas (acceso O(1) por símbolo)
+	char	self[256];   // self[c] == c: sucesor de los símbolos sin regla
+	unsigned char	code[256]; // Código denso de cada símbolo usado
+	char	sym[256];    // Símbolo de cada código
+	int	nsyms;           // Número de símbolos distintos usados
+	int	bits;            // Bits por símbolo empaquetado (2, 3, 4 u 8)
+	Simd*	simd;        // Datos de los núcleos SIMD (NULL sin ellos)
+	uint64_t	seed;    // Semilla de las reglas estocásticas
+	int	stoch;           // 1 si algún símbolo tiene reglas con peso
+	int	ctx;             // 1 si alguna regla tiene contexto
+	char	ignore[256]; // 1 para los símbolos que se saltan al buscar contexto
+	int	skipbranch;      // 1 si el contexto salta las ramas [...]
+	int	param;           // 1 si es un sistema paramétrico
+	unsigned char	arity[256]; // Parámetros de cada símbolo
+	int	npar;            // Mayor número de parámetros de un símbolo
+	double*	axpar;       // Parámetros del axioma (npar arrays de strlen(axiom) + 1)
+	Pool*	pool;        // Memoria de cadenas y reglas si es de un catálogo, o NULL
 };
 
 /**
  * Representa una regla de producción del L-system.
  *
  * Cada regla transforma un carácter (pred) en una secuencia (succ).
- * Las reglas están encadenadas en una lista enlazada.
+ * Las reglas están encadenadas en una lista enlazada. Si un símbolo tiene
+ * reglas con peso (rule F 0.3 -> ...), cada vez se elige una de ellas con
+ * probabilidad proporcional a su peso. Las reglas con contexto
+ * (rule A < F > B -> ...) solo se aplican si los vecinos coinciden. Las
+ * paramétricas (rule A(t) : t > 2 -> ...) solo si se cumple su condición.
  */
 struct Rule
 {
 	char	pred;     // Símbolo que será reemplazado
 	char*	succ;     // Cadena de reemplazo
+	double	weight;   // Peso de una regla estocástica (0 si no tiene)
+	char*	left;     // Contexto izquierdo (A < F), o NULL
+	char*	right;    // Contexto derecho (F > B), o NULL
+	char*	formal;   // Parámetros formales del predecesor ("t,s"), o NULL
+	char*	cond;     // Condición de una regla paramétrica, o NULL
+	Prule*	pr;       // Regla paramétrica compilada por mkparams(), o NULL
 	Rule*	next;     // Siguiente regla en la lista
 };
 
@@ -47,12 +207,237 @@ struct Rule
  */
 struct State
 {
-	int	x;        // Coordenada X del cursor
-	int	y;        // Coordenada Y del cursor
+	double	x;        // Coordenada X del cursor
+	double	y;        // Coordenada Y del cursor
 	double	angle;        // Ángulo de orientación del cursor
 	State*	prev;     // Puntero al estado anterior en la pila
 };
 
+/**
+ * Par de búferes reutilizables para las generaciones.
+ *
+ * La generación actual está en buf[cur] y la siguiente se escribe en el otro
+ * búfer; después se intercambian los papeles, sin copias.
+ *
+ * En un sistema paramétrico buf guarda un símbolo por módulo y par[b] sus
+ * parámetros como estructura de arrays: el parámetro k del módulo i está en
+ * par[b][k * cap[b] + i], así que cada array se recorre en orden igual que
+ * los símbolos.
+ */
+struct Arena
+{
+	char*	buf[2];       // Búferes alternos
+	size_t	cap[2];       // Capacidad de cada búfer en bytes
+	int	cur;              // Búfer con la generación actual
+	size_t	len;          // Longitud de la generación actual
+	size_t	peak;         // Mayor memoria reservada a la vez (bytes)
+	int	depth;            // Número de la generación actual
+	double*	par[2];       // Parámetros de cada búfer (NULL: los del axioma)
+};
+
+/**
+ * Lector secuencial de una generación empaquetada.
+ *
+ * Cada palabra de 64 bits guarda 64 / bits códigos, empezando por los bits
+ * bajos; ningún código queda partido entre dos palabras.
+ */
+struct Reader
+{
+	const uint64_t*	w;    // Palabra actual
+	uint64_t	cur;      // Códigos que quedan por leer de la palabra
+	int	slot;             // Códigos ya leídos de la palabra
+	int	per;              // Códigos por palabra
+	int	bits;             // Bits por código
+	uint64_t	mask;     // (1 << bits) - 1
+};
+
+/**
+ * Marco de la pila del iterador de derivación.
+ *
+ * Representa una producción (o el axioma) que se está recorriendo en el
+ * nivel depth del árbol de derivación.
+ */
+struct Frame
+{
+	const char*	succ;     // Cadena que se recorre en este nivel
+	size_t	len;          // Longitud de la cadena
+	size_t	pos;          // Siguiente posición a visitar
+	int	depth;            // Nivel del árbol (0 es el axioma)
+};
+
+/**
+ * Iterador perezoso sobre los símbolos de una generación.
+ *
+ * Recorre el árbol de derivación en profundidad con una pila explícita de
+ * marcos, sin construir nunca la cadena completa de la generación.
+ */
+struct Iter
+{
+	Lsystem*	ls;       // Sistema que se recorre
+	int	depth;            // Generación objetivo
+	int	top;              // Cima de la pila (-1 al terminar)
+	Frame*	stack;        // Un marco por nivel (depth + 1)
+	size_t	count;        // Símbolos emitidos hasta ahora
+	uint64_t*	idx;      // Índice del siguiente símbolo en cada generación
+};
+
+/**
+ * Tabla de longitudes de expansión.
+ *
+ * len[d * 256 + c] es la longitud de la cadena que produce el símbolo c tras
+ * d derivaciones, con contadores de 64 bits saturados en UINT64_MAX.
+ * Permite acceder al símbolo k de una generación sin construirla.
+ */
+struct Lentab
+{
+	Lsystem*	ls;       // Sistema del que se calculó la tabla
+	int	depth;            // Mayor número de derivaciones calculado
+	uint64_t*	len;      // (depth + 1) × 256 longitudes
+};
+
+/**
+ * Nodo del DAG de una generación: la expansión de sym tras depth derivaciones.
+ *
+ * Las hojas (depth 0) son un símbolo. El resto concatena sus hijos, que son
+ * nodos (símbolo del sucesor, depth - 1) compartidos con los demás padres.
+ */
+struct Node
+{
+	char	sym;          // Símbolo expandido (0 en la raíz)
+	int	depth;            // Derivaciones que representa (0 en las hojas)
+	uint64_t	len;      // Longitud de la expansión, saturada
+	size_t	id;           // Posición en Dag.nodes
+	size_t	nkids;        // Número de hijos
+	Node*	kids[];       // Hijos en orden
+};
+
+/**
+ * Generación representada como un DAG con un nodo por par (símbolo, depth).
+ */
+struct Dag
+{
+	Lsystem*	ls;       // Sistema del que se construyó (NULL si se cargó)
+	int	depth;            // Generación representada
+	Node*	root;         // Producción del axioma
+	Node**	nodes;        // Todos los nodos, hijos antes que padres
+	size_t	nnodes;       // Número de nodos
+	size_t	cap;          // Capacidad de nodes
+	Node**	memo;         // Nodo de cada (depth, símbolo) ya creado
+};
+
+/**
+ * Marco de la pila del iterador del DAG: un nodo y el siguiente hijo.
+ */
+struct Visit
+{
+	Node*	node;         // Nodo que se recorre
+	size_t	pos;          // Siguiente hijo a visitar
+};
+
+/**
+ * Iterador sobre los símbolos de una generación guardada como DAG.
+ */
+struct Dagiter
+{
+	int	top;              // Cima de la pila (-1 al terminar)
+	Visit*	stack;        // Un marco por nivel del DAG
+	uint64_t	count;    // Índice del siguiente símbolo
+};
+
+/**
+ * Inicio de una medida: reloj y contadores de hardware del hilo.
+ */
+struct Mark
+{
+	uint64_t	ns;           // Reloj monótono en nanosegundos
+	uint64_t	ev[NEVENTS];  // Contadores al empezar
+};
+
+/**
+ * Segmento dibujado por la tortuga, en coordenadas de pantalla.
+ */
+struct Seg
+{
+	float	x0, y0;   // Extremo inicial
+	float	x1, y1;   // Extremo final
+};
+
+/**
+ * Geometría de una generación agrupada en polilíneas.
+ *
+ * Los puntos de la polilínea r son los de índice runs[r] a runs[r + 1] - 1.
+ */
+struct Poly
+{
+	float*	xy;           // Coordenadas x, y de cada punto
+	size_t	npts;         // Número de puntos
+	size_t*	runs;         // Inicio de cada polilínea (nruns + 1 entradas)
+	size_t	nruns;        // Número de polilíneas
+};
+
+/**
+ * Imagen en escala de grises para el dibujo sin ventana (un byte por píxel).
+ */
+struct Image
+{
+	int	w, h;             // Dimensiones en píxeles
+	unsigned char*	px;   // w × h píxeles por filas (0 negro, 255 blanco)
+};
+
+/**
+ * Memoria por bloques para muchas reservas pequeñas que se liberan juntas.
+ *
+ * Se reserva avanzando dentro del bloque actual; cuando no cabe se guarda
+ * en la lista next y se empieza otro. No se libera nada suelto.
+ */
+struct Pool
+{
+	char*	p;            // Bloque actual
+	size_t	used;         // Bytes usados del bloque actual
+	size_t	cap;          // Tamaño del bloque actual
+	Pool*	next;         // Bloques anteriores
+};
+
+/**
+ * Catálogo de L-systems cargados de un directorio o de un archivo con
+ * varias definiciones seguidas, con sus cadenas en unas pocas Pool.
+ */
+struct Catalog
+{
+	Lsystem**	sys;      // Sistemas en el orden de los archivos
+	size_t	n;
+	Pool**	pools;        // Una por hilo que parseó
+	int	npool;
+};
+
+/**
+ * Tamaño y composición de una generación calculados con growth(), sin
+ * expandirla. Exactos para un D0L; si no, cotas superiores.
+ */
+struct Growth
+{
+	int	depth;            // Generación
+	int	exact;            // 0 si son cotas (reglas estocásticas, con contexto o paramétricas)
+	int	sat;              // 1 si algún valor pasa de 2^64 - 1 y se ha saturado
+	uint64_t	len;      // Símbolos
+	uint64_t	count[256]; // Símbolos de cada clase (vector de Parikh)
+	uint64_t	segs;     // Segmentos que dibuja la tortuga (F y G)
+	uint64_t	nest;     // Anidamiento máximo de corchetes
+	uint64_t	bytes;    // Memoria de esta generación y la anterior con mkarena()
+	uint64_t	pkbytes;  // Lo mismo con mkpkarena()
+};
+
+/**
+ * Opciones finales comunes de los programas sin gráficos (ver cliargs()).
+ */
+struct Cliopts
+{
+	const char*	mode;     // -l, -p, -d, --stats... o NULL
+	const char*	out;      // Salida de -e, o NULL
+	const char*	resume;   // Checkpoint de -r, o NULL
+	const char*	save;     // Checkpoint de -s, o NULL
+};
+
 /**
  * emalloc - Envoltorio de malloc que aborta si falla.
  * Similar a malloc, pero garantiza que el programa terminará si no hay memoria.
@@ -69,3 +454,723 @@ void* emalloc(size_t size);
  */
 Lsystem* parse(char *filename);
 
+/**
+ * freelsystem - Libera un L-system creado con parse().
+ */
+void freelsystem(Lsystem *ls);
+
+/**
+ * parsetext - Parsea una definición que ya está en memoria; con pool, el
+ * L-system, sus cadenas y sus reglas se reservan en ella.
+ */
+Lsystem* parsetext(const char *file, const char *text, size_t len, Pool *pool);
+
+/**
+ * tryparse - parsetext() que devuelve NULL ante un error en vez de terminar.
+ */
+Lsystem* tryparse(const char *file, const char *text, size_t len, Pool *pool);
+
+/**
+ * parsefail - Abandona el parseo tras un error ya explicado: vuelve a
+ * tryparse() o termina el programa.
+ */
+void parsefail(void) __attribute__((noreturn));
+
+/**
+ * parsetmp - Memoria temporal del parseo en curso; se libera sola al
+ * terminar o al fallar.
+ */
+Pool* parsetmp(void);
+
+/**
+ * loadfile - Proyecta (o lee, si no se puede) un archivo entero en memoria;
+ * NULL si no se puede leer.
+ */
+char* loadfile(const char *path, size_t *len, int *mapped);
+
+/**
+ * loadfd - loadfile() de un descriptor ya abierto, sin cerrarlo.
+ */
+char* loadfd(int fd, const char *path, size_t *len, int *mapped);
+
+/**
+ * unloadfile - Libera el texto de loadfile().
+ */
+void unloadfile(char *text, size_t len, int mapped);
+
+/**
+ * sysend - Final de la definición que empieza en text dentro de un archivo
+ * con varias (el comienzo del 'name' siguiente, o end).
+ */
+const char* sysend(const char *file, const char *text, const char *end);
+
+/**
+ * mkpool - Crea una memoria por bloques vacía.
+ */
+Pool* mkpool(void);
+
+/**
+ * palloc - Reserva n bytes a cero en pool (con pool NULL, con emalloc()).
+ */
+void* palloc(Pool *pool, size_t n);
+
+/**
+ * pstrdup - Copia los n caracteres de s, terminados en '\0', en pool.
+ */
+char* pstrdup(Pool *pool, const char *s, size_t n);
+
+/**
+ * freepool - Libera una memoria por bloques y todo lo reservado en ella.
+ */
+void freepool(Pool *pool);
+
+/**
+ * loadcatalog - Carga todos los L-systems de un directorio o de un archivo
+ * con varias definiciones, parseando con threads hilos.
+ */
+Catalog* loadcatalog(const char *path, int threads);
+
+/**
+ * findsystem - L-system del catálogo con ese nombre ('_' vale por espacio),
+ * o NULL.
+ */
+Lsystem* findsystem(Catalog *cat, const char *name);
+
+/**
+ * freecatalog - Libera un catálogo y todos sus L-systems.
+ */
+void freecatalog(Catalog *cat);
+
+/**
+ * compile - Construye la tabla de reglas de un L-system a partir de su lista.
+ *
+ * parse() la llama al terminar; solo hay que volver a llamarla si se
+ * modifican las reglas a mano.
+ */
+void compile(Lsystem *ls);
+
+/**
+ * lookup - Entrada de la tabla compilada para el símbolo c.
+ */
+#define lookup(ls, c) (&(ls)->table[(unsigned char)(c)])
+
+/**
+ * philox - Número aleatorio de 32 bits para (key, depth, idx) con Philox4x32-10.
+ *
+ * Es un generador basado en contador: el resultado depende solo de sus
+ * argumentos, sin estado compartido, así que cualquier hilo o proceso que
+ * reescriba el símbolo idx de la generación depth obtiene el mismo número.
+ */
+static inline uint32_t philox(uint64_t key, int depth, uint64_t idx) {
+	uint32_t c0 = (uint32_t)idx, c1 = (uint32_t)(idx >> 32), c2 = (uint32_t)depth, c3 = 0;
+	uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+	for (int r = 0; r < 10; r++) {
+		uint64_t p0 = (uint64_t)0xD2511F53 * c0;
+		uint64_t p1 = (uint64_t)0xCD9E8D57 * c2;
+		uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c1 = (uint32_t)p1;
+		c3 = (uint32_t)p0;
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	return c0;
+}
+
+/**
+ * choose - Producción que se aplica al símbolo idx de la generación depth.
+ *
+ * Para una regla determinista es la propia entrada p; para una estocástica,
+ * la alternativa que elige philox() con la semilla del sistema.
+ */
+static inline Prod* choose(Lsystem *ls, Prod *p, int depth, uint64_t idx) {
+	if (p->nalt == 0)
+		return p;
+	uint32_t r = philox(ls->seed, depth, idx);
+	int k = 0;
+	while (k < p->nalt - 1 && r >= p->alt[k].cut)
+		k++;
+	return &p->alt[k];
+}
+
+/**
+ * context - Regla con contexto que se aplica a gen[i], o p si ninguna coincide.
+ * br son los corchetes de gen (mkbrackets()), o NULL sin skipbranch.
+ */
+Prod* context(Lsystem *ls, Prod *p, const char *gen, size_t len, Brackets *br, size_t i);
+
+/**
+ * mkbrackets - Corchetes de una generación, emparejados cuando hagan falta,
+ * o NULL si el contexto de ls no salta ramas.
+ */
+Brackets* mkbrackets(Lsystem *ls, const char *gen, size_t len);
+
+/**
+ * freebrackets - Libera unos corchetes de mkbrackets() (admite NULL).
+ */
+void freebrackets(Brackets *br);
+
+/**
+ * contextual - Compila las reglas con contexto; compile() la llama.
+ */
+void contextual(Lsystem *ls);
+
+/**
+ * rewrite - Producción que se aplica a gen[i] en la generación depth: la
+ * regla con contexto que coincida y, si es estocástica, la que elige choose().
+ */
+static inline Prod* rewrite(Lsystem *ls, const char *gen, size_t len, Brackets *br,
+                            int depth, size_t i) {
+	Prod *p = lookup(ls, gen[i]);
+	if (p->nctx)
+		p = context(ls, p, gen, len, br, i);
+	return choose(ls, p, depth, i);
+}
+
+/**
+ * mkexpr - Compila una expresión con los parámetros formales dados.
+ */
+Expr* mkexpr(const char *s, char **formals, int nformal);
+
+/**
+ * freeexpr - Libera una expresión creada con mkexpr().
+ */
+void freeexpr(Expr *e);
+
+/**
+ * eval - Valor de una expresión compilada con los parámetros par.
+ */
+double eval(const Expr *e, const double *par);
+
+/**
+ * isparametric - 1 si el axioma o alguna regla lleva parámetros o condiciones.
+ */
+int isparametric(Lsystem *ls);
+
+/**
+ * mkparams - Separa símbolos y parámetros y compila las expresiones de un
+ * sistema paramétrico recién parseado.
+ */
+void mkparams(Lsystem *ls);
+
+/**
+ * paramrules - Llena las reglas paramétricas de la tabla (desde compile()).
+ */
+void paramrules(Lsystem *ls);
+
+/**
+ * freeprule - Libera la regla paramétrica compilada de una Rule.
+ */
+void freeprule(Prule *pr);
+
+/**
+ * pmatch - Regla paramétrica que se aplica a c con parámetros par, o NULL.
+ */
+Prule* pmatch(Lsystem *ls, char c, const double *par);
+
+/**
+ * pmcount - Primera pasada de la expansión paramétrica de gen[start, end).
+ */
+size_t pmcount(Lsystem *ls, const char *gen, const double *in, size_t stride,
+              size_t start, size_t end);
+
+/**
+ * pmwrite - Segunda pasada de la expansión paramétrica de gen[start, end).
+ */
+void pmwrite(Lsystem *ls, const char *gen, const double *in, size_t stride, size_t start,
+            size_t end, char *out, double *opar, size_t ostride, size_t pos);
+
+/**
+ * fmtmodule - Texto de un módulo con sus parámetros, como "F(1.5)".
+ */
+size_t fmtmodule(Lsystem *ls, char c, const double *par, size_t stride, size_t i, char *buf);
+
+/**
+ * production - Devuelve el sucesor de la regla de un símbolo, o NULL.
+ */
+char* production(Lsystem *ls, char c);
+
+/**
+ * expand - Calcula la siguiente generación de un L-system.
+ *
+ * @ls: L-system con las reglas de producción.
+ * @gen: Generación actual.
+ * @len: Longitud de la generación actual.
+ * @depth: Número de la generación actual (elige las reglas estocásticas).
+ * @newlen: Si no es NULL, recibe la longitud de la nueva generación.
+ * @threads: Número de hilos a usar (1 para la versión secuencial).
+ * @return: Nueva generación, reservada con el tamaño exacto.
+ *
+ * Trabaja en dos pasadas: cuenta la longitud de salida, calcula los
+ * desplazamientos con una suma de prefijos y escribe cada producción
+ * directamente en su posición final.
+ */
+char* expand(Lsystem *ls, const char *gen, size_t len, int depth, size_t *newlen, int threads);
+
+/**
+ * mksimd - Prepara la expansión vectorial (SSE4.1, AVX2 o AVX-512 según la
+ * CPU). Devuelve NULL si no es posible; compile() la llama.
+ */
+Simd* mksimd(Lsystem *ls);
+
+/**
+ * simdcount - Longitud de salida de gen[start, end) calculada con SIMD.
+ */
+size_t simdcount(Simd *k, const char *gen, size_t start, size_t end);
+
+/**
+ * simdwrite - Escribe las producciones de gen[start, end) con SIMD, sin
+ * escribir más allá de outend ni leer más allá de genend.
+ */
+void simdwrite(Simd *k, const char *gen, size_t start, size_t end,
+               char *out, char *outend, const char *genend);
+
+/**
+ * simdname - Nombre del núcleo de expansión elegido.
+ */
+const char* simdname(void);
+
+/**
+ * schedule - Ejecuta task(arg, b) para nb bloques independientes en nt hilos,
+ * repartidos según la suma de prefijos weight (o a partes iguales si es
+ * NULL) y con robo de trabajo entre hilos. phase es la fase (P_*) a la que
+ * la instrumentación suma el trabajo de los hilos.
+ */
+void schedule(int nt, size_t nb, const size_t *weight, void (*task)(void*, size_t), void *arg,
+              int phase);
+
+/**
+ * grainsize - Símbolos por bloque de schedule() para len símbolos y nt hilos.
+ */
+size_t grainsize(size_t len, int nt);
+
+/**
+ * initrange - Bloques [first, last) que schedule() asigna al principio al hilo t.
+ */
+void initrange(int nt, size_t nb, const size_t *weight, int t, size_t *first, size_t *last);
+
+/**
+ * numapin - Fija el hilo t a una CPU en orden de topología si LSYSTEM_NUMA
+ * está activa (nodo, núcleos físicos, hilos hermanos).
+ */
+void numapin(int t);
+
+/**
+ * numaunpin - Devuelve el hilo que llama a la afinidad original del proceso
+ * tras una región paralela en la que numapin() lo fijó.
+ */
+void numaunpin(void);
+
+/**
+ * numaon - 1 si el modo NUMA (LSYSTEM_NUMA=1) está activo.
+ */
+int numaon(void);
+
+/**
+ * bigalloc - malloc para búferes de generación; con LSYSTEM_THP=1 usa
+ * páginas enormes transparentes para los grandes y con LSYSTEM_OOC=dir los
+ * proyecta desde archivos en dir. Se liberan con bigfree().
+ */
+void* bigalloc(size_t n);
+
+/**
+ * bigfree - Libera un búfer de bigalloc() (o de malloc()).
+ */
+void bigfree(void *p);
+
+/**
+ * oocon - 1 si las generaciones grandes van a disco (LSYSTEM_OOC=directorio).
+ */
+int oocon(void);
+
+/**
+ * oocspace - Bytes libres en el directorio de LSYSTEM_OOC (0 si no está activo).
+ */
+uint64_t oocspace(void);
+
+/**
+ * oocalloc - Búfer de n bytes en un archivo temporal proyectado, o NULL.
+ */
+void* oocalloc(size_t n);
+
+/**
+ * oocmap - Búfer privado con len bytes de fd desde off (múltiplo de 4096),
+ * liberable con bigfree(), o NULL.
+ */
+void* oocmap(int fd, size_t off, size_t len);
+
+/**
+ * oocfree - Libera un búfer de oocalloc() u oocmap(); devuelve 0 si p no lo es.
+ */
+int oocfree(void *p);
+
+/**
+ * oocdrop - Descarta sin escribirlo a disco el contenido de un búfer de
+ * oocalloc() que se va a reescribir; no hace nada con otros búferes.
+ */
+void oocdrop(void *p);
+
+/**
+ * firsttouch - En modo NUMA, cada hilo toca primero las páginas del rango de
+ * salida que le asigna el reparto inicial de schedule() (off en bytes).
+ */
+void firsttouch(char *buf, int nt, size_t nb, const size_t *off);
+
+/**
+ * mkarena - Crea los búferes de generación con el axioma como generación 0.
+ */
+Arena* mkarena(const char *axiom);
+
+/**
+ * freearena - Libera los búferes de generación.
+ */
+void freearena(Arena *a);
+
+/**
+ * arenanext - Expande la generación actual en el búfer libre y lo hace actual.
+ * Reserva solo lo que predice la primera pasada, sin rellenar a ceros.
+ * Devuelve la nueva longitud.
+ */
+size_t arenanext(Arena *a, Lsystem *ls, int threads);
+
+/**
+ * arenagen - Generación actual de unos búferes de generación.
+ */
+#define arenagen(a) ((a)->buf[(a)->cur])
+
+/**
+ * mkiter - Crea un iterador sobre la generación depth sin materializarla.
+ * Usa memoria O(depth × longitud máxima de regla).
+ */
+Iter* mkiter(Lsystem *ls, int depth);
+
+/**
+ * freeiter - Libera un iterador creado con mkiter().
+ */
+void freeiter(Iter *it);
+
+/**
+ * iternext - Siguiente símbolo de la generación, o -1 al terminar.
+ */
+int iternext(Iter *it);
+
+/**
+ * iterread - Lee hasta n símbolos en buf; devuelve cuántos leyó.
+ */
+size_t iterread(Iter *it, char *buf, size_t n);
+
+/**
+ * mklentab - Precalcula las longitudes de expansión hasta depth derivaciones.
+ */
+Lentab* mklentab(Lsystem *ls, int depth);
+
+/**
+ * freelentab - Libera una tabla creada con mklentab().
+ */
+void freelentab(Lentab *lt);
+
+/**
+ * symlen - Longitud del símbolo c tras d derivaciones.
+ */
+#define symlen(lt, c, d) ((lt)->len[(size_t)(d) * 256 + (unsigned char)(c)])
+
+/**
+ * satadd - Suma de contadores de 64 bits que se satura en UINT64_MAX.
+ */
+static inline uint64_t satadd(uint64_t a, uint64_t b) {
+	return a > UINT64_MAX - b ? UINT64_MAX : a + b;
+}
+
+/**
+ * genlen - Longitud de la generación depth, sin construirla.
+ */
+uint64_t genlen(Lentab *lt, int depth);
+
+/**
+ * slicebound - Comienzo del tramo t de n de total elementos, sin desbordar.
+ */
+uint64_t slicebound(uint64_t total, int t, int n);
+
+/**
+ * growth - Tamaño, símbolos, segmentos, anidamiento y memoria de la
+ * generación depth, elevando la matriz de crecimiento de las reglas por
+ * cuadrados: O(log depth) productos de matrices, sin expandir nada.
+ */
+void growth(Lsystem *ls, int depth, Growth *g);
+
+/**
+ * memlimit - Memoria física más el disco libre de LSYSTEM_OOC, en bytes.
+ */
+uint64_t memlimit(void);
+
+/**
+ * growthfits - 1 si las generaciones de g caben en memlimit() (packed: las
+ * empaquetadas); las cotas de sistemas no deterministas siempre caben.
+ */
+int growthfits(Growth *g, int packed);
+
+/**
+ * printgrowth - Escribe el informe de growth() (modo --stats).
+ */
+void printgrowth(Lsystem *ls, Growth *g, FILE *fp);
+
+/**
+ * iterseek - Sitúa el iterador en el símbolo k de su generación en
+ * O(depth × longitud de regla).
+ */
+void iterseek(Iter *it, Lentab *lt, uint64_t k);
+
+/**
+ * symat - Símbolo de índice k de la generación depth, o -1 si no existe.
+ */
+int symat(Lentab *lt, int depth, uint64_t k);
+
+/**
+ * exportgen - Escribe la generación depth en path ("-" es la salida estándar)
+ * mientras se genera, con memoria acotada. Devuelve -1 si falla la salida.
+ */
+int exportgen(Lsystem *ls, int depth, const char *path, int threads, uint64_t *n);
+
+/**
+ * exportmain - Modo -e de los programas sin gráficos: parsea file y exporta
+ * su generación depth a out, con el resumen en stderr. Devuelve el código
+ * de salida del programa.
+ */
+int exportmain(const char *file, int depth, const char *out, int threads);
+
+/**
+ * lazygen - Recorre la generación depth con el iterador perezoso, repartida
+ * entre threads hilos si hay tabla de longitudes. Devuelve -1 si el
+ * iterador se queda sin símbolos antes de tiempo.
+ */
+int lazygen(Lsystem *ls, Lentab *lt, int depth, int threads, uint64_t *n);
+
+/**
+ * cliargs - Separa las opciones finales [modo|-e salida] [-r ck] [-s ck] de
+ * los fixed argumentos fijos. Devuelve -1, tras escribir el uso, si no valen.
+ */
+int cliargs(int argc, char *argv[], int fixed, const char *args, Cliopts *o);
+
+/**
+ * writeall - Escribe n bytes en fd; devuelve -1 si falla.
+ */
+int writeall(int fd, const char *buf, size_t n);
+
+/**
+ * mkdag - Construye el DAG de la generación depth con nodos compartidos.
+ * Usa memoria O(depth × tamaño del alfabeto), no O(longitud).
+ */
+Dag* mkdag(Lsystem *ls, int depth);
+
+/**
+ * freedag - Libera un DAG creado con mkdag() o dagload().
+ */
+void freedag(Dag *g);
+
+/**
+ * daglen - Longitud de la generación (saturada en UINT64_MAX).
+ */
+uint64_t daglen(Dag *g);
+
+/**
+ * dagat - Símbolo de índice k de la generación, o -1 si no existe.
+ */
+int dagat(Dag *g, uint64_t k);
+
+/**
+ * mkdagiter - Crea un iterador que empieza en el símbolo k.
+ */
+Dagiter* mkdagiter(Dag *g, uint64_t k);
+
+/**
+ * freedagiter - Libera un iterador creado con mkdagiter().
+ */
+void freedagiter(Dagiter *it);
+
+/**
+ * dagnext - Siguiente símbolo de la generación, o -1 al terminar.
+ */
+int dagnext(Dagiter *it);
+
+/**
+ * dagread - Lee hasta n símbolos en buf; devuelve cuántos leyó.
+ */
+size_t dagread(Dagiter *it, char *buf, size_t n);
+
+/**
+ * dagsave - Escribe la estructura del DAG en texto; devuelve -1 si falla.
+ */
+int dagsave(Dag *g, FILE *fp);
+
+/**
+ * dagload - Lee un DAG escrito con dagsave(), o devuelve NULL.
+ */
+Dag* dagload(FILE *fp);
+
+/**
+ * rulehash - Huella del axioma, las reglas y la semilla de un L-system.
+ */
+uint64_t rulehash(Lsystem *ls);
+
+/**
+ * cksave - Guarda la generación actual de a en un checkpoint con su
+ * rulehash() y una suma de comprobación; devuelve -1 si falla.
+ */
+int cksave(Arena *a, Lsystem *ls, const char *path);
+
+/**
+ * ckload - Proyecta un checkpoint de cksave() como búferes de generación
+ * para seguir expandiendo con arenanext(), o devuelve NULL si no es válido
+ * o es de otras reglas.
+ */
+Arena* ckload(const char *path, Lsystem *ls);
+
+/**
+ * turtle - Interpreta una generación en paralelo y devuelve sus segmentos.
+ *
+ * @x, @y: Posición inicial en pantalla (el ángulo inicial es ls->initangle).
+ * @nseg: Recibe el número de segmentos.
+ * @threads: Número de hilos (1 para la versión secuencial).
+ *
+ * Cada tramo de la cadena se resume como una transformación rígida más sus
+ * corchetes sin emparejar; componer esos resúmenes da la pose de entrada de
+ * cada tramo y los tramos se dibujan después de forma independiente.
+ */
+Seg* turtle(Lsystem *ls, const char *gen, size_t len, double x, double y, size_t *nseg, int threads);
+
+/**
+ * mkpoly - Agrupa en polilíneas los segmentos conectados.
+ */
+Poly* mkpoly(Seg *segs, size_t n);
+
+/**
+ * freepoly - Libera unas polilíneas creadas con mkpoly().
+ */
+void freepoly(Poly *p);
+
+/**
+ * mkimage - Crea una imagen en blanco de w × h píxeles.
+ */
+Image* mkimage(int w, int h);
+
+/**
+ * freeimage - Libera una imagen creada con mkimage().
+ */
+void freeimage(Image *im);
+
+/**
+ * rasterize - Dibuja los segmentos ajustados y centrados en la imagen.
+ */
+void rasterize(Image *im, Seg *segs, size_t n);
+
+/**
+ * writeppm - Escribe la imagen como PPM binario; devuelve -1 si falla.
+ */
+int writeppm(Image *im, FILE *fp);
+
+/**
+ * writepng - Escribe la imagen como PNG en escala de grises; devuelve -1 si falla.
+ */
+int writepng(Image *im, FILE *fp);
+
+/**
+ * rdinit - Sitúa un lector en el símbolo i de una generación empaquetada.
+ */
+static inline void rdinit(Reader *r, const uint64_t *w, size_t i, int bits) {
+	r->bits = bits;
+	r->per = 64 / bits;
+	r->mask = ((uint64_t)1 << bits) - 1;
+	r->w = w + i / r->per;
+	r->slot = i % r->per;
+	r->cur = *r->w >> (r->slot * bits);
+}
+
+/**
+ * rdnext - Devuelve el siguiente código y avanza el lector.
+ */
+static inline unsigned rdnext(Reader *r) {
+	if (r->slot == r->per) {
+		r->cur = *++r->w;
+		r->slot = 0;
+	}
+	unsigned c = r->cur & r->mask;
+	r->cur >>= r->bits;
+	r->slot++;
+	return c;
+}
+
+/**
+ * pkwords - Palabras de 64 bits que ocupan n símbolos empaquetados.
+ */
+size_t pkwords(Lsystem *ls, size_t n);
+
+/**
+ * pack - Empaqueta n símbolos en w con el alfabeto del L-system.
+ */
+void pack(Lsystem *ls, const char *s, size_t n, uint64_t *w);
+
+/**
+ * unpack - Desempaqueta n símbolos a partir de la posición start.
+ */
+void unpack(Lsystem *ls, const uint64_t *w, size_t start, size_t n, char *out);
+
+/**
+ * mkpkarena - Crea búferes de generación empaquetados con el axioma.
+ */
+Arena* mkpkarena(Lsystem *ls);
+
+/**
+ * pknext - Expande la generación empaquetada actual sin desempaquetarla.
+ * Devuelve la nueva longitud en símbolos.
+ */
+size_t pknext(Arena *a, Lsystem *ls, int threads);
+
+/**
+ * turtlepk - Como turtle(), pero interpretando una generación empaquetada.
+ */
+Seg* turtlepk(Lsystem *ls, const uint64_t *w, size_t len, double x, double y, size_t *nseg, int threads);
+
+/**
+ * profiling - 1 si la instrumentación está activa (LSYSTEM_PROF=1), 0 si no,
+ * -1 antes de leer la variable de entorno.
+ */
+extern int profiling;
+
+/**
+ * profinit - Lee LSYSTEM_PROF; si está activa, el informe se escribe en
+ * stderr al salir del programa. Devuelve profiling.
+ */
+int profinit(void);
+
+/**
+ * profon - Comprobación barata de si hay que medir.
+ */
+#define profon() (profiling > 0 || (profiling < 0 && profinit()))
+
+/**
+ * profstart - Empieza una medida en el hilo que llama.
+ */
+void profstart(Mark *m);
+
+/**
+ * profstop - Suma a la fase phase los eventos desde profstart() y, si wall
+ * es 1, también el tiempo de reloj y una llamada.
+ */
+void profstop(int phase, Mark *m, int wall);
+
+/**
+ * profthread - Suma al hilo t su tiempo ocupado y ocioso en nanosegundos.
+ */
+void profthread(int t, uint64_t busyns, uint64_t idlens);
+
+/**
+ * profclock - Reloj monótono en nanosegundos.
+ */
+uint64_t profclock(void);
+
+/**
+ * profreport - Escribe en stderr los totales por fase y por hilo.
+ */
+void profreport(void);
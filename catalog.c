@@ -0,0 +1,270 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "a.h"
+
+#define POOLCHUNK (1 << 20)	// Bytes por bloque de una Pool
+#define POOLALIGN 16
+
+/**
+ * Definición de un L-system dentro de un archivo cargado.
+ */
+typedef struct
+{
+	const char*	file;     // Archivo de origen
+	const char*	text;     // Comienzo de la definición
+	size_t	len;
+} Piece;
+
+/**
+ * Archivo del catálogo cargado en memoria.
+ */
+typedef struct
+{
+	char*	path;
+	char*	text;
+	size_t	len;
+	int	mapped;
+} Src;
+
+/**
+ * mkpool - Crea una memoria por bloques vacía.
+ */
+Pool* mkpool(void) {
+	return emalloc(sizeof(Pool));
+}
+
+/**
+ * palloc - Reserva n bytes a cero en pool.
+ *
+ * Los bloques se reservan con emalloc(), ya a cero, así que reservar es solo
+ * avanzar dentro del bloque. Sin pool es un emalloc() normal.
+ */
+void* palloc(Pool *pool, size_t n) {
+	if (pool == NULL)
+		return emalloc(n);
+	n = (n + POOLALIGN - 1) / POOLALIGN * POOLALIGN;
+	if (pool->used + n > pool->cap) {
+		if (pool->p) {
+			Pool *old = emalloc(sizeof(Pool));
+			*old = *pool;
+			pool->next = old;
+		}
+		pool->cap = n > POOLCHUNK ? n : POOLCHUNK;
+		pool->p = emalloc(pool->cap);
+		pool->used = 0;
+	}
+	void *p = pool->p + pool->used;
+	pool->used += n;
+	return p;
+}
+
+/**
+ * pstrdup - Copia los n caracteres de s, terminados en '\0', en pool.
+ */
+char* pstrdup(Pool *pool, const char *s, size_t n) {
+	char *p = palloc(pool, n + 1);
+	memcpy(p, s, n);
+	p[n] = '\0';
+	return p;
+}
+
+/**
+ * freepool - Libera una memoria por bloques y todo lo reservado en ella.
+ */
+void freepool(Pool *pool) {
+	if (pool == NULL)
+		return;
+	free(pool->p);
+	for (Pool *b = pool->next, *n; b; b = n) {
+		n = b->next;
+		free(b->p);
+		free(b);
+	}
+	free(pool);
+}
+
+static int bypath(const void *a, const void *b) {
+	return strcmp(((const Src*)a)->path, ((const Src*)b)->path);
+}
+
+/**
+ * listfiles - Archivos regulares de un directorio (sin los ocultos),
+ * ordenados por nombre para que el catálogo no dependa del sistema de
+ * archivos; o el propio path si no es un directorio.
+ */
+static Src* listfiles(const char *path, int *n) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		perror(path);
+		exit(1);
+	}
+	int cap = 16;
+	Src *src = emalloc(cap * sizeof(Src));
+	*n = 0;
+	if (!S_ISDIR(st.st_mode)) {
+		src[(*n)++].path = strdup(path);
+		return src;
+	}
+
+	DIR *d = opendir(path);
+	if (d == NULL) {
+		perror(path);
+		exit(1);
+	}
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.')
+			continue;
+		char *f = emalloc(strlen(path) + strlen(e->d_name) + 2);
+		sprintf(f, "%s/%s", path, e->d_name);
+		if (stat(f, &st) != 0 || !S_ISREG(st.st_mode)) {
+			free(f);
+			continue;
+		}
+		if (*n == cap) {
+			cap *= 2;
+			src = realloc(src, cap * sizeof(Src));
+			if (src == NULL) {
+				fprintf(stderr, "loadcatalog: sin memoria\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		src[(*n)++].path = f;
+	}
+	closedir(d);
+	qsort(src, *n, sizeof(Src), bypath);
+	return src;
+}
+
+/**
+ * loadcatalog - Carga todos los L-systems de un directorio o de un archivo
+ * con varias definiciones seguidas.
+ *
+ * @path: Directorio (se cargan todos sus archivos, en orden de nombre) o
+ *        archivo; cada archivo puede tener varias definiciones, y cada
+ *        'name' empieza una nueva. Los archivos binarios o que no se
+ *        pueden leer y las definiciones con errores se omiten (con un
+ *        mensaje en stderr), sin abandonar las demás.
+ * @threads: Hilos que parsean.
+ * @return: Catálogo con los sistemas en el orden en que aparecen.
+ *
+ * Los archivos se proyectan en memoria y se trocean en definiciones con una
+ * pasada rápida por los tokens; después cada hilo parsea definiciones
+ * enteras directamente del texto proyectado, sin copiarlo. Las cadenas y
+ * reglas de todos los sistemas que parsea un hilo van a su Pool: miles de
+ * sistemas cuestan unas pocas reservas, y liberarlos, unas pocas free().
+ */
+Catalog* loadcatalog(const char *path, int threads) {
+	Mark m;
+	profstart(&m);
+
+	int nsrc;
+	Src *src = listfiles(path, &nsrc);
+	size_t npiece = 0, cap = 64;
+	Piece *pieces = emalloc(cap * sizeof(Piece));
+	for (int f = 0; f < nsrc; f++) {
+		src[f].text = loadfile(src[f].path, &src[f].len, &src[f].mapped);
+		if (src[f].text == NULL) {	// Ya se ha explicado por qué
+			fprintf(stderr, "%s: se omite, no se puede leer\n", src[f].path);
+			continue;
+		}
+		const char *p = src[f].text, *end = p + src[f].len;
+		if (memchr(p, '\0', src[f].len) != NULL) {	// Imágenes y otros binarios del directorio
+			fprintf(stderr, "%s: se omite, no es una definición\n", src[f].path);
+			continue;
+		}
+		while (p < end) {
+			const char *q = sysend(src[f].path, p, end);
+			if (npiece == cap) {
+				cap *= 2;
+				pieces = realloc(pieces, cap * sizeof(Piece));
+				if (pieces == NULL) {
+					fprintf(stderr, "loadcatalog: sin memoria\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			pieces[npiece++] = (Piece){ src[f].path, p, q - p };
+			p = q;
+		}
+	}
+
+	Catalog *cat = emalloc(sizeof(Catalog));
+	cat->n = npiece;
+	cat->sys = emalloc((npiece + 1) * sizeof(Lsystem*));
+	cat->npool = threads < 1 ? 1 : threads;
+#ifndef _OPENMP
+	cat->npool = 1;
+#endif
+	cat->pools = emalloc(cat->npool * sizeof(Pool*));
+	for (int t = 0; t < cat->npool; t++)
+		cat->pools[t] = mkpool();
+
+	// Las definiciones son independientes: cada hilo toma la siguiente libre
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(cat->npool) schedule(dynamic, 16)
+#endif
+	for (size_t i = 0; i < npiece; i++) {
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		cat->sys[i] = tryparse(pieces[i].file, pieces[i].text, pieces[i].len, cat->pools[t]);
+		if (cat->sys[i] == NULL)
+			fprintf(stderr, "%s: se omite una definición con errores\n", pieces[i].file);
+	}
+
+	// Se quitan los huecos de las definiciones omitidas, sin cambiar el orden
+	size_t n = 0;
+	for (size_t i = 0; i < npiece; i++)
+		if (cat->sys[i])
+			cat->sys[n++] = cat->sys[i];
+	cat->sys[n] = NULL;
+	cat->n = n;
+
+	for (int f = 0; f < nsrc; f++) {
+		if (src[f].text)
+			unloadfile(src[f].text, src[f].len, src[f].mapped);
+		free(src[f].path);
+	}
+	free(src);
+	free(pieces);
+	profstop(P_PARSE, &m, 1);
+	return cat;
+}
+
+/**
+ * findsystem - L-system del catálogo con ese nombre, o NULL.
+ *
+ * Un '_' en name vale por un espacio del nombre, para poder nombrar los
+ * sistemas en listas separadas por espacios ("Fractal_Plant").
+ */
+Lsystem* findsystem(Catalog *cat, const char *name) {
+	for (size_t i = 0; i < cat->n; i++) {
+		const char *a = cat->sys[i]->name, *b = name;
+		while (*a && (*a == *b || (*a == ' ' && *b == '_')))
+			a++, b++;
+		if (*a == '\0' && *b == '\0')
+			return cat->sys[i];
+	}
+	return NULL;
+}
+
+/**
+ * freecatalog - Libera un catálogo y todos sus L-systems.
+ */
+void freecatalog(Catalog *cat) {
+	for (size_t i = 0; i < cat->n; i++)
+		freelsystem(cat->sys[i]);
+	for (int t = 0; t < cat->npool; t++)
+		freepool(cat->pools[t]);
+	free(cat->pools);
+	free(cat->sys);
+	free(cat);
+}
@@ -0,0 +1,262 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "a.h"
+
+#define CKPAGE 4096			// La cabecera ocupa una página y cada sección empieza en una
+#define CKCHUNK (4 << 20)	// Bytes por escritura; múltiplo de 8 (ver mix())
+#define CKORDER 0x01020304u	// Detecta un archivo escrito con otro orden de bytes
+
+static const char ckmagic[8] = "LSCKPT1\n";
+static const char ckend[8] = "LSCKEND\n";
+
+/**
+ * Cabecera de un checkpoint, al principio de su primera página.
+ *
+ * Detrás van los símbolos en stride bytes (len símbolos, '\0' y ceros),
+ * los npar arrays de parámetros de stride doubles cada uno y el Cktail.
+ * Cada sección empieza en una página para proyectarla por separado.
+ */
+typedef struct
+{
+	char	magic[8];     // ckmagic
+	uint32_t	order;    // CKORDER
+	int32_t	depth;        // Número de la generación
+	uint64_t	rules;    // rulehash() del L-system que la produjo
+	uint64_t	len;      // Símbolos de la generación
+	uint64_t	stride;   // Bytes de la sección de símbolos (múltiplo de CKPAGE)
+	int32_t	npar;         // Arrays de parámetros (0 si no es paramétrico)
+	int32_t	pad;
+} Ckhdr;
+
+/**
+ * Cola del checkpoint: suma de comprobación de todo lo anterior.
+ */
+typedef struct
+{
+	uint64_t	sum;      // mix() de la cabecera, los símbolos y los parámetros
+	char	magic[8];     // ckend
+} Cktail;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return x << r | x >> (64 - r);
+}
+
+/**
+ * mix - Añade n bytes a la suma h, de 8 en 8 (los que sobran al final, con
+ * ceros). Una sección puede pasarse en trozos si todos menos el último son
+ * múltiplos de 8. Es la ronda de xxHash64: varios GB/s con un solo hilo.
+ */
+static uint64_t mix(uint64_t h, const void *p, size_t n) {
+	const uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL;
+	const char *s = p;
+	uint64_t w;
+	for (; n >= 8; s += 8, n -= 8) {
+		memcpy(&w, s, 8);
+		h = rotl(h + w * P2, 31) * P1;
+	}
+	if (n > 0) {
+		w = 0;
+		memcpy(&w, s, n);
+		h = rotl(h + w * P2, 31) * P1;
+	}
+	return h;
+}
+
+static uint64_t mixstr(uint64_t h, const char *s) {
+	size_t n = s ? strlen(s) : 0;
+	h = mix(h, &n, sizeof n);
+	return s ? mix(h, s, n) : h;
+}
+
+/**
+ * rulehash - Huella de todo lo que decide las generaciones de un L-system.
+ *
+ * Cubre el axioma (con sus parámetros), las reglas en orden con sus pesos,
+ * contextos y condiciones, la semilla y las opciones de contexto; no los
+ * ángulos ni la longitud de línea, que solo cambian el dibujo.
+ */
+uint64_t rulehash(Lsystem *ls) {
+	uint64_t h = mixstr(0, ls->axiom);
+	if (ls->param)
+		h = mix(h, ls->axpar, ls->npar * (strlen(ls->axiom) + 1) * sizeof(double));
+	for (Rule *r = ls->rules; r; r = r->next) {
+		h = mix(h, &r->pred, 1);
+		h = mixstr(h, r->succ);
+		h = mix(h, &r->weight, sizeof r->weight);
+		h = mixstr(h, r->left);
+		h = mixstr(h, r->right);
+		h = mixstr(h, r->formal);
+		h = mixstr(h, r->cond);
+	}
+	h = mix(h, &ls->seed, sizeof ls->seed);
+	h = mix(h, ls->ignore, sizeof ls->ignore);
+	return mix(h, &ls->skipbranch, sizeof ls->skipbranch);
+}
+
+/**
+ * section - Escribe n bytes de p por trozos de CKCHUNK, sumándolos, y los
+ * ceros que faltan hasta total. Devuelve 0, o -1 si falla.
+ */
+static int section(int fd, uint64_t *sum, const char *p, size_t n, size_t total) {
+	static const char zeros[CKPAGE];
+	for (size_t off = 0; off < n; off += CKCHUNK) {
+		size_t k = n - off < CKCHUNK ? n - off : CKCHUNK;
+		*sum = mix(*sum, p + off, k);
+		if (writeall(fd, p + off, k) != 0)
+			return -1;
+	}
+	for (size_t z = n; z < total; ) {
+		size_t k = total - z < CKPAGE ? total - z : CKPAGE;
+		if (writeall(fd, zeros, k) != 0)
+			return -1;
+		z += k;
+	}
+	return 0;
+}
+
+/**
+ * cksave - Guarda la generación actual de a en un checkpoint.
+ *
+ * @a: Búferes de generación sin empaquetar (mkarena()).
+ * @ls: L-system que la produjo.
+ * @path: Archivo de salida, o "-" para la salida estándar.
+ * @return: 0, o -1 si no se pudo escribir.
+ *
+ * Se escribe de principio a fin por trozos, sin volver atrás (vale una
+ * tubería), y la suma va al final. Un archivo se escribe con otro nombre y
+ * se renombra al terminar: nunca queda un checkpoint a medias con el
+ * nombre bueno.
+ */
+int cksave(Arena *a, Lsystem *ls, const char *path) {
+	Ckhdr hdr = { .order = CKORDER, .depth = a->depth, .rules = rulehash(ls), .len = a->len };
+	memcpy(hdr.magic, ckmagic, sizeof hdr.magic);
+	hdr.stride = (a->len + 1 + CKPAGE - 1) / CKPAGE * CKPAGE;
+	hdr.npar = ls->param ? ls->npar : 0;
+
+	int out = strcmp(path, "-") == 0;
+	char *tmp = NULL;
+	int fd = STDOUT_FILENO;
+	if (!out) {
+		tmp = emalloc(strlen(path) + 5);
+		sprintf(tmp, "%s.tmp", path);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror(tmp);
+			free(tmp);
+			return -1;
+		}
+	}
+
+	char page[CKPAGE] = { 0 };
+	memcpy(page, &hdr, sizeof hdr);
+	uint64_t sum = 0;
+	int err = section(fd, &sum, page, CKPAGE, CKPAGE);
+	if (!err)
+		err = section(fd, &sum, arenagen(a), a->len, hdr.stride);
+	const double *par = a->par[a->cur] ? a->par[a->cur] : ls->axpar;
+	for (int k = 0; k < hdr.npar && !err; k++)
+		err = section(fd, &sum, (const char*)(par + k * a->cap[a->cur]), a->len * sizeof(double),
+		              hdr.stride * sizeof(double));
+	Cktail tail = { .sum = sum };
+	memcpy(tail.magic, ckend, sizeof tail.magic);
+	if (!err)
+		err = writeall(fd, (const char*)&tail, sizeof tail);
+
+	if (!out) {
+		if (close(fd) != 0)
+			err = -1;
+		if (!err && rename(tmp, path) != 0)
+			err = -1;
+		if (err)
+			unlink(tmp);
+		free(tmp);
+	}
+	return err ? -1 : 0;
+}
+
+/**
+ * ckload - Abre un checkpoint como búferes de generación listos para seguir.
+ *
+ * @path: Checkpoint escrito con cksave().
+ * @ls: L-system con el que se va a seguir expandiendo.
+ * @return: Búferes con la generación guardada como actual (y su número en
+ *          depth), o NULL si el archivo no es válido, está dañado o es de
+ *          otras reglas (se explica en stderr).
+ *
+ * Los símbolos y los parámetros no se leen ni se copian: se proyectan con
+ * mmap() privado y ooc.c los libera como cualquier búfer grande. La suma se
+ * comprueba recorriendo la proyección una vez, lo que además trae las
+ * páginas que la primera expansión va a leer.
+ */
+Arena* ckload(const char *path, Lsystem *ls) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	struct stat st;
+	Ckhdr hdr;
+	Cktail tail;
+	char page[CKPAGE];
+	const char *why = NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < CKPAGE + (off_t)sizeof tail ||
+	    pread(fd, page, CKPAGE, 0) != CKPAGE)
+		why = "demasiado corto";
+	else {
+		memcpy(&hdr, page, sizeof hdr);
+		if (memcmp(hdr.magic, ckmagic, sizeof hdr.magic) != 0)
+			why = "no es un checkpoint";
+		else if (hdr.order != CKORDER)
+			why = "escrito en una máquina con otro orden de bytes";
+		else if (hdr.rules != rulehash(ls))
+			why = "es de otro L-system o de otras reglas";
+		else if (hdr.depth < 0 || hdr.stride < hdr.len + 1 || hdr.stride % CKPAGE != 0 ||
+		         hdr.npar != (ls->param ? ls->npar : 0) ||
+		         (uint64_t)st.st_size != CKPAGE + hdr.stride * (1 + hdr.npar * sizeof(double)) + sizeof tail)
+			why = "longitudes incoherentes";
+		else if (pread(fd, &tail, sizeof tail, st.st_size - sizeof tail) != sizeof tail ||
+		         memcmp(tail.magic, ckend, sizeof tail.magic) != 0)
+			why = "incompleto";
+	}
+	if (why) {
+		fprintf(stderr, "%s: %s\n", path, why);
+		close(fd);
+		return NULL;
+	}
+
+	char *gen = oocmap(fd, CKPAGE, hdr.stride);
+	double *par = hdr.npar ? oocmap(fd, CKPAGE + hdr.stride, hdr.npar * hdr.stride * sizeof(double)) : NULL;
+	close(fd);
+	if (gen == NULL || (hdr.npar && par == NULL)) {
+		fprintf(stderr, "%s: no se pudo proyectar\n", path);
+		bigfree(gen);
+		bigfree(par);
+		return NULL;
+	}
+
+	uint64_t sum = mix(0, page, CKPAGE);
+	sum = mix(sum, gen, hdr.len);
+	for (int k = 0; k < hdr.npar; k++)
+		sum = mix(sum, par + k * hdr.stride, hdr.len * sizeof(double));
+	if (sum != tail.sum || gen[hdr.len] != '\0') {
+		fprintf(stderr, "%s: la suma de comprobación no coincide (archivo dañado)\n", path);
+		bigfree(gen);
+		bigfree(par);
+		return NULL;
+	}
+
+	Arena *a = emalloc(sizeof(Arena));
+	a->buf[0] = gen;
+	a->cap[0] = hdr.stride;
+	a->par[0] = par;
+	a->len = hdr.len;
+	a->depth = hdr.depth;
+	a->peak = hdr.stride * (1 + hdr.npar * sizeof(double));
+	return a;
+}
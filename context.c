@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+#define SCAN 1024	// Símbolos que se recorren antes de emparejar los corchetes
+
+/**
+ * mkbrackets - Corchetes de gen, sin emparejar todavía.
+ */
+Brackets* mkbrackets(Lsystem *ls, const char *gen, size_t len) {
+	if (!ls->ctx || !ls->skipbranch)
+		return NULL;
+	Brackets *br = emalloc(sizeof(Brackets));
+	br->gen = gen;
+	br->len = len;
+	return br;
+}
+
+/**
+ * pairup - Empareja todos los corchetes de la generación con una pila.
+ */
+static void pairup(Brackets *br) {
+	const char *gen = br->gen;
+	for (size_t i = 0; i < br->len; i++)
+		br->n += gen[i] == '[' || gen[i] == ']';
+	br->pos = emalloc((br->n + 1) * sizeof(size_t));
+	br->mate = emalloc((br->n + 1) * sizeof(size_t));
+	size_t *stk = emalloc((br->n + 1) * sizeof(size_t));	// Índices en pos de los '[' abiertos
+	size_t k = 0, nopen = 0;
+	for (size_t i = 0; i < br->len; i++) {
+		if (gen[i] != '[' && gen[i] != ']')
+			continue;
+		br->pos[k] = i;
+		br->mate[k] = SIZE_MAX;
+		if (gen[i] == '[')
+			stk[nopen++] = k;
+		else if (nopen > 0) {
+			size_t o = stk[--nopen];
+			br->mate[o] = i;
+			br->mate[k] = br->pos[o];
+		}
+		k++;
+	}
+	free(stk);
+}
+
+/**
+ * freebrackets - Libera unos corchetes de mkbrackets().
+ */
+void freebrackets(Brackets *br) {
+	if (br == NULL)
+		return;
+	free(br->pos);
+	free(br->mate);
+	free(br);
+}
+
+/**
+ * mate - Posición de la pareja del corchete gen[i], o -1 si no tiene.
+ *
+ * Las ramas cortas se recorren. Recorrer así las largas costaría O(n) por
+ * símbolo, O(n²) por generación en una planta con muchas ramas: pasados
+ * SCAN símbolos se emparejan una vez todos los corchetes de la generación
+ * (el primer hilo que lo necesita, los demás esperan) y cada salto es
+ * desde entonces una búsqueda binaria.
+ */
+static long mate(Brackets *br, long i) {
+	const char *gen = br->gen;
+	int dir = gen[i] == '[' ? 1 : -1;
+	int depth = 1;
+	long j = i;
+	for (int n = 0; n < SCAN; n++) {
+		j += dir;
+		if (j < 0 || (size_t)j >= br->len)
+			return -1;
+		depth += gen[j] == gen[i] ? 1 : gen[j] == '[' || gen[j] == ']' ? -1 : 0;
+		if (depth == 0)
+			return j;
+	}
+
+	if (!__atomic_load_n(&br->ready, __ATOMIC_ACQUIRE)) {
+#ifdef _OPENMP
+		#pragma omp critical(brackets)
+#endif
+		if (!br->ready) {
+			pairup(br);
+			__atomic_store_n(&br->ready, 1, __ATOMIC_RELEASE);
+		}
+	}
+	size_t lo = 0, hi = br->n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (br->pos[mid] < (size_t)i)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return br->mate[lo] == SIZE_MAX ? -1 : (long)br->mate[lo];
+}
+
+/**
+ * leftof - Posición del símbolo de contexto anterior a i, o -1 si no hay.
+ *
+ * Se saltan los símbolos de ls->ignore. Con ls->skipbranch una rama
+ * completa "[...]" a la izquierda no es contexto (se salta entera, hasta la
+ * pareja de su ']') y un '[' lleva al símbolo del que sale la rama.
+ */
+static long leftof(Lsystem *ls, const char *gen, Brackets *br, long i) {
+	while (--i >= 0) {
+		unsigned char c = gen[i];
+		if (ls->skipbranch && c == ']') {
+			if ((i = mate(br, i)) < 0)
+				return -1;
+			continue;
+		}
+		if (ls->skipbranch && c == '[')
+			continue;
+		if (!ls->ignore[c])
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * rightof - Posición del símbolo de contexto siguiente a i, o -1 si no hay.
+ *
+ * Con ls->skipbranch las ramas "[...]" que salen a la derecha se saltan
+ * hasta la pareja de su '[' y un ']' termina la rama actual: más allá ya
+ * no hay contexto.
+ */
+static long rightof(Lsystem *ls, const char *gen, size_t len, Brackets *br, long i) {
+	while ((size_t)++i < len) {
+		unsigned char c = gen[i];
+		if (ls->skipbranch && c == '[') {
+			if ((i = mate(br, i)) < 0)
+				return -1;
+			continue;
+		}
+		if (ls->skipbranch && c == ']')
+			return -1;
+		if (!ls->ignore[c])
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * matches - 1 si el contexto de gen[i] coincide con el de x.
+ */
+static int matches(Lsystem *ls, Ctx *x, const char *gen, size_t len, Brackets *br,
+                   size_t i) {
+	long j = i;
+	for (size_t k = x->llen; k-- > 0; ) {
+		j = leftof(ls, gen, br, j);
+		if (j < 0 || gen[j] != x->left[k])
+			return 0;
+	}
+	j = i;
+	for (size_t k = 0; k < x->rlen; k++) {
+		j = rightof(ls, gen, len, br, j);
+		if (j < 0 || gen[j] != x->right[k])
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * context - Producción de gen[i] teniendo en cuenta sus vecinos.
+ *
+ * @p: Entrada de la tabla del símbolo (con p->nctx > 0).
+ * @gen, @len: Generación completa de la que se lee el contexto.
+ * @br: Corchetes de gen emparejados con mkbrackets() (NULL sin skipbranch).
+ * @return: La de la primera regla con contexto que coincide, en el orden del
+ *          archivo, o p (la regla sin contexto o la identidad) si ninguna.
+ *
+ * Solo lee gen, nunca la escribe, así que en la expansión paralela cada
+ * bloque lee el contexto de sus vecinos (su halo) directamente del búfer de
+ * entrada compartido, sin copiarlo ni esperar a otros hilos.
+ */
+Prod* context(Lsystem *ls, Prod *p, const char *gen, size_t len, Brackets *br, size_t i) {
+	for (int k = 0; k < p->nctx; k++)
+		if (matches(ls, &p->ctx[k], gen, len, br, i))
+			return &p->ctx[k].prod;
+	return p;
+}
+
+/**
+ * contextual - Compila las reglas con contexto de la lista del L-system.
+ *
+ * Las de cada símbolo se guardan en su entrada de la tabla en el orden del
+ * archivo; la entrada conserva la regla sin contexto (si la hay) para los
+ * casos en que no coincide ninguna.
+ */
+void contextual(Lsystem *ls) {
+	ls->ctx = 0;
+	for (Rule *r = ls->rules; r; r = r->next)
+		if (r->left || r->right)
+			lookup(ls, r->pred)->nctx++;
+
+	for (int c = 0; c < 256; c++) {
+		Prod *p = &ls->table[c];
+		if (p->nctx == 0)
+			continue;
+		// La lista está al revés que el archivo: se llena desde el final
+		p->ctx = emalloc(p->nctx * sizeof(Ctx));
+		int k = p->nctx;
+		for (Rule *r = ls->rules; r; r = r->next)
+			if ((unsigned char)r->pred == c && (r->left || r->right)) {
+				Ctx *x = &p->ctx[--k];
+				x->left = r->left ? r->left : "";
+				x->right = r->right ? r->right : "";
+				x->llen = strlen(x->left);
+				x->rlen = strlen(x->right);
+				x->prod.succ = r->succ;
+				x->prod.len = strlen(r->succ);
+			}
+		ls->ctx = 1;
+	}
+}
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+/**
+ * addnode - Crea un nodo y lo añade a la lista de nodos del DAG.
+ *
+ * Los nodos se numeran en orden de creación; como los hijos se crean antes
+ * que el padre, la lista queda en orden topológico (hijos primero).
+ */
+static Node* addnode(Dag *g, char sym, int depth, size_t nkids) {
+	if (g->nnodes == g->cap) {
+		g->cap = g->cap ? 2 * g->cap : 256;
+		g->nodes = realloc(g->nodes, g->cap * sizeof(Node*));
+		if (g->nodes == NULL) {
+			fprintf(stderr, "dag: sin memoria para %zu nodos\n", g->cap);
+			exit(EXIT_FAILURE);
+		}
+	}
+	Node *n = emalloc(sizeof(Node) + nkids * sizeof(Node*));
+	n->sym = sym;
+	n->depth = depth;
+	n->id = g->nnodes;
+	n->nkids = nkids;
+	n->len = depth == 0;	// Las hojas son un símbolo; el resto suma sus hijos
+	g->nodes[g->nnodes++] = n;
+	return n;
+}
+
+/**
+ * getnode - Nodo único de la expansión de c tras d derivaciones.
+ *
+ * La tabla memo indexa los nodos por (d, c), así que cada par se crea una
+ * sola vez y todos los padres comparten el mismo hijo. Un símbolo sin regla
+ * se expande a sí mismo en cualquier profundidad: se usa su hoja (c, 0).
+ */
+static Node* getnode(Dag *g, char c, int d) {
+	Prod *p = lookup(g->ls, c);
+	if (p->ident)
+		d = 0;
+
+	Node **slot = &g->memo[(size_t)d * 256 + (unsigned char)c];
+	if (*slot)
+		return *slot;
+
+	if (d == 0)
+		return *slot = addnode(g, c, 0, 0);
+
+	Node **kids = emalloc(p->len * sizeof(Node*));
+	for (size_t i = 0; i < p->len; i++)
+		kids[i] = getnode(g, p->succ[i], d - 1);
+
+	Node *n = addnode(g, c, d, p->len);
+	for (size_t i = 0; i < p->len; i++) {
+		n->kids[i] = kids[i];
+		n->len = satadd(n->len, kids[i]->len);
+	}
+	free(kids);
+	return *slot = n;
+}
+
+/**
+ * mkdag - Representa la generación depth como un DAG de nodos compartidos.
+ *
+ * @ls: L-system ya compilado.
+ * @depth: Generación que se representa.
+ * @return: DAG cuya raíz tiene un hijo (símbolo, depth) por símbolo del axioma.
+ *
+ * En un D0L la expansión de un símbolo tras d derivaciones es siempre la
+ * misma, así que hay como mucho un nodo por par (símbolo, d): la memoria
+ * crece linealmente con depth aunque la generación crezca exponencialmente.
+ * Las longitudes de cada nodo se guardan saturadas en UINT64_MAX.
+ */
+Dag* mkdag(Lsystem *ls, int depth) {
+	if (ls->stoch || ls->ctx || ls->param) {	// Dos apariciones de un símbolo no se expanden igual
+		fprintf(stderr, "mkdag: las reglas estocásticas, con contexto o paramétricas no admiten DAG\n");
+		exit(EXIT_FAILURE);
+	}
+	Dag *g = emalloc(sizeof(Dag));
+	g->ls = ls;
+	g->depth = depth;
+	g->memo = emalloc((size_t)(depth + 1) * 256 * sizeof(Node*));
+
+	size_t n = strlen(ls->axiom);
+	Node **kids = emalloc((n + 1) * sizeof(Node*));
+	for (size_t i = 0; i < n; i++)
+		kids[i] = getnode(g, ls->axiom[i], depth);
+
+	g->root = addnode(g, '\0', depth + 1, n);
+	g->root->len = 0;
+	for (size_t i = 0; i < n; i++) {
+		g->root->kids[i] = kids[i];
+		g->root->len = satadd(g->root->len, kids[i]->len);
+	}
+	free(kids);
+	return g;
+}
+
+/**
+ * freedag - Libera un DAG creado con mkdag() o dagload().
+ */
+void freedag(Dag *g) {
+	for (size_t i = 0; i < g->nnodes; i++)
+		free(g->nodes[i]);
+	free(g->nodes);
+	free(g->memo);
+	free(g);
+}
+
+/**
+ * daglen - Longitud de la generación (saturada en UINT64_MAX).
+ */
+uint64_t daglen(Dag *g) {
+	return g->root->len;
+}
+
+/**
+ * dagat - Símbolo de índice k de la generación, o -1 si no existe.
+ *
+ * Baja desde la raíz saltando los hijos que quedan enteros antes de k:
+ * O(depth × longitud de regla).
+ */
+int dagat(Dag *g, uint64_t k) {
+	Node *n = g->root;
+	if (k >= n->len)
+		return -1;
+	while (n->depth > 0) {
+		size_t i;
+		for (i = 0; i < n->nkids && k >= n->kids[i]->len; i++)
+			k -= n->kids[i]->len;
+		n = n->kids[i];
+	}
+	return (unsigned char)n->sym;
+}
+
+/**
+ * mkdagiter - Crea un iterador que empieza en el símbolo k de la generación.
+ *
+ * La pila tiene como mucho un marco por nivel (depth + 1), igual que Iter.
+ */
+Dagiter* mkdagiter(Dag *g, uint64_t k) {
+	Dagiter *it = emalloc(sizeof(Dagiter));
+	it->stack = emalloc((g->depth + 2) * sizeof(Visit));
+	it->count = k;
+	it->top = 0;
+
+	Visit *f = &it->stack[0];
+	f->node = g->root;
+	f->pos = 0;
+	if (k >= g->root->len) {
+		it->top = -1;
+		return it;
+	}
+	while (1) {
+		Node *n = f->node;
+		for (; k >= n->kids[f->pos]->len; f->pos++)
+			k -= n->kids[f->pos]->len;
+		Node *kid = n->kids[f->pos];
+		if (kid->depth == 0)	// dagnext() emitirá esta hoja
+			return it;
+		f->pos++;
+		f = &it->stack[++it->top];
+		f->node = kid;
+		f->pos = 0;
+	}
+}
+
+/**
+ * freedagiter - Libera un iterador creado con mkdagiter().
+ */
+void freedagiter(Dagiter *it) {
+	free(it->stack);
+	free(it);
+}
+
+/**
+ * dagnext - Devuelve el siguiente símbolo, o -1 al final de la generación.
+ */
+int dagnext(Dagiter *it) {
+	while (it->top >= 0) {
+		Visit *f = &it->stack[it->top];
+		if (f->pos == f->node->nkids) {	// Nodo agotado: vuelve al padre
+			it->top--;
+			continue;
+		}
+		Node *kid = f->node->kids[f->pos++];
+		if (kid->depth == 0) {
+			it->count++;
+			return (unsigned char)kid->sym;
+		}
+		Visit *g = &it->stack[++it->top];
+		g->node = kid;
+		g->pos = 0;
+	}
+	return -1;
+}
+
+/**
+ * dagread - Lee hasta n símbolos seguidos en buf; devuelve cuántos leyó.
+ */
+size_t dagread(Dagiter *it, char *buf, size_t n) {
+	size_t i = 0;
+	int c;
+	while (i < n && (c = dagnext(it)) >= 0)
+		buf[i++] = (char)c;
+	return i;
+}
+
+/**
+ * dagsave - Escribe la estructura del DAG (no la cadena expandida).
+ *
+ * Formato de texto: una cabecera "dag profundidad nodos" y una línea por
+ * nodo en orden topológico con "símbolo profundidad hijos id_hijo...", donde
+ * el símbolo va como número. La raíz es el último nodo. Ocupa lo mismo que el DAG.
+ * Devuelve -1 si falla la escritura.
+ */
+int dagsave(Dag *g, FILE *fp) {
+	fprintf(fp, "dag %d %zu\n", g->depth, g->nnodes);
+	for (size_t i = 0; i < g->nnodes; i++) {
+		Node *n = g->nodes[i];
+		fprintf(fp, "%d %d %zu", (unsigned char)n->sym, n->depth, n->nkids);
+		for (size_t j = 0; j < n->nkids; j++)
+			fprintf(fp, " %zu", n->kids[j]->id);
+		fputc('\n', fp);
+	}
+	return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * dagload - Lee un DAG escrito con dagsave().
+ *
+ * @return: DAG sin L-system asociado (ls es NULL) con las longitudes
+ *          recalculadas, o NULL si el formato no es válido.
+ *
+ * Sirve para consultar y recorrer la generación, no para seguir expandiendo.
+ * Los hijos de cada nodo se leen antes de reservarlo: un número de hijos
+ * absurdo en la cabecera del nodo no reserva nada que el archivo no traiga.
+ */
+Dag* dagload(FILE *fp) {
+	int depth;
+	size_t nnodes;
+	if (fscanf(fp, "dag %d %zu", &depth, &nnodes) != 2 || depth < 0 || nnodes == 0)
+		return NULL;
+
+	Dag *g = emalloc(sizeof(Dag));
+	g->depth = depth;
+	g->memo = NULL;
+	size_t cap = 64;
+	Node **kids = emalloc(cap * sizeof(Node*));
+	for (size_t i = 0; i < nnodes; i++) {
+		int sym, d;
+		size_t nkids, j;
+		if (fscanf(fp, "%d %d %zu", &sym, &d, &nkids) != 3 || sym < 0 || sym > 255 ||
+		    d < 0 || d > depth + 1 || (d == 0 && nkids > 0))
+			goto bad;
+		for (j = 0; j < nkids; j++) {
+			size_t id;
+			// Los hijos van antes y más abajo: la pila del iterador basta
+			if (fscanf(fp, "%zu", &id) != 1 || id >= g->nnodes || g->nodes[id]->depth >= d)
+				goto bad;
+			if (j == cap) {
+				Node **k = realloc(kids, 2 * cap * sizeof(Node*));
+				if (k == NULL)
+					goto bad;
+				kids = k;
+				cap *= 2;
+			}
+			kids[j] = g->nodes[id];
+		}
+		Node *n = addnode(g, (char)sym, d, nkids);
+		for (j = 0; j < nkids; j++) {
+			n->kids[j] = kids[j];
+			n->len = satadd(n->len, kids[j]->len);
+		}
+	}
+	free(kids);
+	kids = NULL;
+	g->root = g->nodes[nnodes - 1];
+	if (g->root->depth == 0)	// La raíz es una producción, no una hoja
+		goto bad;
+	return g;
+
+bad:
+	free(kids);
+	freedag(g);
+	return NULL;
+}
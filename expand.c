@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+/**
+ * production - Devuelve la producción asociada a un símbolo del sistema.
+ *
+ * @ls: L-system con la lista de reglas.
+ * @c: Símbolo a reescribir.
+ * @return: Sucesor de la regla, o NULL si el símbolo no tiene regla.
+ */
+char* production(Lsystem *ls, char c) {
+	Prod *p = lookup(ls, c);
+	return p->ident ? NULL : p->succ;
+}
+
+/**
+ * countchunk - Primera pasada: longitud de salida de un tramo de la entrada.
+ *
+ * Cada símbolo aporta la longitud de su producción (1 si no tiene regla),
+ * leída de la tabla compilada. Si la CPU lo permite se clasifican los
+ * símbolos por bloques con SIMD. Las reglas estocásticas se eligen con
+ * choose() según depth y la posición i, así que la segunda pasada vuelve a
+ * elegir exactamente lo mismo sin guardar nada. Las reglas con contexto
+ * miran los vecinos en gen[0, len), también fuera del tramo.
+ */
+static size_t countchunk(Lsystem *ls, const char *gen, size_t len, Brackets *br,
+                         size_t start, size_t end, int depth) {
+	if (ls->simd)
+		return simdcount(ls->simd, gen, start, end);
+
+	size_t n = 0;
+	for (size_t i = start; i < end; i++)
+		n += rewrite(ls, gen, len, br, depth, i)->len;
+	return n;
+}
+
+/**
+ * writechunk - Segunda pasada: escribe las producciones de un tramo
+ * directamente en su posición final del búfer de salida.
+ *
+ * @outend: Final del tramo de salida; los núcleos SIMD escriben bloques
+ *          completos y no deben pisar el tramo de otro hilo.
+ * @genend: Final de la generación de entrada.
+ * @br: Corchetes emparejados de la entrada, o NULL.
+ * @depth: Número de la generación de entrada.
+ */
+static void writechunk(Lsystem *ls, const char *gen, size_t start, size_t end,
+                       char *out, char *outend, const char *genend, Brackets *br, int depth) {
+	if (ls->simd) {
+		simdwrite(ls->simd, gen, start, end, out, outend, genend);
+		return;
+	}
+	for (size_t i = start; i < end; i++) {
+		Prod *p = rewrite(ls, gen, genend - gen, br, depth, i);
+		if (p->ident)
+			*out++ = gen[i];
+		else {
+			memcpy(out, p->succ, p->len);
+			out += p->len;
+		}
+	}
+}
+
+/**
+ * Reparto de una generación en bloques de entrada de grainsize() símbolos.
+ *
+ * off[b] es el desplazamiento de salida del bloque b y off[nb] el total.
+ * Tras la primera pasada sirve también como peso de cada bloque para la
+ * segunda, cuyo coste es proporcional a lo que escribe.
+ */
+typedef struct
+{
+	Lsystem*	ls;
+	const char*	gen;      // Generación de entrada
+	size_t	len;          // Longitud de gen
+	int	depth;            // Número de la generación de entrada
+	int	nt;               // Número de hilos
+	size_t	nb;           // Número de bloques
+	size_t	grain;        // Símbolos por bloque (el último puede tener menos)
+	size_t*	off;          // nb + 1 desplazamientos de salida
+	char*	out;          // Búfer de salida (segunda pasada)
+	const double*	par;  // Parámetros de gen (sistemas paramétricos)
+	size_t	stride;       // Distancia entre los arrays de par
+	double*	opar;         // Parámetros de la salida
+	size_t	ostride;      // Distancia entre los arrays de opar
+	Brackets*	br;       // Corchetes emparejados de gen (contexto con skipbranch)
+} Split;
+
+/**
+ * counttask - Primera pasada de un bloque: su longitud de salida.
+ */
+static void counttask(void *arg, size_t b) {
+	Split *sp = arg;
+	size_t start = b * sp->grain;
+	size_t end = start + sp->grain < sp->len ? start + sp->grain : sp->len;
+	if (sp->ls->param)
+		sp->off[b + 1] = pmcount(sp->ls, sp->gen, sp->par, sp->stride, start, end);
+	else
+		sp->off[b + 1] = countchunk(sp->ls, sp->gen, sp->len, sp->br, start, end, sp->depth);
+}
+
+/**
+ * writetask - Segunda pasada de un bloque: escribe en su desplazamiento.
+ */
+static void writetask(void *arg, size_t b) {
+	Split *sp = arg;
+	size_t start = b * sp->grain;
+	size_t end = start + sp->grain < sp->len ? start + sp->grain : sp->len;
+	if (sp->ls->param) {
+		pmwrite(sp->ls, sp->gen, sp->par, sp->stride, start, end, sp->out, sp->opar,
+		       sp->ostride, sp->off[b]);
+		return;
+	}
+	writechunk(sp->ls, sp->gen, start, end, sp->out + sp->off[b],
+	           sp->out + sp->off[b + 1], sp->gen + sp->len, sp->br, sp->depth);
+}
+
+/**
+ * plan - Divide la entrada en bloques, hace la primera pasada y la suma de
+ * prefijos. El tamaño de bloque lo elige grainsize().
+ */
+static void plan(Split *sp, Lsystem *ls, const char *gen, const double *par, size_t stride,
+                 size_t len, int depth, int threads) {
+	sp->ls = ls;
+	sp->gen = gen;
+	sp->par = par;
+	sp->stride = stride;
+	sp->len = len;
+	sp->depth = depth;
+	sp->nt = threads < 1 ? 1 : threads;
+	sp->grain = grainsize(len, sp->nt);
+	sp->br = mkbrackets(ls, gen, len);	// Solo con contexto que salta ramas
+	sp->nb = len ? (len + sp->grain - 1) / sp->grain : 1;
+	sp->off = emalloc((sp->nb + 1) * sizeof(size_t));
+
+	// Longitud de salida de cada bloque (el coste depende de la entrada)
+	Mark m;
+	profstart(&m);
+	schedule(sp->nt, sp->nb, NULL, counttask, sp, P_COUNT);
+	profstop(P_COUNT, &m, 1);
+
+	// Suma de prefijos: desplazamiento de cada bloque en la salida
+	profstart(&m);
+	sp->off[0] = 0;
+	for (size_t b = 0; b < sp->nb; b++)
+		sp->off[b + 1] += sp->off[b];
+	profstop(P_SCAN, &m, 1);
+}
+
+/**
+ * emit - Segunda pasada: cada bloque se escribe en su desplazamiento de out.
+ *
+ * Los bloques se reparten según lo que escriben, no según lo que leen, y
+ * los hilos que terminan antes roban bloques a los demás. Cada bloque
+ * escribe directamente en su sitio, así que no hay mezcla final. La entrada
+ * entera es de solo lectura durante las dos pasadas: las reglas con contexto
+ * leen los símbolos vecinos de otros bloques (el halo) sin sincronizarse.
+ */
+static void emit(Split *sp, char *out) {
+	Mark m;
+	profstart(&m);
+	sp->out = out;
+	schedule(sp->nt, sp->nb, sp->off, writetask, sp, P_WRITE);
+	out[sp->off[sp->nb]] = '\0';
+	profstop(P_WRITE, &m, 1);
+}
+
+/**
+ * expand - Calcula la siguiente generación en dos pasadas (contar y escribir).
+ *
+ * @ls: L-system con las reglas de producción.
+ * @gen: Generación actual.
+ * @len: Longitud de la generación actual.
+ * @depth: Número de la generación actual (elige las reglas estocásticas).
+ * @newlen: Si no es NULL, recibe la longitud de la nueva generación.
+ * @threads: Número de hilos (se ignora si no se compila con OpenMP).
+ * @return: Nueva generación terminada en '\0', reservada con el tamaño exacto.
+ *
+ * La entrada se divide en bloques pequeños. En la primera pasada se suma la
+ * longitud de salida de los símbolos de cada bloque; una suma de prefijos
+ * sobre esas longitudes da el desplazamiento de cada bloque en la salida. En
+ * la segunda pasada cada bloque escribe sus producciones en su
+ * desplazamiento, sin strcat ni mezcla final, así que cada generación cuesta
+ * tiempo lineal. Los bloques se reparten con robo de trabajo (schedule()).
+ * Los sistemas paramétricos necesitan los parámetros de gen: arenanext().
+ */
+char* expand(Lsystem *ls, const char *gen, size_t len, int depth, size_t *newlen, int threads) {
+	if (ls->param) {
+		fprintf(stderr, "expand: los sistemas paramétricos se expanden con arenanext()\n");
+		exit(EXIT_FAILURE);
+	}
+	Split sp;
+	plan(&sp, ls, gen, NULL, 0, len, depth, threads);
+
+	size_t total = sp.off[sp.nb];
+	char *out = malloc(total + 1);
+	if (out == NULL) {
+		fprintf(stderr, "expand: no hay memoria para %zu bytes\n", total + 1);
+		exit(EXIT_FAILURE);
+	}
+	emit(&sp, out);
+
+	free(sp.off);
+	freebrackets(sp.br);
+	if (newlen)
+		*newlen = total;
+	return out;
+}
+
+/**
+ * mkarena - Crea el par de búferes de generación con el axioma como actual.
+ */
+Arena* mkarena(const char *axiom) {
+	Arena *a = emalloc(sizeof(Arena));
+	a->len = strlen(axiom);
+	a->cap[0] = a->len + 1;
+	a->buf[0] = malloc(a->cap[0]);
+	if (a->buf[0] == NULL) {
+		fprintf(stderr, "mkarena: sin memoria\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(a->buf[0], axiom, a->len + 1);
+	a->cur = 0;
+	a->peak = a->cap[0];
+	return a;
+}
+
+/**
+ * freearena - Libera los búferes de generación.
+ */
+void freearena(Arena *a) {
+	bigfree(a->buf[0]);
+	bigfree(a->buf[1]);
+	bigfree(a->par[0]);
+	bigfree(a->par[1]);
+	free(a);
+}
+
+/**
+ * arenanext - Expande la generación actual en el otro búfer y los alterna.
+ *
+ * @a: Búferes de generación.
+ * @ls: L-system con las reglas.
+ * @threads: Número de hilos.
+ * @return: Longitud de la nueva generación.
+ *
+ * La primera pasada de expand() da la longitud exacta de la salida antes de
+ * escribirla. Si el búfer libre no tiene sitio se sustituye por uno de
+ * max(necesario, 1.5 × capacidad): se libera antes de reservar (su contenido
+ * es la generación anterior, que ya no hace falta) y se reserva con
+ * bigalloc(), sin el relleno a ceros de emalloc. En modo NUMA cada hilo toca
+ * primero las páginas de los bloques que va a escribir. La nueva generación queda como actual
+ * sin copiarla.
+ *
+ * Con LSYSTEM_OOC los búferes grandes son archivos proyectados: cada bloque
+ * se escribe en orden en su tramo y la pasada siguiente lo vuelve a leer en
+ * orden, así que el núcleo puede mantener en memoria solo las páginas que se
+ * están usando. Al reutilizar un búfer se descarta antes su contenido.
+ *
+ * En un sistema paramétrico cada búfer tiene además sus arrays de
+ * parámetros, de la misma capacidad; los de la generación 0 son los del
+ * axioma (ls->axpar). Cada bloque los lee y escribe en su tramo, igual que
+ * los símbolos.
+ */
+size_t arenanext(Arena *a, Lsystem *ls, int threads) {
+	const char *gen = a->buf[a->cur];
+	int nxt = !a->cur;
+	const double *par = a->par[a->cur] ? a->par[a->cur] : ls->axpar;
+	Split sp;
+	plan(&sp, ls, gen, par, a->cap[a->cur], a->len, a->depth, threads);
+	size_t need = sp.off[sp.nb] + 1;
+
+	int grow = a->cap[nxt] < need;
+	if (grow) {
+		size_t cap = a->cap[nxt] + a->cap[nxt] / 2;
+		if (cap < need)
+			cap = need;
+		bigfree(a->buf[nxt]);
+		a->buf[nxt] = bigalloc(cap);
+		if (a->buf[nxt] == NULL) {
+			fprintf(stderr, "arenanext: no hay memoria para %zu bytes (en uso %zu)\n",
+			        cap, a->cap[a->cur]);
+			exit(EXIT_FAILURE);
+		}
+		a->cap[nxt] = cap;
+		firsttouch(a->buf[nxt], sp.nt, sp.nb, sp.off);	// Solo con LSYSTEM_NUMA
+	} else
+		oocdrop(a->buf[nxt]);	// Solo con LSYSTEM_OOC
+	if (ls->param) {
+		if (grow || a->par[nxt] == NULL) {
+			bigfree(a->par[nxt]);
+			a->par[nxt] = bigalloc(ls->npar * a->cap[nxt] * sizeof(double));
+			if (a->par[nxt] == NULL) {
+				fprintf(stderr, "arenanext: no hay memoria para los parámetros\n");
+				exit(EXIT_FAILURE);
+			}
+		} else
+			oocdrop(a->par[nxt]);
+		sp.opar = a->par[nxt];
+		sp.ostride = a->cap[nxt];
+	}
+	emit(&sp, a->buf[nxt]);
+
+	a->len = sp.off[sp.nb];
+	a->cur = nxt;
+	a->depth++;
+	size_t bytes = a->cap[0] + a->cap[1];
+	if (ls->param)
+		bytes += (a->cap[0] + a->cap[1]) * ls->npar * sizeof(double);
+	if (bytes > a->peak)
+		a->peak = bytes;
+	free(sp.off);
+	freebrackets(sp.br);
+	return a->len;
+}
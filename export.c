@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "a.h"
+
+#define EXPCHUNK (4 << 20)	// Símbolos por búfer; múltiplo del bloque de O_DIRECT
+#define ALIGN 4096			// Alineación de búferes y escrituras con O_DIRECT
+#define MAXIOV 64			// Búferes por llamada a writev()
+
+/**
+ * writeall - Escribe n bytes en fd, reintentando escrituras parciales.
+ * Devuelve 0, o -1 si falla.
+ */
+int writeall(int fd, const char *buf, size_t n) {
+	while (n > 0) {
+		ssize_t w = write(fd, buf, n);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+
+/**
+ * nodirect - Quita O_DIRECT de fd para las escrituras que no están alineadas.
+ */
+static void nodirect(int fd) {
+#ifdef O_DIRECT
+	int fl = fcntl(fd, F_GETFL);
+	if (fl >= 0 && (fl & O_DIRECT))
+		fcntl(fd, F_SETFL, fl & ~O_DIRECT);
+#endif
+}
+
+/**
+ * flushbank - Escribe en orden los búferes de una tanda con writev().
+ *
+ * Con O_DIRECT solo se escriben así los bytes múltiplos de ALIGN; la cola
+ * (que solo tiene la última tanda) se escribe después sin O_DIRECT. Si el
+ * sistema de archivos rechaza O_DIRECT se quita y se sigue sin él.
+ */
+static int flushbank(int fd, char **bufs, const size_t *lens, int n) {
+	struct iovec iov[MAXIOV];
+	int niov = 0;
+	size_t total = 0;
+
+	for (int i = 0; i < n; i++)
+		if (lens[i] > 0) {
+			iov[niov].iov_base = bufs[i];
+			iov[niov].iov_len = lens[i];
+			total += lens[i];
+			niov++;
+		}
+
+	struct iovec *v = iov;
+	while (total > 0) {
+		size_t want = total;
+#ifdef O_DIRECT
+		int fl = fcntl(fd, F_GETFL);
+		if (fl >= 0 && (fl & O_DIRECT) && total % ALIGN != 0) {
+			want = total / ALIGN * ALIGN;
+			if (want == 0) {
+				nodirect(fd);
+				want = total;
+			}
+		}
+#endif
+		// Recorta el vector a want bytes sin perder el resto
+		int k = 0;
+		size_t got = 0, save = 0;
+		while (got + v[k].iov_len < want)
+			got += v[k++].iov_len;
+		save = v[k].iov_len;
+		v[k].iov_len = want - got;
+		ssize_t w = writev(fd, v, k + 1);
+		v[k].iov_len = save;
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EINVAL) {	// O_DIRECT no admitido por este sistema de archivos
+				int before = fcntl(fd, F_GETFL);
+				nodirect(fd);
+				if (before != fcntl(fd, F_GETFL))
+					continue;
+			}
+			return -1;
+		}
+		total -= w;
+		while (w > 0 && (size_t)w >= v->iov_len)
+			w -= (v++)->iov_len;
+		if (w > 0) {
+			v->iov_base = (char*)v->iov_base + w;
+			v->iov_len -= w;
+		}
+	}
+	return 0;
+}
+
+/**
+ * openout - Abre la salida de exportgen(): "-" es la salida estándar.
+ *
+ * Los archivos regulares se abren con O_DIRECT si se puede, para que la
+ * exportación no llene la caché de páginas; tuberías, terminales y sistemas
+ * de archivos que no lo admiten usan escrituras normales.
+ */
+static int openout(const char *path) {
+	if (strcmp(path, "-") == 0)
+		return STDOUT_FILENO;
+	int fd = -1;
+#ifdef O_DIRECT
+	struct stat st;
+	if (stat(path, &st) != 0 || S_ISREG(st.st_mode))
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+	if (fd < 0)
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	return fd;
+}
+
+/**
+ * writemodules - Escribe una generación paramétrica como texto, con los
+ * parámetros de cada módulo entre paréntesis: "F(1.5)[+A(3)]".
+ */
+static int writemodules(int fd, Lsystem *ls, Arena *a) {
+	const char *gen = arenagen(a);
+	const double *par = a->par[a->cur] ? a->par[a->cur] : ls->axpar;
+	char *buf = emalloc(EXPCHUNK + MAXMODULE);
+	size_t n = 0;
+	int err = 0;
+	for (size_t i = 0; i < a->len && !err; i++) {
+		n += fmtmodule(ls, gen[i], par, a->cap[a->cur], i, buf + n);
+		if (n >= EXPCHUNK) {
+			err = writeall(fd, buf, n);
+			n = 0;
+		}
+	}
+	if (!err)
+		err = writeall(fd, buf, n);
+	free(buf);
+	return err;
+}
+
+/**
+ * exportarena - exportgen() para las reglas con contexto o paramétricas.
+ *
+ * El contexto de un símbolo y sus parámetros están en la generación
+ * anterior, que el iterador perezoso no tiene: se construyen las
+ * generaciones con arenanext() (que puede usar LSYSTEM_OOC para no depender
+ * de la memoria) y la última se escribe de una vez. @n recibe los símbolos
+ * (módulos) escritos, no los bytes.
+ *
+ * La memoria crece con la generación. growth() solo da una cota superior
+ * para estas reglas, así que no se rechaza la exportación: se avisa si la
+ * cota no cabe en memlimit().
+ */
+static int exportarena(Lsystem *ls, int depth, const char *path, int threads, uint64_t *n) {
+	Growth g;
+	growth(ls, depth, &g);
+	if (g.bytes > memlimit())
+		fprintf(stderr, "exportgen: con contexto o parámetros la generación %d se construye entera; "
+		        "puede necesitar hasta %.1f MB y hay %.1f MB (LSYSTEM_OOC amplía el límite)\n",
+		        depth, g.bytes / 1048576.0, memlimit() / 1048576.0);
+
+	Arena *a = mkarena(ls->axiom);
+	for (int d = 0; d < depth; d++)
+		arenanext(a, ls, threads);
+
+	int fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int err = fd < 0 ? -1 : ls->param ? writemodules(fd, ls, a) : writeall(fd, arenagen(a), a->len);
+	if (err)
+		err = -1;
+	if (fd > STDOUT_FILENO && close(fd) != 0)
+		err = -1;
+	*n = err ? 0 : a->len;
+	freearena(a);
+	return err;
+}
+
+/**
+ * exportgen - Escribe la generación depth en path mientras se genera.
+ *
+ * @ls: L-system ya compilado por parse().
+ * @depth: Generación que se exporta (0 es el axioma).
+ * @path: Archivo de salida, o "-" para la salida estándar (vale una tubería).
+ * @threads: Número de hilos que generan.
+ * @n: Recibe el número de símbolos escritos.
+ * @return: 0, o -1 si no se pudo abrir o escribir la salida.
+ *
+ * La generación nunca se materializa: cada hilo llena con el iterador
+ * perezoso un búfer alineado de EXPCHUNK símbolos en su posición (con
+ * iterseek()), y la tanda de búferes se escribe en orden con un solo
+ * writev(). Con OpenMP hay dos tandas: un hilo más escribe la anterior
+ * mientras los demás generan la siguiente. La memoria es
+ * 2 × threads × EXPCHUNK, sea cual sea la longitud de la generación.
+ * Las reglas con contexto y las paramétricas son la excepción (exportarena()).
+ */
+int exportgen(Lsystem *ls, int depth, const char *path, int threads, uint64_t *n) {
+	if (ls->ctx || ls->param)
+		return exportarena(ls, depth, path, threads, n);
+	int nt = threads < 1 ? 1 : threads > MAXIOV ? MAXIOV : threads;
+#ifndef _OPENMP
+	nt = 1;		// Sin OpenMP las tandas no se solaparían
+#endif
+	Lentab *lt = NULL;
+	uint64_t total = UINT64_MAX;
+
+	// Para repartir hace falta la longitud; si no cabe en 64 bits o depende
+	// de reglas estocásticas se genera con un solo hilo, que no necesita saltar
+	if (ls->stoch)
+		nt = 1;
+	if (nt > 1) {
+		lt = mklentab(ls, depth);
+		total = genlen(lt, depth);
+		if (total == UINT64_MAX) {
+			freelentab(lt);
+			lt = NULL;
+			nt = 1;
+		}
+	}
+
+	int fd = openout(path);
+	if (fd < 0)
+		return -1;
+
+	int nbank = nt > 1 ? 2 : 1;
+	char *bufs[2][MAXIOV];
+	size_t lens[2][MAXIOV];
+	Iter *its[MAXIOV];
+	for (int t = 0; t < nt; t++) {
+		for (int b = 0; b < nbank; b++)
+			if (posix_memalign((void**)&bufs[b][t], ALIGN, EXPCHUNK) != 0) {
+				fprintf(stderr, "exportgen: sin memoria\n");
+				exit(EXIT_FAILURE);
+			}
+		its[t] = mkiter(ls, depth);
+	}
+
+	int err = 0;
+	uint64_t done = 0;
+	if (nt == 1) {
+		// Un hilo: el iterador avanza sin saltos y se escribe cada búfer lleno
+		for (;;) {
+			lens[0][0] = iterread(its[0], bufs[0][0], EXPCHUNK);
+			if (lens[0][0] == 0 || (err = flushbank(fd, bufs[0], lens[0], 1)) != 0)
+				break;
+			done += lens[0][0];
+		}
+	} else {
+		// Tanda r: el hilo t genera [pos + t × EXPCHUNK, ...) en bufs[r % 2][t]
+		// mientras otro hilo escribe la tanda r - 1
+		uint64_t pos = 0;
+		int pending = 0;
+		for (int r = 0; pos < total || pending; r++) {
+			int cur = r % 2;
+			uint64_t base = pos;
+			// j = 0 escribe y el resto genera; así vale con menos hilos de los pedidos
+#ifdef _OPENMP
+			#pragma omp parallel for schedule(dynamic, 1) num_threads(nt + 1)
+#endif
+			for (int j = 0; j <= nt; j++) {
+				if (j == 0) {
+					if (pending && flushbank(fd, bufs[!cur], lens[!cur], nt) != 0)
+						err = -1;
+					continue;
+				}
+				int t = j - 1;
+				uint64_t at = base + (uint64_t)t * EXPCHUNK;
+				size_t want = at >= total ? 0 : total - at < EXPCHUNK ? total - at : EXPCHUNK;
+				if (want > 0 && its[t]->count != at)
+					iterseek(its[t], lt, at);
+				lens[cur][t] = want ? iterread(its[t], bufs[cur][t], want) : 0;
+			}
+			if (err)
+				break;
+			pending = 0;
+			for (int t = 0; t < nt; t++) {
+				done += lens[cur][t];
+				pending |= lens[cur][t] > 0;
+			}
+			pos = total - pos < (uint64_t)nt * EXPCHUNK ? total : pos + (uint64_t)nt * EXPCHUNK;
+		}
+		if (done != total)
+			err = -1;
+	}
+
+	if (fd != STDOUT_FILENO && close(fd) != 0)
+		err = -1;
+	for (int t = 0; t < nt; t++) {
+		for (int b = 0; b < nbank; b++)
+			free(bufs[b][t]);
+		freeiter(its[t]);
+	}
+	if (lt)
+		freelentab(lt);
+	*n = done;
+	return err;
+}
+
+/**
+ * exportmain - Modo -e de lsystemNoGrafico y lsystemNoGraficoOpenMP.
+ *
+ * Parsea file y escribe su generación depth en out con exportgen(). Los
+ * mensajes van a stderr para no mezclarse con la cadena cuando out es la
+ * salida estándar. Devuelve el código de salida del programa.
+ */
+int exportmain(const char *file, int depth, const char *out, int threads) {
+	struct timeval inicio, fin;
+	uint64_t n;
+
+	Lsystem *ls = parse((char*)file);
+	gettimeofday(&inicio, NULL);
+	int err = exportgen(ls, depth, out, threads, &n);
+	gettimeofday(&fin, NULL);
+	double tiempo = (fin.tv_sec - inicio.tv_sec) + (fin.tv_usec - inicio.tv_usec) / 1000000.0;
+	if (err) {
+		fprintf(stderr, "%s: error al escribir la generación %d\n", out, depth);
+		return 1;
+	}
+	fprintf(stderr, "La generación %d (%llu símbolos) se escribió en %f segundos con %d %s (%.1f MB/s).\n",
+	        depth, (unsigned long long)n, tiempo, threads, threads == 1 ? "hilo" : "hilos",
+	        tiempo > 0 ? n / tiempo / 1048576.0 : 0);
+	return 0;
+}
+
+/**
+ * lazygen - Recorre la generación depth con el iterador perezoso, sin construirla.
+ *
+ * @ls: L-system ya compilado por parse().
+ * @lt: Tabla de longitudes hasta depth, o NULL para recorrerla con un solo
+ *      hilo (reglas estocásticas: sin longitudes no se puede repartir).
+ * @depth: Generación que se recorre.
+ * @threads: Número de hilos.
+ * @n: Recibe el número de símbolos de la generación.
+ * @return: 0, o -1 (con el error en stderr) si el iterador se queda sin
+ *          símbolos antes del final de algún tramo.
+ *
+ * La salida se reparte en tramos de igual longitud: cada hilo sitúa su
+ * iterador en el inicio de su tramo con iterseek() y lo recorre por su cuenta.
+ */
+int lazygen(Lsystem *ls, Lentab *lt, int depth, int threads, uint64_t *n) {
+	if (lt == NULL) {
+		char buf[65536];
+		Iter *iter = mkiter(ls, depth);
+		while (iterread(iter, buf, sizeof buf) > 0)
+			;
+		*n = iter->count;
+		freeiter(iter);
+		return 0;
+	}
+	uint64_t total = genlen(lt, depth);
+	int err = 0;
+
+#ifdef _OPENMP
+	#pragma omp parallel num_threads(threads) reduction(|:err)
+#endif
+	{
+		int tid = 0, nth = 1;
+#ifdef _OPENMP
+		tid = omp_get_thread_num();
+		nth = omp_get_num_threads();
+#endif
+		uint64_t start = slicebound(total, tid, nth);	// Tramo de salida del hilo
+		uint64_t end = slicebound(total, tid + 1, nth);
+		char buf[65536];
+
+		Iter *iter = mkiter(ls, depth);
+		iterseek(iter, lt, start);
+		for (uint64_t k = start; k < end; ) {
+			size_t want = end - k < sizeof buf ? end - k : sizeof buf;
+			size_t got = iterread(iter, buf, want);
+			if (got == 0) {	// El iterador acabó antes que el tramo
+				err = 1;
+				break;
+			}
+			k += got;
+		}
+		freeiter(iter);
+	}
+	*n = total;
+	if (err) {
+		fprintf(stderr, "lazygen: la generación %d terminó antes de los %llu símbolos previstos\n",
+		        depth, (unsigned long long)total);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * cliargs - Opciones finales de los programas sin gráficos.
+ *
+ * @argc, @argv: Argumentos de main().
+ * @fixed: Argumentos fijos, contando el nombre del programa.
+ * @args: Descripción de los argumentos para el mensaje de uso.
+ * @o: Recibe las opciones.
+ * @return: 0, o -1 tras escribir el uso o el error en stderr.
+ *
+ * Detrás de los argumentos fijos va como mucho un modo (-l, -p...) o
+ * "-e salida", y al final cualquier número de "-r checkpoint" y
+ * "-s checkpoint"; -r y -s solo valen sin modo, guardando las
+ * generaciones completas. El modo no se comprueba: lo interpreta quien llama.
+ */
+int cliargs(int argc, char *argv[], int fixed, const char *args, Cliopts *o) {
+	memset(o, 0, sizeof *o);
+	while (argc >= fixed + 2 && (strcmp(argv[argc - 2], "-r") == 0 || strcmp(argv[argc - 2], "-s") == 0)) {
+		if (argv[argc - 2][1] == 'r')
+			o->resume = argv[argc - 1];
+		else
+			o->save = argv[argc - 1];
+		argc -= 2;
+	}
+	if (argc < fixed || argc > fixed + 2 || (argc == fixed + 2 && strcmp(argv[fixed], "-e") != 0)) {
+		fprintf(stderr, "Uso: %s %s [-r checkpoint] [-s checkpoint]\n"
+		        "  -e escribe la generación sin guardarla, salvo con reglas con contexto o\n"
+		        "     paramétricas: esas la construyen entera en memoria (o en LSYSTEM_OOC)\n", argv[0], args);
+		return -1;
+	}
+	if ((o->resume || o->save) && argc != fixed) {
+		fprintf(stderr, "-r y -s solo valen para guardar las generaciones completas\n");
+		return -1;
+	}
+	if (argc == fixed + 2)	// -e: escribe la generación en salida ("-" es stdout) sin guardarla
+		o->out = argv[fixed + 1];
+	else if (argc == fixed + 1)
+		o->mode = argv[fixed];
+	return 0;
+}
@@ -0,0 +1,268 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+// Instrucciones de la máquina de pila de las expresiones
+enum {
+	X_CONST, X_PARAM, X_NEG, X_NOT,
+	X_ADD, X_SUB, X_MUL, X_DIV, X_POW,
+	X_LT, X_GT, X_LE, X_GE, X_EQ, X_NE, X_AND, X_OR
+};
+
+#define MAXCODE 256		// Instrucciones por expresión
+
+/**
+ * Estado del compilador: texto que queda por leer, nombres de los
+ * parámetros formales y código generado hasta ahora.
+ */
+typedef struct
+{
+	const char*	s;        // Posición actual en el texto
+	const char*	src;      // Expresión completa (para los errores)
+	char**	formals;      // Nombres de los parámetros del predecesor
+	int	nformal;
+	Op	code[MAXCODE];
+	int	n;                // Instrucciones generadas
+	int	depth, maxdepth;  // Altura de la pila al ejecutar el código
+} Comp;
+
+static void expr(Comp *c);
+
+static void fail(Comp *c, const char *what) {
+	fprintf(stderr, "expression '%s': %s at '%s'\n", c->src, what, c->s);
+	parsefail();
+}
+
+/**
+ * emit - Añade una instrucción y lleva la cuenta de la pila.
+ *
+ * Las operaciones cuyos operandos son constantes se calculan aquí mismo
+ * (plegado de constantes), así que 2*3.14/180 cuesta una sola instrucción.
+ */
+static void emit(Comp *c, int op, int arg, double val) {
+	if (c->n == MAXCODE)
+		fail(c, "too long");
+	Op *o = &c->code[c->n];
+	o->op = op;
+	o->arg = arg;
+	o->val = val;
+
+	int pops = op >= X_ADD ? 2 : op >= X_NEG ? 1 : 0;
+	c->depth += 1 - pops;
+	if (c->depth > c->maxdepth)
+		c->maxdepth = c->depth;
+	c->n++;
+
+	if (pops && c->n > pops) {
+		for (int k = 2; k <= pops + 1; k++)
+			if (c->code[c->n - k].op != X_CONST)
+				return;
+		double v = eval(&(Expr){ pops + 1, pops + 1, c->code + c->n - pops - 1 }, NULL);
+		c->n -= pops + 1;
+		c->code[c->n].op = X_CONST;
+		c->code[c->n].arg = 0;
+		c->code[c->n].val = v;
+		c->n++;
+	}
+}
+
+static void skip(Comp *c) {
+	while (isspace((unsigned char)*c->s))
+		c->s++;
+}
+
+/**
+ * accept - Consume el operador op si viene a continuación.
+ */
+static int accept(Comp *c, const char *op) {
+	skip(c);
+	size_t n = strlen(op);
+	if (strncmp(c->s, op, n) != 0)
+		return 0;
+	// '<' no debe tragarse el principio de '<='
+	if (n == 1 && (op[0] == '<' || op[0] == '>' || op[0] == '!') && c->s[1] == '=')
+		return 0;
+	c->s += n;
+	return 1;
+}
+
+/**
+ * atom - Número, parámetro formal o expresión entre paréntesis.
+ */
+static void atom(Comp *c) {
+	skip(c);
+	if (accept(c, "(")) {
+		expr(c);
+		if (!accept(c, ")"))
+			fail(c, "expected ')'");
+		return;
+	}
+	if (isdigit((unsigned char)*c->s) || *c->s == '.') {
+		char *end;
+		double v = strtod(c->s, &end);
+		c->s = end;
+		emit(c, X_CONST, 0, v);
+		return;
+	}
+	if (isalpha((unsigned char)*c->s) || *c->s == '_') {
+		const char *start = c->s;
+		while (isalnum((unsigned char)*c->s) || *c->s == '_')
+			c->s++;
+		size_t n = c->s - start;
+		for (int k = 0; k < c->nformal; k++)
+			if (strlen(c->formals[k]) == n && strncmp(c->formals[k], start, n) == 0) {
+				emit(c, X_PARAM, k, 0);
+				return;
+			}
+		c->s = start;
+		fail(c, "unknown parameter");
+	}
+	fail(c, "expected a number or a parameter");
+}
+
+static void unary(Comp *c);
+
+static void power(Comp *c) {
+	atom(c);
+	if (accept(c, "^")) {
+		unary(c);	// Asociativa por la derecha: 2^3^2 = 2^9
+		emit(c, X_POW, 0, 0);
+	}
+}
+
+static void unary(Comp *c) {
+	if (accept(c, "-")) {
+		unary(c);
+		emit(c, X_NEG, 0, 0);
+	} else if (accept(c, "!")) {
+		unary(c);
+		emit(c, X_NOT, 0, 0);
+	} else
+		power(c);
+}
+
+static void product(Comp *c) {
+	unary(c);
+	for (;;)
+		if (accept(c, "*"))
+			unary(c), emit(c, X_MUL, 0, 0);
+		else if (accept(c, "/"))
+			unary(c), emit(c, X_DIV, 0, 0);
+		else
+			return;
+}
+
+static void sum(Comp *c) {
+	product(c);
+	for (;;)
+		if (accept(c, "+"))
+			product(c), emit(c, X_ADD, 0, 0);
+		else if (accept(c, "-"))
+			product(c), emit(c, X_SUB, 0, 0);
+		else
+			return;
+}
+
+static void compare(Comp *c) {
+	static const struct { const char *s; int op; } ops[] = {
+		{ "<=", X_LE }, { ">=", X_GE }, { "==", X_EQ }, { "!=", X_NE },
+		{ "<", X_LT }, { ">", X_GT }, { "=", X_EQ }
+	};
+	sum(c);
+	for (size_t k = 0; k < sizeof ops / sizeof ops[0]; k++)
+		if (accept(c, ops[k].s)) {
+			sum(c);
+			emit(c, ops[k].op, 0, 0);
+			return;
+		}
+}
+
+static void andterm(Comp *c) {
+	compare(c);
+	while (accept(c, "&&"))
+		compare(c), emit(c, X_AND, 0, 0);
+}
+
+static void expr(Comp *c) {
+	andterm(c);
+	while (accept(c, "||"))
+		andterm(c), emit(c, X_OR, 0, 0);
+}
+
+/**
+ * mkexpr - Compila una expresión a código de una máquina de pila.
+ *
+ * @s: Texto de la expresión (aritmética + - * / ^, comparaciones, && || !).
+ * @formals: Nombres de los parámetros del predecesor; X_PARAM k lee el k-ésimo.
+ * @nformal: Número de parámetros.
+ * @return: Código listo para eval(), sin referencias al texto.
+ *
+ * Se compila una sola vez al parsear; la expansión solo ejecuta el código.
+ */
+Expr* mkexpr(const char *s, char **formals, int nformal) {
+	Comp c = { .s = s, .src = s, .formals = formals, .nformal = nformal };
+	expr(&c);
+	skip(&c);
+	if (*c.s != '\0')
+		fail(&c, "unexpected text");
+	if (c.maxdepth > EXPRSTACK)
+		fail(&c, "too deeply nested");
+
+	Expr *e = emalloc(sizeof(Expr));
+	e->n = c.n;
+	e->depth = c.maxdepth;
+	e->code = emalloc(c.n * sizeof(Op));
+	memcpy(e->code, c.code, c.n * sizeof(Op));
+	return e;
+}
+
+/**
+ * freeexpr - Libera una expresión creada con mkexpr().
+ */
+void freeexpr(Expr *e) {
+	if (e) {
+		free(e->code);
+		free(e);
+	}
+}
+
+/**
+ * eval - Ejecuta el código de una expresión con los parámetros par.
+ *
+ * Los booleanos son 1 o 0. La pila es local y de tamaño fijo (mkexpr()
+ * comprueba que basta), así que se puede llamar desde varios hilos a la vez.
+ */
+double eval(const Expr *e, const double *par) {
+	double st[EXPRSTACK + 1];
+	int sp = 0;
+
+	for (const Op *o = e->code, *end = o + e->n; o < end; o++) {
+		switch (o->op) {
+		case X_CONST: st[sp++] = o->val; continue;
+		case X_PARAM: st[sp++] = par[o->arg]; continue;
+		case X_NEG: st[sp - 1] = -st[sp - 1]; continue;
+		case X_NOT: st[sp - 1] = st[sp - 1] == 0; continue;
+		}
+		double b = st[--sp], *a = &st[sp - 1];
+		switch (o->op) {
+		case X_ADD: *a += b; break;
+		case X_SUB: *a -= b; break;
+		case X_MUL: *a *= b; break;
+		case X_DIV: *a /= b; break;
+		case X_POW: *a = pow(*a, b); break;
+		case X_LT: *a = *a < b; break;
+		case X_GT: *a = *a > b; break;
+		case X_LE: *a = *a <= b; break;
+		case X_GE: *a = *a >= b; break;
+		case X_EQ: *a = *a == b; break;
+		case X_NE: *a = *a != b; break;
+		case X_AND: *a = *a != 0 && b != 0; break;
+		case X_OR: *a = *a != 0 || b != 0; break;
+		}
+	}
+	return st[0];
+}
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "a.h"
+
+#define NESTMAX ((int64_t)1 << 62)	// Los anidamientos se saturan aquí
+
+/**
+ * satmul - Producto de contadores de 64 bits que se satura en UINT64_MAX.
+ */
+static inline uint64_t satmul(uint64_t a, uint64_t b) {
+	uint64_t r;
+	return __builtin_mul_overflow(a, b, &r) ? UINT64_MAX : r;
+}
+
+/**
+ * growthmatrix - Matriz de crecimiento sobre el alfabeto denso de ls.
+ *
+ * La fila del código a cuenta cuántas veces sale cada símbolo al reescribir
+ * una vez el símbolo a. Sin reglas estocásticas, con contexto ni
+ * paramétricas es exacta. Con ellas cada entrada es el máximo entre todos
+ * los sucesores posibles (también el de la regla sin contexto, o la
+ * identidad, para cuando no se aplica ninguna otra), y como todo es no
+ * negativo las potencias dan cotas superiores de cualquier generación.
+ */
+static uint64_t* growthmatrix(Lsystem *ls) {
+	int k = ls->nsyms;
+	uint64_t *m = emalloc((size_t)k * k * sizeof(uint64_t));
+	uint64_t *row = emalloc(k * sizeof(uint64_t));
+	for (int a = 0; a < k; a++) {
+		Prod *p = lookup(ls, ls->sym[a]);
+		uint64_t *ma = &m[(size_t)a * k];
+		int nsucc = 1 + p->nalt + p->nctx + p->nprule;
+		for (int s = 0; s < nsucc; s++) {
+			const Prod *q = s == 0 ? p
+			              : s <= p->nalt ? &p->alt[s - 1]
+			              : s <= p->nalt + p->nctx ? &p->ctx[s - 1 - p->nalt].prod
+			              : &p->prule[s - 1 - p->nalt - p->nctx].prod;
+			memset(row, 0, k * sizeof(uint64_t));
+			for (size_t i = 0; i < q->len; i++)
+				row[ls->code[(unsigned char)q->succ[i]]]++;
+			for (int b = 0; b < k; b++)
+				if (row[b] > ma[b])
+					ma[b] = row[b];
+		}
+		if (p->nprule && ma[a] == 0)
+			ma[a] = 1;	// Si no se cumple ninguna condición el módulo se queda
+	}
+	free(row);
+	return m;
+}
+
+/**
+ * matmul - c = a × b para matrices k × k, saturando.
+ */
+static void matmul(uint64_t *c, const uint64_t *a, const uint64_t *b, int k) {
+	for (int i = 0; i < k; i++) {
+		uint64_t *ci = &c[(size_t)i * k];
+		memset(ci, 0, k * sizeof(uint64_t));
+		for (int j = 0; j < k; j++) {
+			uint64_t aij = a[(size_t)i * k + j];
+			if (aij == 0)
+				continue;
+			const uint64_t *bj = &b[(size_t)j * k];
+			for (int l = 0; l < k; l++)
+				ci[l] = satadd(ci[l], satmul(aij, bj[l]));
+		}
+	}
+}
+
+/**
+ * vecmul - v = v × m para un vector fila de k contadores, saturando.
+ */
+static void vecmul(uint64_t *v, const uint64_t *m, int k) {
+	uint64_t *w = emalloc(k * sizeof(uint64_t));
+	for (int j = 0; j < k; j++) {
+		if (v[j] == 0)
+			continue;
+		const uint64_t *mj = &m[(size_t)j * k];
+		for (int l = 0; l < k; l++)
+			w[l] = satadd(w[l], satmul(v[j], mj[l]));
+	}
+	memcpy(v, w, k * sizeof(uint64_t));
+	free(w);
+}
+
+/**
+ * parikh - Vector de Parikh de la generación depth: v × M^depth con v el del
+ * axioma, elevando por cuadrados (O(k³ log depth) en vez de expandir).
+ */
+static void parikh(Lsystem *ls, const uint64_t *m, int depth, uint64_t *v) {
+	int k = ls->nsyms;
+	memset(v, 0, k * sizeof(uint64_t));
+	for (char *s = ls->axiom; *s; s++)
+		v[ls->code[(unsigned char)*s]]++;
+
+	size_t sz = (size_t)k * k * sizeof(uint64_t);
+	uint64_t *p = emalloc(sz), *t = emalloc(sz);
+	memcpy(p, m, sz);
+	for (unsigned d = depth; d > 0; d >>= 1) {
+		if (d & 1)
+			vecmul(v, p, k);
+		if (d > 1) {
+			matmul(t, p, p, k);
+			uint64_t *x = p;
+			p = t;
+			t = x;
+		}
+	}
+	free(p);
+	free(t);
+}
+
+static inline int64_t nestadd(int64_t a, int64_t b) {
+	int64_t r = a + b;	// |a|, |b| <= NESTMAX: no se desborda
+	return r > NESTMAX ? NESTMAX : r < -NESTMAX ? -NESTMAX : r;
+}
+
+/**
+ * nesting - Anidamiento máximo de corchetes de la generación depth.
+ *
+ * Para cada símbolo y número de derivaciones se guarda cuánto cambia la
+ * profundidad de corchetes su expansión (net) y cuánto sube como mucho
+ * respecto al principio (peak); los de un sucesor salen de recorrerlo con
+ * los de sus símbolos una derivación antes. Cuesta O(depth × longitud de
+ * las reglas), y se para en cuanto la tabla deja de cambiar (sin corchetes
+ * en las reglas, o todo saturado).
+ */
+static uint64_t nesting(Lsystem *ls, int depth) {
+	int k = ls->nsyms;
+	int64_t *net = emalloc(2 * k * sizeof(int64_t)), *peak = emalloc(2 * k * sizeof(int64_t));
+	for (int a = 0; a < k; a++) {
+		net[a] = ls->sym[a] == '[' ? 1 : ls->sym[a] == ']' ? -1 : 0;
+		peak[a] = net[a] > 0 ? net[a] : 0;
+	}
+	int cur = 0;
+	for (int d = 1; d <= depth; d++) {
+		int64_t *pn = &net[cur * k], *pp = &peak[cur * k];
+		int64_t *nn = &net[!cur * k], *np = &peak[!cur * k];
+		for (int a = 0; a < k; a++) {
+			Prod *p = lookup(ls, ls->sym[a]);
+			int64_t run = 0, top = 0;
+			for (size_t i = 0; i < p->len; i++) {
+				int b = ls->code[(unsigned char)p->succ[i]];
+				int64_t h = nestadd(run, pp[b]);
+				if (h > top)
+					top = h;
+				run = nestadd(run, pn[b]);
+			}
+			nn[a] = run;
+			np[a] = top;
+		}
+		cur = !cur;
+		if (memcmp(nn, pn, k * sizeof(int64_t)) == 0 && memcmp(np, pp, k * sizeof(int64_t)) == 0)
+			break;
+	}
+
+	int64_t run = 0, top = 0;
+	for (char *s = ls->axiom; *s; s++) {
+		int b = ls->code[(unsigned char)*s];
+		int64_t h = nestadd(run, peak[cur * k + b]);
+		if (h > top)
+			top = h;
+		run = nestadd(run, net[cur * k + b]);
+	}
+	free(net);
+	free(peak);
+	return top >= NESTMAX ? UINT64_MAX : (uint64_t)top;
+}
+
+/**
+ * arenabytes - Memoria de dos generaciones seguidas con los búferes de
+ * mkarena() (con parámetros) o de mkpkarena().
+ */
+static uint64_t arenabytes(Lsystem *ls, uint64_t len, uint64_t prev, int packed) {
+	if (packed) {
+		uint64_t per = 64 / ls->bits;
+		uint64_t w = satadd(len / per + 2, prev / per + 2);
+		return satmul(w, sizeof(uint64_t));
+	}
+	uint64_t sym = 1 + (ls->param ? ls->npar * sizeof(double) : 0);
+	return satmul(satadd(len + (len < UINT64_MAX), prev + (prev < UINT64_MAX)), sym);
+}
+
+/**
+ * growth - Tamaño y composición de la generación depth sin expandirla.
+ *
+ * @ls: L-system compilado.
+ * @depth: Generación (>= 0).
+ * @g: Recibe los resultados.
+ *
+ * Para un D0L (sin reglas estocásticas, con contexto ni paramétricas) los
+ * valores son exactos: el vector de Parikh de la generación N es el del
+ * axioma por la matriz de crecimiento elevada a N. Si no, son cotas
+ * superiores y g->exact queda a 0. Los contadores se saturan en
+ * UINT64_MAX en vez de desbordarse (g->sat a 1).
+ */
+void growth(Lsystem *ls, int depth, Growth *g) {
+	memset(g, 0, sizeof *g);
+	g->depth = depth;
+	g->exact = !ls->stoch && !ls->ctx && !ls->param;
+
+	int k = ls->nsyms;
+	uint64_t *m = growthmatrix(ls);
+	uint64_t *v = emalloc(k * sizeof(uint64_t)), *prev = emalloc(k * sizeof(uint64_t));
+	parikh(ls, m, depth > 0 ? depth - 1 : 0, prev);
+	memcpy(v, prev, k * sizeof(uint64_t));
+	if (depth > 0)
+		vecmul(v, m, k);
+
+	uint64_t plen = 0;
+	for (int a = 0; a < k; a++) {
+		unsigned char c = ls->sym[a];
+		g->count[c] = v[a];
+		g->len = satadd(g->len, v[a]);
+		plen = satadd(plen, prev[a]);
+		if (ls->table[c].op == T_FORWARD)
+			g->segs = satadd(g->segs, v[a]);
+	}
+	if (depth == 0)
+		plen = 0;	// Solo está el búfer del axioma
+	g->nest = g->exact ? nesting(ls, depth) : g->count['['];
+	g->bytes = arenabytes(ls, g->len, plen, 0);
+	g->pkbytes = arenabytes(ls, g->len, plen, 1);
+	g->sat = g->len == UINT64_MAX || g->bytes == UINT64_MAX || g->nest == UINT64_MAX;
+	free(m);
+	free(v);
+	free(prev);
+}
+
+/**
+ * memlimit - Bytes que pueden ocupar las generaciones: la memoria física,
+ * más el espacio libre del directorio de LSYSTEM_OOC si está activo.
+ */
+uint64_t memlimit(void) {
+	long pages = sysconf(_SC_PHYS_PAGES), size = sysconf(_SC_PAGE_SIZE);
+	uint64_t n = pages > 0 && size > 0 ? (uint64_t)pages * size : UINT64_MAX;
+	return oocon() ? satadd(n, oocspace()) : n;
+}
+
+/**
+ * growthfits - 1 si la expansión hasta la generación de g cabe en memlimit().
+ *
+ * Las cotas de sistemas no deterministas no sirven para rechazar: siempre
+ * cabe. Con packed se mira la memoria de las generaciones empaquetadas.
+ */
+int growthfits(Growth *g, int packed) {
+	if (!g->exact)
+		return 1;
+	return (packed ? g->pkbytes : g->bytes) <= memlimit();
+}
+
+static void printcount(FILE *fp, uint64_t n) {
+	if (n == UINT64_MAX)
+		fprintf(fp, "más de 2^64");
+	else
+		fprintf(fp, "%llu", (unsigned long long)n);
+}
+
+/**
+ * printgrowth - Escribe en fp el informe de growth() para el modo --stats.
+ */
+void printgrowth(Lsystem *ls, Growth *g, FILE *fp) {
+	fprintf(fp, "Generación %d", g->depth);
+	if (!g->exact) {	// Se dice qué reglas hacen que sean solo cotas
+		const char *why[3];
+		int n = 0;
+		if (ls->stoch)
+			why[n++] = "estocásticas";
+		if (ls->ctx)
+			why[n++] = "con contexto";
+		if (ls->param)
+			why[n++] = "paramétricas";
+		fprintf(fp, " (cotas superiores: reglas");
+		for (int k = 0; k < n; k++)
+			fprintf(fp, "%s%s", k == 0 ? " " : k == n - 1 ? " y " : ", ", why[k]);
+		fprintf(fp, ")");
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "  Símbolos: ");
+	printcount(fp, g->len);
+	fprintf(fp, "\n");
+	for (int a = 0; a < ls->nsyms; a++) {
+		unsigned char c = ls->sym[a];
+		fprintf(fp, "    '%c': ", c);
+		printcount(fp, g->count[c]);
+		fprintf(fp, "\n");
+	}
+	fprintf(fp, "  Segmentos (F y G): ");
+	printcount(fp, g->segs);
+	fprintf(fp, "\n  Anidamiento máximo de corchetes: ");
+	printcount(fp, g->nest);
+	fprintf(fp, "\n  Memoria prevista: %.1f MB (empaquetada %.1f MB), disponible %.1f MB\n",
+	        g->bytes / 1048576.0, g->pkbytes / 1048576.0, memlimit() / 1048576.0);
+}
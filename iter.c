@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+/**
+ * mkiter - Crea un iterador sobre los símbolos de la generación depth.
+ *
+ * @ls: L-system ya compilado por parse().
+ * @depth: Generación que se quiere recorrer (0 es el axioma).
+ * @return: Iterador situado en el primer símbolo.
+ *
+ * La pila tiene un marco por nivel del árbol de derivación, así que la
+ * memoria es O(depth) independientemente de la longitud de la generación.
+ * Para las reglas estocásticas se lleva además el índice de cada nivel, que
+ * es el que usa choose() en la expansión por generaciones.
+ */
+Iter* mkiter(Lsystem *ls, int depth) {
+	if (ls->ctx || ls->param) {	// El recorrido en profundidad no ve vecinos ni parámetros
+		fprintf(stderr, "mkiter: las reglas con contexto o paramétricas necesitan la generación anterior completa\n");
+		exit(EXIT_FAILURE);
+	}
+	Iter *it = emalloc(sizeof(Iter));
+	it->ls = ls;
+	it->depth = depth;
+	it->stack = emalloc((depth + 1) * sizeof(Frame));
+	it->idx = emalloc((depth + 1) * sizeof(uint64_t));
+	it->stack[0].succ = ls->axiom;
+	it->stack[0].len = strlen(ls->axiom);
+	it->stack[0].pos = 0;
+	it->stack[0].depth = 0;
+	it->top = 0;
+	it->count = 0;
+	return it;
+}
+
+/**
+ * freeiter - Libera un iterador creado con mkiter().
+ */
+void freeiter(Iter *it) {
+	free(it->stack);
+	free(it->idx);
+	free(it);
+}
+
+/**
+ * step - Avanza el recorrido en profundidad hasta el siguiente símbolo.
+ *
+ * Un símbolo se emite cuando está en la generación objetivo o cuando no
+ * tiene regla (se reescribiría a sí mismo en todos los niveles restantes).
+ * Si no, se apila un marco con su producción un nivel más abajo.
+ *
+ * Los símbolos de cada nivel se visitan en el orden de su generación, así
+ * que idx[d] es el índice del siguiente símbolo de la generación d. Un
+ * símbolo sin regla emitido en el nivel d ocupa también un puesto en las
+ * generaciones siguientes; como casi todos se crean en los últimos niveles,
+ * actualizarlas cuesta O(1) amortizado.
+ */
+static inline int step(Iter *it) {
+	while (it->top >= 0) {
+		Frame *f = &it->stack[it->top];
+		if (f->pos == f->len) {	// Producción agotada: vuelve al padre
+			it->top--;
+			continue;
+		}
+		char c = f->succ[f->pos++];
+		Prod *p = lookup(it->ls, c);
+		if (f->depth == it->depth || p->ident) {
+			if (it->ls->stoch)
+				for (int d = f->depth; d <= it->depth; d++)
+					it->idx[d]++;
+			it->count++;
+			return (unsigned char)c;
+		}
+		if (it->ls->stoch)
+			p = choose(it->ls, p, f->depth, it->idx[f->depth]++);
+		Frame *g = &it->stack[++it->top];
+		g->succ = p->succ;
+		g->len = p->len;
+		g->pos = 0;
+		g->depth = f->depth + 1;
+	}
+	return -1;
+}
+
+/**
+ * iternext - Devuelve el siguiente símbolo de la generación, o -1 al final.
+ */
+int iternext(Iter *it) {
+	return step(it);
+}
+
+/**
+ * iterread - Lee hasta n símbolos seguidos en buf.
+ *
+ * @return: Número de símbolos leídos (menor que n solo al final).
+ */
+size_t iterread(Iter *it, char *buf, size_t n) {
+	size_t i = 0;
+	int c;
+	while (i < n && (c = step(it)) >= 0)
+		buf[i++] = (char)c;
+	return i;
+}
+
+/**
+ * mklentab - Precalcula len(símbolo, d) para todos los símbolos y d <= depth.
+ *
+ * @ls: L-system ya compilado.
+ * @depth: Mayor número de derivaciones que se va a consultar.
+ * @return: Tabla con (depth + 1) × 256 contadores saturados de 64 bits.
+ *
+ * len(c, 0) = 1 y len(c, d) es la suma de len(s, d - 1) para cada símbolo s
+ * del sucesor de c (1 si c no tiene regla). Con reglas estocásticas, con
+ * contexto o paramétricas la longitud depende de la posición o de los
+ * parámetros de cada símbolo y no hay tabla.
+ */
+Lentab* mklentab(Lsystem *ls, int depth) {
+	if (ls->stoch || ls->ctx || ls->param) {
+		fprintf(stderr, "mklentab: las reglas estocásticas, con contexto o paramétricas no tienen longitudes fijas\n");
+		exit(EXIT_FAILURE);
+	}
+	Lentab *lt = emalloc(sizeof(Lentab));
+	lt->ls = ls;
+	lt->depth = depth;
+	lt->len = emalloc((size_t)(depth + 1) * 256 * sizeof(uint64_t));
+
+	for (int c = 0; c < 256; c++)
+		lt->len[c] = 1;
+
+	for (int d = 1; d <= depth; d++) {
+		uint64_t *prev = &lt->len[(size_t)(d - 1) * 256];
+		uint64_t *cur = &lt->len[(size_t)d * 256];
+		for (int c = 0; c < 256; c++) {
+			Prod *p = &ls->table[c];
+			if (p->ident) {
+				cur[c] = 1;
+				continue;
+			}
+			uint64_t n = 0;
+			for (size_t i = 0; i < p->len; i++)
+				n = satadd(n, prev[(unsigned char)p->succ[i]]);
+			cur[c] = n;
+		}
+	}
+	return lt;
+}
+
+/**
+ * freelentab - Libera una tabla creada con mklentab().
+ */
+void freelentab(Lentab *lt) {
+	free(lt->len);
+	free(lt);
+}
+
+/**
+ * genlen - Longitud de la generación depth (saturada en UINT64_MAX).
+ */
+uint64_t genlen(Lentab *lt, int depth) {
+	uint64_t n = 0;
+	for (char *s = lt->ls->axiom; *s; s++)
+		n = satadd(n, symlen(lt, *s, depth));
+	return n;
+}
+
+/**
+ * slicebound - Comienzo del tramo t de n en que se reparten total elementos:
+ * total * t / n, calculado sin desbordar 64 bits aunque total llegue a
+ * UINT64_MAX (una longitud saturada). El tramo t es [slicebound(t),
+ * slicebound(t + 1)), así que los tramos no se solapan ni dejan huecos.
+ */
+uint64_t slicebound(uint64_t total, int t, int n) {
+	return total / n * t + total % n * t / n;
+}
+
+/**
+ * iterseek - Coloca el iterador para que el siguiente símbolo sea el k-ésimo.
+ *
+ * @it: Iterador creado con mkiter().
+ * @lt: Tabla de longitudes con lt->depth >= it->depth.
+ * @k: Índice (desde 0) dentro de la generación.
+ *
+ * Baja por el árbol de derivación saltando los símbolos cuya expansión
+ * completa queda antes de k, así que cuesta O(depth × longitud de regla).
+ * Si k está fuera de la generación el iterador queda terminado.
+ */
+void iterseek(Iter *it, Lentab *lt, uint64_t k) {
+	Frame *f = &it->stack[0];
+	f->succ = it->ls->axiom;
+	f->len = strlen(it->ls->axiom);
+	f->pos = 0;
+	f->depth = 0;
+	it->top = 0;
+	it->count = k;
+
+	while (1) {
+		int rest = it->depth - f->depth;
+		for (; f->pos < f->len; f->pos++) {
+			uint64_t l = symlen(lt, f->succ[f->pos], rest);
+			if (k < l)
+				break;
+			k -= l;
+		}
+		if (f->pos == f->len) {	// k está más allá del final
+			it->top = -1;
+			return;
+		}
+		Prod *p = lookup(it->ls, f->succ[f->pos]);
+		if (rest == 0 || p->ident)	// step() emitirá este símbolo
+			return;
+		f->pos++;
+		f = &it->stack[++it->top];
+		f->succ = p->succ;
+		f->len = p->len;
+		f->pos = 0;
+		f->depth = it->stack[it->top - 1].depth + 1;
+	}
+}
+
+/**
+ * symat - Devuelve el símbolo de índice k de la generación depth, o -1.
+ */
+int symat(Lentab *lt, int depth, uint64_t k) {
+	Iter *it = mkiter(lt->ls, depth);
+	iterseek(it, lt, k);
+	int c = iternext(it);
+	freeiter(it);
+	return c;
+}
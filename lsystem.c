@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 
 #include "a.h"
@@ -13,11 +14,17 @@
 
 Lsystem *ls;	// Estructura del sistema de lindemayer actual
 State *state;	// Pila de estados para manejo de posiciones/ángulos con corchetes [ ]
-int x, y;		// Coordenadas actuales del cursor de dibujo
+double x, y;	// Coordenadas actuales del cursor de dibujo
 double angle;	// Ángulo de orientación actual
 char *curgen;	// Generación actual del L-system (cadena)
+size_t curlen;	// Longitud de la generación actual
+Arena *gens;	// Búferes alternos donde se guardan las generaciones
+int lazy = 0;	// Modo perezoso: se dibuja con el iterador, sin guardar curgen
+int depth = 0;	// Número de generación actual
 
 int offsetX = 0, offsetY = 0;	// Desplazamiento visual de la escena en pantalla
+Poly *geom = NULL;	// Geometría de la generación actual (se reutiliza al desplazar)
+SDL_FPoint *pts = NULL;	// Puntos de geom con el desplazamiento aplicado
 
 /**
  * Guarda el estado actual (posición y ángulo) en una pila.
@@ -45,61 +52,51 @@ void popstate(void) {
 	free(s);
 }
 
-/**
- * Devuelve la producción asociada a un símbolo del sistema.
- * Si no hay regla definida, retorna NULL.
- */
-char* production(char c) {
-	for (Rule *r = ls->rules; r; r = r->next)
-		if (r->pred == c)
-			return r->succ;
-	return NULL;
-}
-
 /**
  * Genera la próxima iteración del sistema de Lindenmayer.
  * Reemplaza cada símbolo de la cadena actual usando las reglas de producción.
  */
 void nextgen(void) {
-    char *newgen = emalloc(1024 * strlen(curgen)); 
-    newgen[0] = '\0';
-
-    for (char *p = curgen; *p; p++) {
-        char *prod = production(*p);
-        if (prod)
-            strcat(newgen, prod);
-        else {
-            size_t len = strlen(newgen);
-            newgen[len] = *p;
-            newgen[len + 1] = '\0';
-        }
+    // Se escribe en el búfer libre con el tamaño exacto y se alternan
+    curlen = arenanext(gens, ls, 1);
+    curgen = arenagen(gens);
+
+    // La geometría en caché corresponde a la generación anterior
+    if (geom) {
+        freepoly(geom);
+        geom = NULL;
     }
-
-    free(curgen);
-    curgen = strdup(newgen);
-	printf("\ncadena: %s\n",curgen);
-    free(newgen);
+	// La longitud ya se conoce: se escribe de una vez, sin que printf recorra la cadena
+	printf("\ncadena: ");
+	fflush(stdout);
+	writeall(STDOUT_FILENO, curgen, curlen);
+	putchar('\n');
 }
 
 /**
  * Traza una línea desde la posición actual en la dirección del ángulo actual.
  * Luego actualiza la posición del cursor.
+ *
+ * Hace las mismas cuentas en double que turtle(), así que con y sin -l se
+ * dibujan los mismos segmentos (sin truncar cada paso a píxeles enteros).
+ * Eso vale porque aquí turtle() trabaja con un solo hilo: con varios
+ * compone las transformaciones por bloques y los segmentos pueden
+ * diferir en los últimos bits.
  */
 void forward(SDL_Renderer *renderer) {
-	int x1 = x + ls->linelen * cos(angle * M_PI / 180.0);
-	int y1 = y - ls->linelen * sin(angle * M_PI / 180.0);
-	SDL_RenderDrawLine(renderer, x + offsetX, y + offsetY, x1 + offsetX, y1 + offsetY);
+	double x1 = x + ls->linelen * cos(angle * M_PI / 180.0);
+	double y1 = y - ls->linelen * sin(angle * M_PI / 180.0);
+	SDL_RenderDrawLineF(renderer, x + offsetX, y + offsetY, x1 + offsetX, y1 + offsetY);
 	x = x1;
 	y = y1;
 }
 
 /**
- * Rota el ángulo actual en una cierta cantidad.
+ * Rota el ángulo actual en una cierta cantidad. Como en turtle(), el ángulo
+ * no se reduce a [0, 360): cambiaría el redondeo del seno y el coseno.
  */
 void rotate(double angulo) {
 	angle += angulo;
-	if (angle >= 360.0) angle -= 360.0;
-	if (angle <= 0.0)   angle += 360.0;
 }
 
 
@@ -118,37 +115,79 @@ void redraw(SDL_Renderer *renderer) {
 
 	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);	// Color negro para dibujar
 
-	for (char *s = curgen; *s; s++) {	// Recorre la cadena actual
-		switch (*s) {
-			case 'F':
-			case 'G':
-				forward(renderer);		// Avanza y dibuja línea
+	if (!lazy) {
+		// La geometría se calcula una vez por generación; al desplazar la
+		// vista solo se suma el desplazamiento y se envían las polilíneas
+		if (geom == NULL) {
+			size_t n;
+			Seg *segs = turtle(ls, curgen, curlen, x, y, &n, 1);
+			geom = mkpoly(segs, n);
+			free(segs);
+			SDL_FPoint *p = realloc(pts, (geom->npts + 1) * sizeof(SDL_FPoint));
+			if (p == NULL) {	// Se deja la pantalla en blanco y se reintenta en el siguiente redibujado
+				fprintf(stderr, "redraw: sin memoria para %zu puntos\n", geom->npts);
+				freepoly(geom);
+				geom = NULL;
+				SDL_RenderPresent(renderer);
+				return;
+			}
+			pts = p;
+		}
+		Mark m;
+		profstart(&m);
+		for (size_t i = 0; i < geom->npts; i++) {
+			pts[i].x = geom->xy[2 * i] + offsetX;
+			pts[i].y = geom->xy[2 * i + 1] + offsetY;
+		}
+		for (size_t r = 0; r < geom->nruns; r++)
+			SDL_RenderDrawLinesF(renderer, pts + geom->runs[r], geom->runs[r + 1] - geom->runs[r]);
+		SDL_RenderPresent(renderer);
+		profstop(P_DRAW, &m, 1);
+		return;
+	}
+
+	// En modo perezoso los símbolos salen del iterador de derivación y la
+	// interpretación se mide junto con el envío a SDL
+	Mark m;
+	profstart(&m);
+	Iter *iter = mkiter(ls, depth);
+	int c;
+
+	while ((c = iternext(iter)) > 0) {	// Recorre la generación
+		switch (lookup(ls, c)->op) {	// Acción precompilada del símbolo
+			case T_FORWARD:
+				forward(renderer);		// Avanza y dibuja línea ('F', 'G')
 				break;
-			case '-':
-				rotate(ls->leftangle);	// Gira hacia la izquierda
+			case T_LEFT:
+				rotate(ls->leftangle);	// Gira hacia la izquierda ('-')
 				break;
-			case '+':
-				rotate(ls->rightangle);	// Gira hacia la derecha
+			case T_RIGHT:
+				rotate(ls->rightangle);	// Gira hacia la derecha ('+')
 				break;
-			case '[':
-				pushstate();			// Guarda estado actual
+			case T_PUSH:
+				pushstate();			// Guarda estado actual ('[')
 				break;
-			case ']':
-				popstate();				// Restaura estado anterior
+			case T_POP:
+				popstate();				// Restaura estado anterior (']')
 				break;
 		}
 	}
+	freeiter(iter);
 	SDL_RenderPresent(renderer);		// Muestra en pantalla lo dibujado
+	profstop(P_DRAW, &m, 1);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Uso: %s archivo\n", argv[0]);
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Uso: %s archivo [-l]\n", argv[0]);
         return 1;
     }
+    lazy = argc == 3 && strcmp(argv[2], "-l") == 0;	// -l: no guarda la generación en memoria
 
     ls = parse(argv[1]);		// Parsea el archivo L-system
-    curgen = strdup(ls->axiom);	// Copia el axioma como cadena inicial
+    gens = mkarena(ls->axiom);	// Copia el axioma como generación inicial
+    curgen = arenagen(gens);
+    curlen = gens->len;
 
 	// Inicializa SDL
     SDL_Init(SDL_INIT_VIDEO);	
@@ -166,7 +205,9 @@ int main(int argc, char *argv[]) {
     while (!quit) {
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_MOUSEBUTTONDOWN) {
-                nextgen();		// Avanza a la siguiente generación
+                if (!lazy)
+                    nextgen();	// Avanza a la siguiente generación
+                depth++;
                 redraw(ren);	// Redibuja
             }
             else if (e.type == SDL_KEYDOWN) {
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <omp.h>
+
+
+#include "a.h"
+
+#define MAXLIST 64		// Máximo de valores en cada lista de la línea de órdenes
+#define LINESIZE 4096	// Longitud máxima de una línea del archivo de referencia
+
+/**
+ * Configuración medida: un sistema, un motor de expansión, un núcleo SIMD,
+ * una profundidad y un número de hilos.
+ */
+typedef struct
+{
+	char*	file;         // Archivo del L-system
+	char*	backend;      // bytes, packed, lazy o dag
+	char*	simd;         // Valor de LSYSTEM_SIMD, o "auto"
+	int	depth;            // Generación que se calcula desde el axioma
+	int	threads;          // Número de hilos
+} Config;
+
+/**
+ * Resultado de una configuración (lo calcula un proceso hijo).
+ */
+typedef struct
+{
+	double	min, p50, p90, max;   // Tiempos por repetición en segundos
+	uint64_t	symbols;          // Símbolos de la generación depth
+	uint64_t	bytes;            // Bytes que escribe el motor por repetición (ver trial())
+	long	rss;                  // Pico de memoria residente del hijo (KB)
+	char	simd[16];             // Núcleo SIMD que se usó de verdad
+} Result;
+
+/**
+ * Medida de referencia para detectar regresiones.
+ */
+typedef struct
+{
+	char	key[LINESIZE];    // sistema,backend,simd,profundidad,hilos
+	double	p50;
+} Base;
+
+int reps = 5;		// Repeticiones medidas por configuración
+int warmups = 1;	// Repeticiones previas que no se miden
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Recorre la generación depth sin guardarla con lazygen(), repartida con la
+ * tabla de longitudes como en el modo -l de los nografico. Deja en symbols
+ * la longitud de la generación; devuelve -1 si la recorrida se queda corta.
+ */
+int runlazy(Lsystem *ls, int depth, int threads, uint64_t *symbols) {
+    Lentab *lt = mklentab(ls, depth);
+    int err = lazygen(ls, lt, depth, threads, symbols);
+    freelentab(lt);
+    return err;
+}
+
+/**
+ * Construye el DAG de la generación depth y la recorre entera en paralelo.
+ * Como runlazy(), devuelve -1 si la recorrida se queda corta.
+ */
+int rundag(Lsystem *ls, int depth, int threads, uint64_t *symbols) {
+    Dag *g = mkdag(ls, depth);
+    uint64_t total = daglen(g);
+    int err = 0;
+
+    #pragma omp parallel num_threads(threads) reduction(|:err)
+    {
+        int t = omp_get_thread_num(), nth = omp_get_num_threads();
+        uint64_t start = slicebound(total, t, nth), end = slicebound(total, t + 1, nth);
+        char buf[65536];
+        Dagiter *it = mkdagiter(g, start);
+        for (uint64_t n = start; n < end; ) {
+            size_t want = end - n < sizeof buf ? end - n : sizeof buf;
+            size_t got = dagread(it, buf, want);
+            if (got == 0) {
+                err = 1;
+                break;
+            }
+            n += got;
+        }
+        freedagiter(it);
+    }
+    freedag(g);
+    *symbols = total;
+    return err ? -1 : 0;
+}
+
+/**
+ * Una repetición: calcula la generación depth desde el axioma.
+ *
+ * Deja en symbols los símbolos de la generación depth, igual con todos los
+ * motores para que simbolos_s compare el tiempo de llegar a la misma
+ * generación. En bytes deja los bytes que escribe el motor: todas las
+ * generaciones intermedias con bytes y packed, y la generación depth que
+ * se lee del iterador con lazy y dag, que no guardan ninguna. Devuelve -1
+ * si la generación no se pudo recorrer entera.
+ */
+int trial(Config *c, Lsystem *ls, uint64_t *symbols, uint64_t *bytes) {
+    *bytes = 0;
+
+    if (strcmp(c->backend, "lazy") == 0 || strcmp(c->backend, "dag") == 0) {
+        int err = c->backend[0] == 'l' ? runlazy(ls, c->depth, c->threads, symbols)
+                                       : rundag(ls, c->depth, c->threads, symbols);
+        *bytes = *symbols;
+        return err;
+    }
+
+    int packed = strcmp(c->backend, "packed") == 0;
+    Arena *a = packed ? mkpkarena(ls) : mkarena(ls->axiom);
+    for (int i = 0; i < c->depth; i++) {
+        size_t n = packed ? pknext(a, ls, c->threads) : arenanext(a, ls, c->threads);
+        *bytes += packed ? pkwords(ls, n) * sizeof(uint64_t) : n;
+    }
+    *symbols = a->len;
+    freearena(a);
+    return 0;
+}
+
+int cmpdouble(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Percentil p (0 a 100) de n tiempos ya ordenados, por el rango más cercano.
+ */
+double percentile(double *t, int n, double p) {
+    int i = (int)(p / 100.0 * n + 0.999999) - 1;
+    if (i < 0)
+        i = 0;
+    if (i >= n)
+        i = n - 1;
+    return t[i];
+}
+
+/**
+ * Mide una configuración en un proceso hijo, para que el pico de memoria
+ * residente sea solo suyo y LSYSTEM_SIMD se aplique antes de elegir núcleo.
+ * Devuelve 0 si todo fue bien.
+ */
+int measure(Config *c, Result *r) {
+    int fd[2];
+    if (pipe(fd) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        close(fd[0]);
+        if (strcmp(c->simd, "auto") != 0)
+            setenv("LSYSTEM_SIMD", c->simd, 1);
+        Lsystem *ls = parse(c->file);
+        double *t = emalloc(reps * sizeof(double));
+        uint64_t symbols, bytes;
+
+        for (int i = 0; i < warmups; i++)
+            if (trial(c, ls, &symbols, &bytes) != 0)
+                _exit(1);
+        for (int i = 0; i < reps; i++) {
+            double t0 = now();
+            if (trial(c, ls, &r->symbols, &r->bytes) != 0)
+                _exit(1);   // La medida falla, pero el barrido sigue
+            t[i] = now() - t0;
+        }
+        qsort(t, reps, sizeof(double), cmpdouble);
+        r->min = t[0];
+        r->p50 = percentile(t, reps, 50);
+        r->p90 = percentile(t, reps, 90);
+        r->max = t[reps - 1];
+        snprintf(r->simd, sizeof r->simd, "%s", ls->simd ? simdname() : "escalar");
+        if (write(fd[1], r, sizeof *r) != sizeof *r)
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fd[1]);
+    int status;
+    struct rusage ru;
+    ssize_t n = read(fd[0], r, sizeof *r);
+    close(fd[0]);
+    if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || n != sizeof *r)
+        return -1;
+    r->rss = ru.ru_maxrss;
+    return 0;
+}
+
+/**
+ * Separa una lista "a,b,c" en sus elementos (modifica la cadena).
+ */
+int split(char *s, char **out) {
+    int n = 0;
+    for (char *tok = strtok(s, ","); tok && n < MAXLIST; tok = strtok(NULL, ","))
+        out[n++] = tok;
+    return n;
+}
+
+/**
+ * Lee un CSV escrito por este programa y guarda la mediana de cada
+ * configuración. Devuelve el número de configuraciones leídas.
+ */
+int readbase(char *filename, Base **base) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    char line[LINESIZE];
+    int n = 0, cap = 64;
+    *base = emalloc(cap * sizeof(Base));
+
+    while (fgets(line, sizeof line, fp)) {
+        char *f[16];
+        int nf = 0;
+        for (char *p = line; nf < 16; p++) {
+            f[nf++] = p;
+            p = strchr(p, ',');
+            if (p == NULL)
+                break;
+            *p = '\0';
+        }
+        if (nf < 8 || strcmp(f[0], "sistema") == 0)	// Cabecera o línea incompleta
+            continue;
+        if (n == cap) {
+            cap *= 2;
+            *base = realloc(*base, cap * sizeof(Base));
+            if (*base == NULL) {
+                fprintf(stderr, "readbase: sin memoria\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        // La clave son los cinco primeros campos, con sus comas
+        size_t klen = f[5] - 1 - line;
+        memcpy((*base)[n].key, line, klen);
+        (*base)[n].key[klen] = '\0';
+        for (size_t i = 0; i < klen; i++)
+            if ((*base)[n].key[i] == '\0')
+                (*base)[n].key[i] = ',';
+        (*base)[n].p50 = atof(f[7]);
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+void usage(char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-d profundidades] [-t hilos] [-k motores] [-v simd] [-r repeticiones]\n"
+            "       [-w calentamiento] [-f csv|json] [-b referencia.csv] [-x tolerancia] archivo...\n"
+            "  motores: bytes, packed, lazy, dag (por defecto bytes,packed)\n"
+            "  simd: auto, scalar, sse4, avx2, avx512 (por defecto auto)\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    char depthlist[] = "8,10", threadlist[] = "1", backendlist[] = "bytes,packed", simdlist[] = "auto";
+    char *sd = depthlist, *st = threadlist, *sk = backendlist, *sv = simdlist;
+    char *basefile = NULL, *format = "csv";
+    double tol = 0.10;	// Una mediana un 10 % más lenta es una regresión
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:k:v:r:w:f:b:x:")) != -1) {
+        switch (opt) {
+            case 'd': sd = optarg; break;
+            case 't': st = optarg; break;
+            case 'k': sk = optarg; break;
+            case 'v': sv = optarg; break;
+            case 'r': reps = atoi(optarg); break;
+            case 'w': warmups = atoi(optarg); break;
+            case 'f': format = optarg; break;
+            case 'b': basefile = optarg; break;
+            case 'x': tol = atof(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    int json = strcmp(format, "json") == 0;
+    if (optind == argc || reps < 1 || warmups < 0 || (!json && strcmp(format, "csv") != 0))
+        usage(argv[0]);
+
+    char *depths[MAXLIST], *threads[MAXLIST], *backends[MAXLIST], *simds[MAXLIST];
+    int nd = split(sd, depths), nt = split(st, threads);
+    int nk = split(sk, backends), nv = split(sv, simds);
+    for (int k = 0; k < nk; k++)
+        if (strcmp(backends[k], "bytes") && strcmp(backends[k], "packed") &&
+            strcmp(backends[k], "lazy") && strcmp(backends[k], "dag"))
+            usage(argv[0]);
+
+    Base *base = NULL;
+    int nbase = basefile ? readbase(basefile, &base) : 0;
+    int regressions = 0, first = 1;
+
+    if (json)
+        printf("[\n");
+    else
+        printf("sistema,backend,simd,profundidad,hilos,repeticiones,min_s,p50_s,p90_s,max_s,"
+               "simbolos,simbolos_s,bytes_s,rss_kb,nucleo%s\n", basefile ? ",base_p50_s,cambio,regresion" : "");
+
+    for (int f = optind; f < argc; f++)
+    for (int k = 0; k < nk; k++)
+    for (int v = 0; v < nv; v++)
+    for (int d = 0; d < nd; d++)
+    for (int t = 0; t < nt; t++) {
+        Config c = { argv[f], backends[k], simds[v], atoi(depths[d]), atoi(threads[t]) };
+        Result r;
+        if (c.threads < 1)
+            c.threads = 1;
+        if (measure(&c, &r) != 0) {
+            fprintf(stderr, "%s %s %s %d %d: la medida falló\n",
+                    c.file, c.backend, c.simd, c.depth, c.threads);
+            continue;
+        }
+
+        // Comparación con la referencia: misma configuración, mediana
+        char key[LINESIZE];
+        double bp50 = 0, change = 0;
+        int found = 0, reg = 0;
+        snprintf(key, sizeof key, "%s,%s,%s,%d,%d", c.file, c.backend, c.simd, c.depth, c.threads);
+        for (int i = 0; i < nbase; i++)
+            if (strcmp(base[i].key, key) == 0) {
+                found = 1;
+                bp50 = base[i].p50;
+                change = bp50 > 0 ? r.p50 / bp50 - 1 : 0;
+                reg = change > tol;
+            }
+        if (reg) {
+            regressions++;
+            fprintf(stderr, "REGRESIÓN %s: mediana %.6f s frente a %.6f s (%+.1f %%)\n",
+                    key, r.p50, bp50, 100 * change);
+        }
+
+        double sps = r.p50 > 0 ? r.symbols / r.p50 : 0;
+        double bps = r.p50 > 0 ? r.bytes / r.p50 : 0;
+        if (json) {
+            printf("%s  {\"sistema\": \"%s\", \"backend\": \"%s\", \"simd\": \"%s\", \"nucleo\": \"%s\", "
+                   "\"profundidad\": %d, \"hilos\": %d, \"repeticiones\": %d, "
+                   "\"min_s\": %.9f, \"p50_s\": %.9f, \"p90_s\": %.9f, \"max_s\": %.9f, "
+                   "\"simbolos\": %llu, \"simbolos_s\": %.0f, \"bytes_s\": %.0f, \"rss_kb\": %ld",
+                   first ? "" : ",\n", c.file, c.backend, c.simd, r.simd, c.depth, c.threads, reps,
+                   r.min, r.p50, r.p90, r.max, (unsigned long long)r.symbols, sps, bps, r.rss);
+            if (found)
+                printf(", \"base_p50_s\": %.9f, \"cambio\": %.4f, \"regresion\": %s",
+                       bp50, change, reg ? "true" : "false");
+            printf("}");
+        } else {
+            printf("%s,%s,%s,%d,%d,%d,%.9f,%.9f,%.9f,%.9f,%llu,%.0f,%.0f,%ld,%s",
+                   c.file, c.backend, c.simd, c.depth, c.threads, reps,
+                   r.min, r.p50, r.p90, r.max, (unsigned long long)r.symbols, sps, bps, r.rss, r.simd);
+            if (basefile) {
+                if (found)
+                    printf(",%.9f,%.4f,%d", bp50, change, reg);
+                else
+                    printf(",,,");
+            }
+            printf("\n");
+        }
+        first = 0;
+        fflush(stdout);
+    }
+    if (json)
+        printf("\n]\n");
+
+    free(base);
+    return regressions ? 2 : 0;
+}
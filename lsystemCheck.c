@@ -0,0 +1,638 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "a.h"
+
+/**
+ * Comprobaciones de make check: casos con resultado conocido de las partes
+ * que no se ven al dibujar. Escribe cada fallo y termina con error si hay
+ * alguno. Se ejecuta desde la raíz del repositorio (lee systems/).
+ */
+
+int checks, fails;	// Comprobaciones hechas y fallidas
+
+void check(int ok, const char *fmt, ...) {
+    va_list ap;
+    checks++;
+    if (ok)
+        return;
+    fails++;
+    fprintf(stderr, "FALLO: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/**
+ * Compila s con los parámetros formales t y s, la evalúa con par y
+ * comprueba que da want. Devuelve el número de instrucciones del código.
+ */
+int checkexpr(const char *s, const double *par, double want) {
+    char *formals[] = { "t", "s" };
+    Expr *e = mkexpr(s, formals, 2);
+    double v = eval(e, par);
+    int n = e->n;
+    freeexpr(e);
+    check(fabs(v - want) <= 1e-12 * fabs(want), "'%s' da %g y no %g", s, v, want);
+    return n;
+}
+
+/**
+ * Compilador de expresiones de las reglas paramétricas (expr.c).
+ */
+void checkexprs(void) {
+    double par[] = { 2, 0.5 };
+
+    // Precedencia y asociatividad
+    checkexpr("1+2*3", par, 7);
+    checkexpr("(1+2)*3", par, 9);
+    checkexpr("10-4-3", par, 3);
+    checkexpr("8/4/2", par, 1);
+    checkexpr("2*3^2", par, 18);
+    checkexpr("2^3^2", par, 512);     // Por la derecha: 2^(3^2)
+    checkexpr("-2^2", par, -4);       // El signo se aplica a la potencia
+    checkexpr("2^-1", par, 0.5);
+    checkexpr("1+1==2", par, 1);
+    checkexpr("0&&1||1", par, 1);
+    checkexpr("!0&&t", par, 1);
+
+    // <= y >= no se leen como < o > seguidos de =
+    checkexpr("t<=2", par, 1);
+    checkexpr("t<2", par, 0);
+    checkexpr("t>=2", par, 1);
+    checkexpr("t>2", par, 0);
+    checkexpr("t!=2", par, 0);
+    checkexpr("t=2", par, 1);
+    checkexpr("s*4<=t", par, 1);
+
+    // Plegado de constantes: lo que no depende de parámetros es una instrucción
+    int n = checkexpr("2*3.14/180", par, 2 * 3.14 / 180);
+    check(n == 1, "'2*3.14/180' tiene %d instrucciones y no 1", n);
+    n = checkexpr("t*(2+3)", par, 10);
+    check(n == 3, "'t*(2+3)' tiene %d instrucciones y no 3", n);
+    n = checkexpr("-(2^2)+t", par, -2);
+    check(n == 3, "'-(2^2)+t' tiene %d instrucciones y no 3", n);
+    n = checkexpr("t*2+3", par, 7);   // (t*2)+3: no hay nada que plegar
+    check(n == 5, "'t*2+3' tiene %d instrucciones y no 5", n);
+}
+
+/**
+ * Hash FNV-1a de 64 bits de n bytes, para comparar generaciones enteras.
+ */
+uint64_t fnv(uint64_t h, const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+#define FNVINIT 0xcbf29ce484222325ULL
+
+/**
+ * Parsea un L-system escrito en el propio programa.
+ */
+Lsystem* fromtext(const char *text) {
+    return parsetext("check", text, strlen(text), NULL);
+}
+
+/**
+ * Expande ls desde el axioma hasta la generación depth con arenanext().
+ */
+Arena* expandto(Lsystem *ls, int depth, int threads) {
+    Arena *a = mkarena(ls->axiom);
+    for (int d = 0; d < depth; d++)
+        arenanext(a, ls, threads);
+    return a;
+}
+
+/**
+ * Expande ls hasta depth y compara growth() con lo que sale de verdad: el
+ * vector de Parikh, los segmentos y el anidamiento. Sin reglas con contexto
+ * (exact) tienen que coincidir; con ellas growth() da cotas superiores.
+ */
+void checkgrowth(const char *name, Lsystem *ls, int depth) {
+    Arena *a = expandto(ls, depth, 1);
+    const char *gen = arenagen(a);
+    uint64_t count[256] = { 0 }, segs = 0, nest = 0;
+    int64_t open = 0;
+    for (size_t i = 0; i < a->len; i++) {
+        unsigned char c = gen[i];
+        count[c]++;
+        segs += ls->table[c].op == T_FORWARD;
+        open += c == '[' ? 1 : c == ']' ? -1 : 0;
+        if (open > (int64_t)nest)
+            nest = open;
+    }
+
+    Growth g;
+    growth(ls, depth, &g);
+    check(!g.sat, "%s %d: growth() se satura", name, depth);
+    if (g.exact) {
+        check(g.len == a->len, "%s %d: growth() da %llu símbolos y hay %zu", name, depth,
+              (unsigned long long)g.len, a->len);
+        for (int c = 0; c < 256; c++)
+            check(g.count[c] == count[c], "%s %d: growth() da %llu '%c' y hay %llu", name, depth,
+                  (unsigned long long)g.count[c], c, (unsigned long long)count[c]);
+        check(g.segs == segs, "%s %d: growth() da %llu segmentos y hay %llu", name, depth,
+              (unsigned long long)g.segs, (unsigned long long)segs);
+        check(g.nest == nest, "%s %d: growth() da anidamiento %llu y es %llu", name, depth,
+              (unsigned long long)g.nest, (unsigned long long)nest);
+    } else {
+        check(g.len >= a->len, "%s %d: la cota %llu es menor que los %zu símbolos", name, depth,
+              (unsigned long long)g.len, a->len);
+        check(g.nest >= nest, "%s %d: la cota de anidamiento %llu es menor que %llu", name, depth,
+              (unsigned long long)g.nest, (unsigned long long)nest);
+    }
+    freearena(a);
+}
+
+/**
+ * Predicción de tamaños sin expandir (growth.c).
+ */
+void checkgrowths(void) {
+    Lsystem *plant = parse("systems/plant"), *koch = parse("systems/koch");
+    Lsystem *signal = parse("systems/signal");
+    for (int d = 0; d <= 8; d++)
+        checkgrowth("systems/plant", plant, d);
+    for (int d = 0; d <= 5; d++)
+        checkgrowth("systems/koch", koch, d);
+    for (int d = 0; d <= 30; d += 10)
+        checkgrowth("systems/signal", signal, d);
+
+    // Sin expandir: la longitud coincide con la de la tabla de iter.c hasta
+    // que no cabe en 64 bits, y desde ahí todo se satura
+    Growth g;
+    Lentab *lt = mklentab(plant, 25);
+    growth(plant, 25, &g);
+    check(!g.sat && g.len == genlen(lt, 25), "systems/plant 25: growth() da %llu símbolos y no %llu",
+          (unsigned long long)g.len, (unsigned long long)genlen(lt, 25));
+    freelentab(lt);
+    growth(plant, 40, &g);
+    check(g.sat && g.len == UINT64_MAX && g.bytes == UINT64_MAX,
+          "systems/plant 40: growth() no se satura (%llu símbolos)", (unsigned long long)g.len);
+    freelsystem(plant);
+    freelsystem(koch);
+    freelsystem(signal);
+
+    // Anidamiento: crece con cada generación, o se para en un punto fijo
+    Lsystem *deep = fromtext("name 'deep'\naxiom A\nrule A -> [A]F\n");
+    Lsystem *fixed = fromtext("name 'fixed'\naxiom C\nrule C -> [B]\nrule B -> [A]\nrule A -> F\n");
+    Lsystem *flat = fromtext("name 'flat'\naxiom [F]F\nrule F -> FF\n");
+    for (int d = 0; d <= 6; d++) {
+        checkgrowth("deep", deep, d);
+        checkgrowth("fixed", fixed, d);
+        checkgrowth("flat", flat, d);
+    }
+    growth(deep, 1000, &g);
+    check(g.nest == 1000, "deep 1000: growth() da anidamiento %llu y no 1000", (unsigned long long)g.nest);
+    growth(fixed, 1000, &g);
+    check(g.nest == 2, "fixed 1000: growth() da anidamiento %llu y no 2", (unsigned long long)g.nest);
+    growth(flat, 1000, &g);
+    check(g.nest == 1 && g.sat, "flat 1000: growth() da anidamiento %llu y no 1", (unsigned long long)g.nest);
+    freelsystem(deep);
+    freelsystem(fixed);
+    freelsystem(flat);
+}
+
+/**
+ * Lee hasta len símbolos del DAG g con dagread(); devuelve su hash y deja
+ * en got cuántos leyó.
+ */
+uint64_t daghash(Dag *g, size_t len, size_t *got) {
+    char buf[4096];
+    size_t n;
+    uint64_t h = FNVINIT;
+    Dagiter *di = mkdagiter(g, 0);
+    *got = 0;
+    while (*got < len && (n = dagread(di, buf, sizeof buf)) > 0) {
+        h = fnv(h, buf, n);
+        *got += n;
+    }
+    freedagiter(di);
+    return h;
+}
+
+/**
+ * Compara la generación depth de ls, calculada con cada motor que la
+ * admite, con su longitud y su hash conocidos (obtenidos con una
+ * implementación aparte). name solo sirve para los mensajes.
+ */
+void checkls(const char *name, Lsystem *ls, int depth, size_t len, uint64_t hash) {
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        Arena *a = expandto(ls, depth, threads);
+        check(a->len == len && fnv(FNVINIT, arenagen(a), a->len) == hash,
+              "%s %d con %d hilos: la generación no es la conocida", name, depth, threads);
+        freearena(a);
+    }
+    if (ls->ctx)	// Los demás motores no admiten reglas con contexto
+        return;
+
+    // Empaquetada
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        Arena *a = mkpkarena(ls);
+        for (int d = 0; d < depth; d++)
+            pknext(a, ls, threads);
+        char *gen = emalloc(a->len + 1);
+        unpack(ls, (const uint64_t*)arenagen(a), 0, a->len, gen);
+        check(a->len == len && fnv(FNVINIT, gen, a->len) == hash,
+              "%s %d empaquetada con %d hilos: la generación no es la conocida", name, depth, threads);
+        free(gen);
+        freearena(a);
+    }
+
+    // Perezosa, leída a trozos (con reglas estocásticas no se puede saltar,
+    // así que también lazygen() la recorre con un solo iterador)
+    char buf[4096];
+    size_t n, got = 0;
+    uint64_t h = FNVINIT;
+    Iter *it = mkiter(ls, depth);
+    while ((n = iterread(it, buf, sizeof buf)) > 0) {
+        h = fnv(h, buf, n);
+        got += n;
+    }
+    freeiter(it);
+    check(got == len && h == hash, "%s %d perezosa: la generación no es la conocida", name, depth);
+    if (ls->stoch)	// Ni DAG: dos apariciones de un símbolo no se expanden igual
+        return;
+
+    Dag *g = mkdag(ls, depth);
+    h = daghash(g, len, &got);
+    check(daglen(g) == len && got == len && h == hash, "%s %d con el DAG: la generación no es la conocida",
+          name, depth);
+
+    // Guardado y vuelto a leer; cortado a la mitad no se puede leer
+    char *text;
+    size_t size;
+    FILE *fp = open_memstream(&text, &size);
+    check(dagsave(g, fp) == 0, "%s %d: dagsave() falla", name, depth);
+    fclose(fp);
+    freedag(g);
+    fp = fmemopen(text, size, "r");
+    g = dagload(fp);
+    fclose(fp);
+    check(g != NULL, "%s %d: dagload() no lee lo que escribe dagsave()", name, depth);
+    if (g) {
+        h = daghash(g, len, &got);
+        check(daglen(g) == len && got == len && h == hash,
+              "%s %d con el DAG cargado: la generación no es la conocida", name, depth);
+        freedag(g);
+    }
+    fp = fmemopen(text, size / 2, "r");
+    g = dagload(fp);
+    fclose(fp);
+    check(g == NULL, "%s %d: dagload() acepta un DAG cortado", name, depth);
+    if (g)
+        freedag(g);
+    free(text);
+}
+
+/**
+ * checkls() con el L-system del archivo file.
+ */
+void checkgen(const char *file, int depth, size_t len, uint64_t hash) {
+    Lsystem *ls = parse((char*)file);
+    checkls(file, ls, depth, len, hash);
+    freelsystem(ls);
+}
+
+/**
+ * Hash del texto de una generación paramétrica, módulo a módulo como lo
+ * escribe -e; en chars deja su longitud.
+ */
+uint64_t fmthash(Lsystem *ls, Arena *a, size_t *chars) {
+    const char *gen = arenagen(a);
+    const double *par = a->par[a->cur] ? a->par[a->cur] : ls->axpar;
+    char buf[MAXMODULE];
+    uint64_t h = FNVINIT;
+    *chars = 0;
+    for (size_t i = 0; i < a->len; i++) {
+        size_t n = fmtmodule(ls, gen[i], par, a->cap[a->cur], i, buf);
+        h = fnv(h, buf, n);
+        *chars += n;
+    }
+    return h;
+}
+
+/**
+ * Expansión paramétrica (param.c): compara el texto de la generación depth,
+ * con 1 y 4 hilos, con su longitud y su hash conocidos.
+ */
+void checkparam(const char *name, Lsystem *ls, int depth, size_t modules, size_t chars, uint64_t hash) {
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        Arena *a = expandto(ls, depth, threads);
+        size_t n;
+        uint64_t h = fmthash(ls, a, &n);
+        check(a->len == modules && n == chars && h == hash,
+              "%s %d con %d hilos: la generación (%zu módulos, %zu caracteres) no es la conocida",
+              name, depth, threads, a->len, n);
+        freearena(a);
+    }
+}
+
+/**
+ * Generaciones conocidas de los sistemas de ejemplo.
+ */
+void checkgens(void) {
+    const char *plant2 = "FF+[[F+[[X]-X]-F[-FX]+X]-F+[[X]-X]-F[-FX]+X]-FF[-FFF+[[X]-X]-F[-FX]+X]"
+                         "+F+[[X]-X]-F[-FX]+X";
+    checkgen("systems/plant", 2, strlen(plant2), fnv(FNVINIT, plant2, strlen(plant2)));
+    checkgen("systems/plant", 6, 25159, 0x2a20bf0504ae3680ULL);
+    checkgen("systems/plant", 8, 403751, 0xaa2599d2d98d5740ULL);
+
+    // La señal recorre la fila de 1 y se ramifica con 0 < 0 > 1 -> 1[-F1F1]
+    checkgen("systems/signal", 1, 6, fnv(FNVINIT, "F1F0F1", 6));
+    checkgen("systems/signal", 3, 8, fnv(FNVINIT, "F1F0F0F1", 8));
+    checkgen("systems/signal", 10, 50, 0xfdf4c5a806ad77b3ULL);
+    checkgen("systems/signal", 30, 6748, 0xe04edff924121667ULL);
+    checkgen("systems/signal", 40, 102613, 0xfbccc9f51e98f0ecULL);
+
+    // Las reglas estocásticas eligen lo mismo con cualquier reparto: la
+    // generación 8 tiene varios bloques de 16K símbolos
+    checkgen("systems/stochastic", 2, 31, fnv(FNVINIT, "F[+F]F[-F]F[-F[+F]F]F[+F]F[-F]F", 31));
+    checkgen("systems/stochastic", 3, 116, 0xe46f2a6d5b456482ULL);
+    checkgen("systems/stochastic", 8, 80711, 0xc45c832a4eeccaf9ULL);
+
+    // Otra semilla, en el archivo o en LSYSTEM_SEED, da otra generación
+    Lsystem *ls = fromtext("name 'seed 2'\naxiom F\nrule F 0.33 -> F[+F]F[-F]F\n"
+                           "rule F 0.33 -> F[+F]F\nrule F 0.34 -> F[-F]F\nseed 2\n");
+    checkls("systems/stochastic con seed 2", ls, 8, 53501, 0x7e01500356e3c7d1ULL);
+    freelsystem(ls);
+    setenv("LSYSTEM_SEED", "7", 1);
+    ls = parse("systems/stochastic");
+    unsetenv("LSYSTEM_SEED");
+    check(ls->seed == 7, "LSYSTEM_SEED=7 no cambia la semilla (%llu)", (unsigned long long)ls->seed);
+    checkls("systems/stochastic con LSYSTEM_SEED=7", ls, 8, 62096, 0x43247e660485e9f6ULL);
+    freelsystem(ls);
+
+    // Paramétrico: se aplica la primera regla cuya condición se cumple y,
+    // si no se cumple ninguna (A(0) desde la generación 15), el módulo se copia
+    ls = fromtext("name 'param'\naxiom A(14)\nrule A(t) : t>0 -> F(t)[+A(t-1)]-A(t-1)\n"
+                  "rule F(l) : l<3 -> F(l*1.5)\nrule F(l) -> F(l/2)G\n");
+    const char *param2 = "F(7)G[+F(13)[+A(12)]-A(12)]-F(13)[+A(12)]-A(12)";
+    checkparam("param", ls, 0, 1, 5, fnv(FNVINIT, "A(14)", 5));
+    checkparam("param", ls, 2, 20, strlen(param2), fnv(FNVINIT, param2, strlen(param2)));
+    checkparam("param", ls, 10, 6984, 13856, 0x7199ba16812c1be7ULL);
+    checkparam("param", ls, 16, 111944, 268988, 0x16166dc25b82aa44ULL);
+    checkparam("param", ls, 20, 129692, 349816, 0xa4fbcc55c8587cfbULL);
+    freelsystem(ls);
+}
+
+/**
+ * Checkpoints (ckpt.c): guarda la generación k en path, la carga y sigue
+ * hasta depth; tiene que dar lo mismo que expandir desde el axioma.
+ */
+void checkckpt(const char *name, Lsystem *ls, int k, int depth, const char *path) {
+    Arena *a = expandto(ls, k, 4);
+    check(cksave(a, ls, path) == 0, "%s: no se pudo guardar la generación %d", name, k);
+    freearena(a);
+    a = ckload(path, ls);
+    check(a != NULL && a->depth == k, "%s: no se pudo cargar la generación %d", name, k);
+    if (a == NULL)
+        return;
+    while (a->depth < depth)
+        arenanext(a, ls, 4);
+    Arena *b = expandto(ls, depth, 4);
+    size_t na, nb;
+    int same = ls->param ? fmthash(ls, a, &na) == fmthash(ls, b, &nb) && na == nb :
+                           fnv(FNVINIT, arenagen(a), a->len) == fnv(FNVINIT, arenagen(b), b->len);
+    check(a->len == b->len && same, "%s: seguir desde la generación %d no da la %d", name, k, depth);
+    freearena(b);
+    freearena(a);
+}
+
+/**
+ * Cambia n bytes del archivo path en off por p, o lo corta en off si p es NULL.
+ */
+void patch(const char *path, off_t off, const void *p, size_t n) {
+    int fd = open(path, O_WRONLY);
+    int err = fd < 0 || (p ? pwrite(fd, p, n, off) != (ssize_t)n : ftruncate(fd, off) != 0);
+    check(!err, "%s: no se pudo modificar", path);
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * ckload() tiene que rechazar un checkpoint de la generación k de ls en
+ * cuanto le falte un byte, tenga uno cambiado o sea de otras reglas.
+ */
+void checkckbad(Lsystem *ls, int k, const char *path) {
+    Arena *a = expandto(ls, k, 1);
+    struct stat st;
+    check(cksave(a, ls, path) == 0 && stat(path, &st) == 0, "%s: no se pudo guardar", path);
+    freearena(a);
+
+    // Otra semilla, u otras reglas con el mismo axioma
+    ls->seed++;
+    check(ckload(path, ls) == NULL, "ckload() acepta el checkpoint con otra semilla");
+    ls->seed--;
+    Lsystem *other = fromtext("name 'otro'\naxiom X\nrule X -> F[+X]F[-X]+X\nrule F -> FF\n");
+    check(ckload(path, other) == NULL, "ckload() acepta el checkpoint de otras reglas");
+    freelsystem(other);
+
+    // Un símbolo cambiado (la cabecera ocupa la primera página de 4096 bytes)
+    char c = 0;
+    int fd = open(path, O_RDONLY);
+    check(fd >= 0 && pread(fd, &c, 1, 4096 + 10) == 1, "%s: no se pudo leer", path);
+    if (fd >= 0)
+        close(fd);
+    c ^= 1;
+    patch(path, 4096 + 10, &c, 1);
+    check(ckload(path, ls) == NULL, "ckload() acepta un checkpoint con un símbolo cambiado");
+    c ^= 1;
+    patch(path, 4096 + 10, &c, 1);
+    a = ckload(path, ls);
+    check(a != NULL, "ckload() no acepta el checkpoint restaurado");
+    if (a)
+        freearena(a);
+
+    // npar, en el byte 40 de la cabecera (ver Ckhdr)
+    int32_t npar = ls->npar + 1;
+    patch(path, 40, &npar, sizeof npar);
+    check(ckload(path, ls) == NULL, "ckload() acepta un checkpoint con npar %d", npar);
+
+    // Cortado: sin la cola y sin la mitad de los símbolos
+    patch(path, st.st_size - 1, NULL, 0);
+    check(ckload(path, ls) == NULL, "ckload() acepta un checkpoint sin el último byte");
+    patch(path, 4096 + 2048, NULL, 0);
+    check(ckload(path, ls) == NULL, "ckload() acepta un checkpoint cortado");
+}
+
+/**
+ * Crea un archivo vacío en el directorio actual (para que admita O_DIRECT,
+ * que /tmp en memoria no siempre admite) y deja su nombre en path.
+ */
+int mktmp(char path[static 20]) {
+    strcpy(path, "lsystemCheck-XXXXXX");
+    int fd = mkstemp(path);
+    check(fd >= 0, "no se pudo crear el archivo temporal");
+    if (fd < 0)
+        return -1;
+    close(fd);
+    return 0;
+}
+
+void checkckpts(void) {
+    char path[20];
+    if (mktmp(path) != 0)
+        return;
+
+    Lsystem *ls = parse("systems/plant");
+    checkckpt("systems/plant", ls, 4, 8, path);
+    checkckbad(ls, 6, path);
+    freelsystem(ls);
+    ls = parse("systems/stochastic");
+    checkckpt("systems/stochastic", ls, 3, 8, path);
+    freelsystem(ls);
+
+    // Los parámetros van en secciones de stride doubles
+    ls = fromtext("name 'param'\naxiom A(14)\nrule A(t) : t>0 -> F(t)[+A(t-1)]-A(t-1)\n"
+                  "rule F(l) : l<3 -> F(l*1.5)\nrule F(l) -> F(l/2)G\n");
+    checkckpt("param", ls, 8, 16, path);
+    checkckbad(ls, 8, path);
+    freelsystem(ls);
+    unlink(path);
+}
+
+/**
+ * Exportación (export.c): el archivo que escribe exportgen() tiene que ser
+ * la generación depth tal como la da arenanext(), o su texto si ls es
+ * paramétrico.
+ */
+void checkexport(const char *name, Lsystem *ls, int depth, int threads, const char *path) {
+    uint64_t n;
+    int err = exportgen(ls, depth, path, threads, &n);
+    int fd = open(path, O_RDONLY);
+    char *buf = emalloc(1 << 16);
+    ssize_t k;
+    size_t bytes = 0;
+    uint64_t h = FNVINIT;
+    while (fd >= 0 && (k = read(fd, buf, 1 << 16)) > 0) {
+        h = fnv(h, buf, k);
+        bytes += k;
+    }
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+
+    Arena *a = expandto(ls, depth, 4);
+    size_t chars = a->len;
+    uint64_t want = ls->param ? fmthash(ls, a, &chars) : fnv(FNVINIT, arenagen(a), a->len);
+    check(err == 0 && n == a->len && bytes == chars && h == want,
+          "%s %d exportada con %d hilos: %zu bytes, y la generación tiene %zu", name, depth, threads,
+          bytes, chars);
+    freearena(a);
+}
+
+void checkexports(void) {
+    char path[20];
+    if (mktmp(path) != 0)
+        return;
+
+    // La generación 10 ocupa dos búferes de EXPCHUNK y no es múltiplo de la
+    // alineación de O_DIRECT, así que la última tanda deja una cola
+    Lsystem *ls = parse("systems/plant");
+    Arena *a = expandto(ls, 10, 4);
+    check(a->len > 4 << 20 && a->len % 4096 != 0, "systems/plant 10 ya no deja cola (%zu símbolos)", a->len);
+    freearena(a);
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        checkexport("systems/plant", ls, 2, threads, path);
+        checkexport("systems/plant", ls, 10, threads, path);
+    }
+    freelsystem(ls);
+    ls = parse("systems/stochastic");
+    checkexport("systems/stochastic", ls, 8, 4, path);
+    freelsystem(ls);
+    ls = parse("systems/signal");
+    checkexport("systems/signal", ls, 40, 4, path);
+    freelsystem(ls);
+    ls = fromtext("name 'param'\naxiom A(14)\nrule A(t) : t>0 -> F(t)[+A(t-1)]-A(t-1)\n"
+                  "rule F(l) : l<3 -> F(l*1.5)\nrule F(l) -> F(l/2)G\n");
+    checkexport("param", ls, 16, 4, path);
+    freelsystem(ls);
+    unlink(path);
+}
+
+/**
+ * dagload() tiene que rechazar un DAG mal formado sin leer fuera de él.
+ */
+void checkdags(void) {
+    const char *bad[] = {
+        "",
+        "dag 1 0\n",
+        "dag 1 2\n70 0 0\n70 1 1 2\n",		// Hijo que no existe
+        "dag 1 2\n70 0 0\n70 1 1 1\n",		// Hijo que es el propio nodo
+        "dag 1 2\n70 1 0\n70 1 1 0\n",		// Hijo a la misma profundidad
+        "dag 1 2\n300 0 0\n70 1 1 0\n",		// Símbolo fuera de rango
+        "dag 1 2\n70 0 1 0\n70 1 1 0\n",	// Hoja con hijos
+        "dag 1 1\n70 0 0\n",				// La raíz es una hoja
+        "dag 1 2\n70 0 0\n70 1 3 0 0\n",	// Faltan hijos
+    };
+    for (size_t i = 0; i < sizeof bad / sizeof bad[0]; i++) {
+        FILE *fp = fmemopen((void*)bad[i], strlen(bad[i]) + 1, "r");
+        Dag *g = dagload(fp);
+        fclose(fp);
+        check(g == NULL, "dagload() acepta el DAG mal formado %zu", i);
+        if (g)
+            freedag(g);
+    }
+    const char *good = "dag 1 2\n70 0 0\n70 1 3 0 0 0\n";
+    FILE *fp = fmemopen((void*)good, strlen(good), "r");
+    Dag *g = dagload(fp);
+    fclose(fp);
+    check(g != NULL && daglen(g) == 3, "dagload() no lee un DAG de tres hojas");
+    if (g)
+        freedag(g);
+}
+
+/**
+ * Catálogo (catalog.c): de un archivo con tres definiciones, la del medio
+ * con un error, se cargan las otras dos en su orden.
+ */
+void checkcatalog(void) {
+    char path[20];
+    if (mktmp(path) != 0)
+        return;
+    const char *bundle = "name 'Fractal Plant'\naxiom X\nrule X -> F+[[X]-X]-F[-FX]+X\nrule F -> FF\n"
+                         "name 'Roto'\naxiom F\nrule F F+F\n"
+                         "name 'Koch Curve'\naxiom F\nrule F -> F+F-F-F+F\n";
+    FILE *fp = fopen(path, "w");
+    check(fp != NULL && fputs(bundle, fp) >= 0 && fclose(fp) == 0, "%s: no se pudo escribir", path);
+
+    const char *koch2 = "F+F-F-F+F+F+F-F-F+F-F+F-F-F+F-F+F-F-F+F+F+F-F-F+F";
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        Catalog *cat = loadcatalog(path, threads);
+        check(cat->n == 2 && strcmp(cat->sys[0]->name, "Fractal Plant") == 0 &&
+              strcmp(cat->sys[1]->name, "Koch Curve") == 0,
+              "catálogo con %d hilos: %zu sistemas en vez de Fractal Plant y Koch Curve", threads, cat->n);
+        if (cat->n == 2) {
+            check(findsystem(cat, "Fractal_Plant") == cat->sys[0] && findsystem(cat, "Koch_Curve") == cat->sys[1],
+                  "findsystem() no encuentra los sistemas con '_' por espacio");
+            check(findsystem(cat, "Roto") == NULL && findsystem(cat, "Fractal") == NULL &&
+                  findsystem(cat, "Fractal_Plant_") == NULL, "findsystem() encuentra un sistema que no está");
+            checkls("Koch Curve del catálogo", cat->sys[1], 2, strlen(koch2), fnv(FNVINIT, koch2, strlen(koch2)));
+        }
+        freecatalog(cat);
+    }
+    unlink(path);
+}
+
+int main(void) {
+    checkexprs();
+    checkgrowths();
+    checkgens();
+    checkdags();
+    checkcatalog();
+    checkckpts();
+    checkexports();
+
+    printf("%d comprobaciones, %d fallos\n", checks, fails);
+    return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+
+#include "a.h"
+
+#define CHUNK (16 << 20)	// Símbolos que cada proceso genera y escribe de una vez
+
+/**
+ * Envía los símbolos del tramo al proceso 0 en trozos de CHUNK, en orden.
+ * Si el iterador se acaba antes de tiempo envía un mensaje vacío, que el
+ * proceso 0 toma como final del tramo, y devuelve -1.
+ */
+int sendslice(Iter *it, uint64_t n, char *buf) {
+    for (uint64_t done = 0; done < n; ) {
+        size_t want = n - done < CHUNK ? n - done : CHUNK;
+        size_t got = iterread(it, buf, want);
+        MPI_Send(buf, (int)got, MPI_CHAR, 0, 0, MPI_COMM_WORLD);
+        if (got == 0)
+            return -1;
+        done += got;
+    }
+    return 0;
+}
+
+/**
+ * El proceso 0 escribe en fp su tramo y después los de los demás procesos
+ * en orden, según le llegan: la salida es la generación completa. Tras un
+ * error sigue recibiendo sin escribir, para que ningún proceso se quede
+ * bloqueado enviando.
+ */
+int streamall(Iter *it, uint64_t n, uint64_t *counts, int size, char *buf, FILE *fp) {
+    int err = 0;
+    for (uint64_t done = 0; done < n; ) {
+        size_t want = n - done < CHUNK ? n - done : CHUNK;
+        size_t got = iterread(it, buf, want);
+        if (got == 0 || fwrite(buf, 1, got, fp) != got) {
+            err = -1;
+            break;
+        }
+        done += got;
+    }
+    for (int r = 1; r < size; r++)
+        for (uint64_t done = 0; done < counts[r]; ) {
+            MPI_Status st;
+            int got;
+            MPI_Recv(buf, CHUNK, MPI_CHAR, r, 0, MPI_COMM_WORLD, &st);
+            MPI_Get_count(&st, MPI_CHAR, &got);
+            if (got == 0) {	// El proceso r no pudo generar todo su tramo
+                err = -1;
+                break;
+            }
+            if (!err && fwrite(buf, 1, got, fp) != (size_t)got)
+                err = -1;
+            done += got;
+        }
+    if (fflush(fp) != 0)
+        err = -1;
+    return err;
+}
+
+/**
+ * Cada proceso escribe su tramo en el archivo compartido a partir de su
+ * desplazamiento, sin pasar por los demás.
+ */
+int writeslice(Iter *it, uint64_t n, uint64_t off, char *buf, MPI_File fh) {
+    for (uint64_t done = 0; done < n; ) {
+        size_t want = n - done < CHUNK ? n - done : CHUNK;
+        size_t got = iterread(it, buf, want);
+        if (got == 0 || MPI_File_write_at(fh, (MPI_Offset)(off + done), buf, (int)got, MPI_CHAR,
+                                          MPI_STATUS_IGNORE) != MPI_SUCCESS)
+            return -1;
+        done += got;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, size;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc != 4) {
+        if (rank == 0)
+            fprintf(stderr, "Uso: mpirun -np N %s archivo profundidad salida|-\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+    int depth = atoi(argv[2]);
+    char *out = argv[3];
+    double inicio = MPI_Wtime();
+
+    // Todos los procesos parsean el sistema y calculan las mismas longitudes
+    Lsystem *ls = parse(argv[1]);
+    if (ls->stoch || ls->ctx || ls->param) { // El reparto necesita longitudes fijas (mklentab())
+        if (rank == 0)
+            fprintf(stderr, "%s: las reglas estocásticas, con contexto o paramétricas no se pueden repartir entre procesos\n", argv[1]);
+        MPI_Finalize();
+        return 1;
+    }
+    Lentab *lt = mklentab(ls, depth);
+    uint64_t total = genlen(lt, depth);
+    if (total == UINT64_MAX) {
+        if (rank == 0)
+            fprintf(stderr, "La generación %d tiene más de 2^64 símbolos\n", depth);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Tramo propio de la salida y desplazamiento por suma de prefijos de los
+    // recuentos de todos los procesos
+    uint64_t start = slicebound(total, rank, size);
+    uint64_t n = slicebound(total, rank + 1, size) - start;
+    uint64_t off = 0;
+    MPI_Exscan(&n, &off, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0)
+        off = 0;	// MPI_Exscan no define el resultado del proceso 0
+
+    // El proceso sitúa el iterador en su primer símbolo y genera solo su tramo
+    Iter *it = mkiter(ls, depth);
+    iterseek(it, lt, off);
+    char *buf = malloc(CHUNK);
+    if (buf == NULL) {
+        fprintf(stderr, "%d: sin memoria\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int err = 0;
+    if (strcmp(out, "-") == 0) {
+        uint64_t *counts = rank == 0 ? emalloc(size * sizeof(uint64_t)) : NULL;
+        MPI_Gather(&n, 1, MPI_UINT64_T, counts, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            err = streamall(it, n, counts, size, buf, stdout);
+        else
+            err = sendslice(it, n, buf);
+        free(counts);
+    } else {
+        MPI_File fh;
+        if (MPI_File_open(MPI_COMM_WORLD, out, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                          MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+            if (rank == 0)
+                fprintf(stderr, "%s: no se puede abrir\n", out);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        MPI_File_set_size(fh, (MPI_Offset)total);	// Recorta una salida anterior más larga
+        err = writeslice(it, n, off, buf, fh);
+        MPI_File_close(&fh);
+    }
+
+    // Todos deben haber generado exactamente su recuento
+    if (it->count != off + n)
+        err = -1;
+    int errs = 0;
+    MPI_Allreduce(&err, &errs, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    double tiempo = MPI_Wtime() - inicio;
+
+    if (rank == 0) {
+        if (errs)
+            fprintf(stderr, "Error al generar o escribir la salida\n");
+        fprintf(stderr, "Generación %d: %llu símbolos en %f segundos con %d procesos (%.0f símbolos/s)\n",
+                depth, (unsigned long long)total, tiempo, size, tiempo > 0 ? total / tiempo : 0);
+    }
+
+    free(buf);
+    freeiter(it);
+    freelentab(lt);
+    freelsystem(ls);
+    MPI_Finalize();
+    return errs ? 1 : 0;
+}
@@ -1,4 +1,3 @@
-#include <SDL2/SDL.h> // Librería para manejo de gráficos y eventos
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,64 +16,106 @@ State *state;	// Pila de estados para manejo de posiciones/ángulos con corchete
 int x, y;		// Coordenadas actuales del cursor de dibujo
 double angle;	// Ángulo de orientación actual
 char *curgen;	// Generación actual del L-system (cadena)
-
-/**
- * Devuelve la producción asociada a un símbolo del sistema.
- * Si no hay regla definida, retorna NULL.
- */
-char* production(char c) {
-	for (Rule *r = ls->rules; r; r = r->next)
-		if (r->pred == c)
-			return r->succ;
-	return NULL;
-}
+size_t curlen;	// Longitud de la generación actual
+Arena *gens;	// Búferes alternos donde se guardan las generaciones
+int packed = 0;	// Generaciones empaquetadas con pocos bits por símbolo (-p)
 
 /**
  * Genera la próxima iteración del sistema de Lindenmayer.
  * Reemplaza cada símbolo de la cadena actual usando las reglas de producción.
  */
 void nextgen(void) {
-    char *newgen = emalloc(1024 * strlen(curgen)); 
-    newgen[0] = '\0';
-
-    for (char *p = curgen; *p; p++) {
-        char *prod = production(*p);
-        if (prod)
-            strcat(newgen, prod);
-        else {
-            size_t len = strlen(newgen);
-            newgen[len] = *p;
-            newgen[len + 1] = '\0';
-        }
-    }
+    // Se escribe en el búfer libre con el tamaño exacto y se alternan
+    if (packed)
+        curlen = pknext(gens, ls, 1);
+    else
+        curlen = arenanext(gens, ls, 1);
+    curgen = arenagen(gens);
+}
 
-    free(curgen);
-    curgen = strdup(newgen);
-    free(newgen);
+/**
+ * Representa la generación depth como un DAG compartido, sin expandirla.
+ * Devuelve la longitud de la generación y en nodes el tamaño del DAG.
+ */
+size_t daggen(int depth, size_t *nodes) {
+    Dag *g = mkdag(ls, depth);
+    size_t n = daglen(g);
+    *nodes = g->nnodes;
+    freedag(g);
+    return n;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Uso: %s archivo iteraciones\n", argv[0]);
+    Cliopts o;  // Modo, -e y checkpoints de -r/-s tras los argumentos fijos
+    if (cliargs(argc, argv, 3, "archivo iteraciones [-l|-p|-d|-e salida|--stats]", &o) != 0)
         return 1;
-    }
     struct timeval inicio, fin;
     double tiempo;
 
     int it = atoi(argv[2]); //Obtenemos el número de iteraciones a realizar por linea de comandos
+    if (o.out)  // -e: escribe la generación it en salida ("-" es stdout) sin guardarla
+        return exportmain(argv[1], it, o.out, 1);
+    int lazy = o.mode && strcmp(o.mode, "-l") == 0; // -l: recorre cada generación sin guardarla
+    packed = o.mode && strcmp(o.mode, "-p") == 0;   // -p: guarda las generaciones empaquetadas
+    int dag = o.mode && strcmp(o.mode, "-d") == 0;  // -d: solo el DAG de cada generación
+    int stats = o.mode && strcmp(o.mode, "--stats") == 0; // --stats: solo predice la generación
+    size_t nodes;
 
     ls = parse(argv[1]);		// Parsea el archivo L-system
-    curgen = strdup(ls->axiom);	// Copia el axioma como cadena inicial
+    Growth g;
+    growth(ls, it, &g);     // Tamaño de la última generación sin expandir nada
+    if (stats) {
+        printgrowth(ls, &g, stdout);
+        return 0;
+    }
+    if (!lazy && !dag && !growthfits(&g, packed)) {
+        fprintf(stderr, "La generación %d necesita %.1f MB y solo hay %.1f MB: no se expande\n",
+                it, (packed ? g.pkbytes : g.bytes) / 1048576.0, memlimit() / 1048576.0);
+        return 1;
+    }
+    if (o.resume) {   // Sigue desde la generación guardada en vez de desde el axioma
+        gens = ckload(o.resume, ls);
+        if (gens == NULL)
+            return 1;
+        printf("Se sigue desde la generación %d (%zu símbolos) de %s\n", gens->depth, gens->len, o.resume);
+    } else
+        gens = packed ? mkpkarena(ls) : mkarena(ls->axiom);	// Copia el axioma como generación inicial
+    curgen = arenagen(gens);
+    curlen = gens->len;
+    if (!lazy && !packed && !dag)
+        printf("Núcleo de expansión: %s\n", ls->simd ? simdname() : "escalar");
 
-    for(int i=1; i<=it; i++){
+    for(int i=gens->depth+1; i<=it; i++){
         gettimeofday(&inicio, NULL);// Registrar tiempo inicial
-        nextgen();
+        if (lazy) {
+            uint64_t n;
+            if (lazygen(ls, NULL, i, 1, &n) != 0)
+                return 1;
+            curlen = n;
+        } else if (dag)
+            curlen = daggen(i, &nodes);
+        else
+            nextgen();
         gettimeofday(&fin, NULL);   // Registrar tiempo final
 
         tiempo = (fin.tv_sec - inicio.tv_sec) + (fin.tv_usec - inicio.tv_usec) / 1000000.0; 
-        printf("La iteración %d tardó %f segundos en ejecutarse.\n", i,tiempo);
+        if (lazy)
+            printf("La iteración %d tardó %f segundos en ejecutarse.\n", i,tiempo);
+        else if (dag)
+            printf("La iteración %d tardó %f segundos en ejecutarse (%zu símbolos, %zu nodos).\n",
+                   i, tiempo, curlen, nodes);
+        else
+            printf("La iteración %d tardó %f segundos en ejecutarse (memoria %.1f MB, pico %.1f MB).\n",
+                   i, tiempo, (gens->cap[0] + gens->cap[1]) / 1048576.0, gens->peak / 1048576.0);
 
     }
+    if (o.save) {
+        if (cksave(gens, ls, o.save) != 0) {
+            fprintf(stderr, "%s: error al guardar la generación %d\n", o.save, gens->depth);
+            return 1;
+        }
+        printf("La generación %d (%zu símbolos) se guardó en %s\n", gens->depth, gens->len, o.save);
+    }
 
         
 }
@@ -1,4 +1,3 @@
-#include <SDL2/SDL.h> // Librería para manejo de gráficos y eventos
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,91 +17,88 @@ State *state;	// Pila de estados para manejo de posiciones/ángulos con corchete
 int x, y;		// Coordenadas actuales del cursor de dibujo
 double angle;	// Ángulo de orientación actual
 char *curgen;	// Generación actual del L-system (cadena)
-
-/**
- * Devuelve la producción asociada a un símbolo del sistema.
- * Si no hay regla definida, retorna NULL.
- */
-char* production(char c) {
-	for (Rule *r = ls->rules; r; r = r->next)
-		if (r->pred == c)
-			return r->succ;
-	return NULL;
-}
+size_t curlen;	// Longitud de la generación actual
+Arena *gens;	// Búferes alternos donde se guardan las generaciones
+int packed = 0;	// Generaciones empaquetadas con pocos bits por símbolo (-p)
 
 /**
  * Genera la próxima iteración del sistema de Lindenmayer.
  * Reemplaza cada símbolo de la cadena actual usando las reglas de producción.
  */
 void nextgen(int threads) {
-    // Calcula la longitud de la generación actual
-    size_t len = strlen(curgen);
-
-    // Reserva un array de buffers, uno por cada hilo, para construir su parte de la nueva generación
-    char **buffers = calloc(threads, sizeof(char*));
-    for (int i = 0; i < threads; i++)
-        buffers[i] = calloc(1024 * len / threads + 1, sizeof(char));
-
-    // Sección paralela: cada hilo procesa una parte de la cadena
-    #pragma omp parallel num_threads(threads)
-    {
-        int tid = omp_get_thread_num(); // ID del hilo
-        size_t chunk = len / threads;   // Tamaño del fragmento a procesar por hilo
-        size_t start = tid * chunk;     // Índice de inicio
-        size_t end = (tid == threads - 1) ? len : start + chunk; // Índice de fin
-
-        // Itera sobre su fragmento y aplica reglas de producción
-        for (size_t i = start; i < end; i++) {
-            char c = curgen[i];
-            char *prod = production(c); // Busca producción para el carácter actual
-            if (prod)
-                strcat(buffers[tid], prod); // Si hay producción, la concatena al buffer
-            else {
-                size_t l = strlen(buffers[tid]); // Si no hay, copia el carácter tal cual
-                buffers[tid][l] = c;
-                buffers[tid][l + 1] = '\0';
-            }
-        }
-    }
-
-    // Une todos los buffers en uno solo (secuencial)
-    char *newgen = emalloc(1024 * len);
-    newgen[0] = '\0';
-    for (int i = 0; i < threads; i++) {
-        strcat(newgen, buffers[i]);
-        free(buffers[i]); // Libera el buffer individual
-    }
-    free(buffers); // Libera el array de buffers
-
-    // Libera la generación anterior y actualiza curgen con la nueva
-    free(curgen);
-    curgen = strdup(newgen);
-    free(newgen);
+    // Se escribe en el búfer libre con el tamaño exacto y se alternan
+    if (packed)
+        curlen = pknext(gens, ls, threads);
+    else
+        curlen = arenanext(gens, ls, threads);
+    curgen = arenagen(gens);
 }
 
-
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s archivo iteraciones num_hilos\n", argv[0]);
+    Cliopts o;  // Modo, -e y checkpoints de -r/-s tras los argumentos fijos
+    if (cliargs(argc, argv, 4, "archivo iteraciones num_hilos [-l|-p|-e salida|--stats]", &o) != 0)
         return 1;
-    }
     struct timeval inicio, fin;
     double tiempo;
 
     int it = atoi(argv[2]); //Obtenemos el número de iteraciones a realizar por linea de comandos
     int threads = atoi(argv[3]); //Obtenemos el número hilos por linea de comandos
+    if (o.out)  // -e: escribe la generación it en salida ("-" es stdout) sin guardarla
+        return exportmain(argv[1], it, o.out, threads);
+    int lazy = o.mode && strcmp(o.mode, "-l") == 0; // -l: recorre cada generación sin guardarla
+    packed = o.mode && strcmp(o.mode, "-p") == 0;   // -p: guarda las generaciones empaquetadas
+    int stats = o.mode && strcmp(o.mode, "--stats") == 0; // --stats: solo predice la generación
     ls = parse(argv[1]);		// Parsea el archivo L-system
-    curgen = strdup(ls->axiom);	// Copia el axioma como cadena inicial
-
-    for(int i=1; i<=it; i++){
+    Growth g;
+    growth(ls, it, &g);     // Tamaño de la última generación sin expandir nada
+    if (stats) {
+        printgrowth(ls, &g, stdout);
+        return 0;
+    }
+    if (!lazy && !growthfits(&g, packed)) {
+        fprintf(stderr, "La generación %d necesita %.1f MB y solo hay %.1f MB: no se expande\n",
+                it, (packed ? g.pkbytes : g.bytes) / 1048576.0, memlimit() / 1048576.0);
+        return 1;
+    }
+    if (o.resume) {   // Sigue desde la generación guardada en vez de desde el axioma
+        gens = ckload(o.resume, ls);
+        if (gens == NULL)
+            return 1;
+        printf("Se sigue desde la generación %d (%zu símbolos) de %s\n", gens->depth, gens->len, o.resume);
+    } else
+        gens = packed ? mkpkarena(ls) : mkarena(ls->axiom);	// Copia el axioma como generación inicial
+    curgen = arenagen(gens);
+    curlen = gens->len;
+    if (!lazy && !packed)
+        printf("Núcleo de expansión: %s\n", ls->simd ? simdname() : "escalar");
+    Lentab *lt = lazy && !ls->stoch && !ls->ctx && !ls->param ? mklentab(ls, it) : NULL; // Longitudes para repartir la salida
+
+    for(int i=gens->depth+1; i<=it; i++){
         gettimeofday(&inicio, NULL);// Registrar tiempo inicial
-        nextgen(threads);
+        if (lazy) {
+            uint64_t n;
+            if (lazygen(ls, lt, i, threads, &n) != 0)
+                return 1;
+            curlen = n;
+        } else
+            nextgen(threads);
         gettimeofday(&fin, NULL);   // Registrar tiempo final
 
         tiempo = (fin.tv_sec - inicio.tv_sec) + (fin.tv_usec - inicio.tv_usec) / 1000000.0; 
-        printf("La iteración %d tardó %f segundos en ejecutarse.\n", i,tiempo);
+        if (lazy)
+            printf("La iteración %d tardó %f segundos en ejecutarse.\n", i,tiempo);
+        else
+            printf("La iteración %d tardó %f segundos en ejecutarse (memoria %.1f MB, pico %.1f MB).\n",
+                   i, tiempo, (gens->cap[0] + gens->cap[1]) / 1048576.0, gens->peak / 1048576.0);
 
     }
+    if (o.save) {
+        if (cksave(gens, ls, o.save) != 0) {
+            fprintf(stderr, "%s: error al guardar la generación %d\n", o.save, gens->depth);
+            return 1;
+        }
+        printf("La generación %d (%zu símbolos) se guardó en %s\n", gens->depth, gens->len, o.save);
+    }
 
         
 }
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <omp.h>
+
+
+#include "a.h"
+
+#define LINESIZE 4096	// Longitud máxima de una línea de la lista de trabajos
+
+/**
+ * Trabajo de dibujo: un sistema, una generación, un tamaño y un destino.
+ */
+typedef struct
+{
+	char*	file;     // Archivo con la definición del L-system (o nombre en el catálogo)
+	int	depth;        // Generación a dibujar
+	int	w, h;         // Tamaño de la imagen
+	char*	out;      // Archivo de salida (.png, .ppm o '-' para stdout)
+	Lsystem*	ls;   // Sistema ya comprobado por admit(), o NULL si se descarta
+	int	own;          // 1 si ls es solo de este trabajo (no del catálogo)
+} Job;
+
+static Catalog *catalog;	// Sistemas ya cargados con -c, o NULL
+
+/**
+ * Lee la lista de trabajos. Cada línea tiene la forma
+ *     archivo profundidad ancho alto salida
+ * Las líneas vacías y las que empiezan por '#' se ignoran. Con un catálogo
+ * (-c), archivo puede ser el nombre de uno de sus sistemas, con '_' en
+ * lugar de los espacios.
+ */
+Job* readjobs(char *filename, int *njobs) {
+    FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (fp == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+
+    char line[LINESIZE], file[LINESIZE], out[LINESIZE];
+    int n = 0, cap = 64, lineno = 0;
+    Job *jobs = emalloc(cap * sizeof(Job));
+
+    while (fgets(line, sizeof line, fp)) {
+        lineno++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        if (n == cap) {
+            cap *= 2;
+            jobs = realloc(jobs, cap * sizeof(Job));
+            if (jobs == NULL) {
+                fprintf(stderr, "readjobs: sin memoria\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        Job *j = &jobs[n];
+        if (sscanf(p, "%s %d %d %d %s", file, &j->depth, &j->w, &j->h, out) != 5 ||
+            j->depth < 0 || j->w <= 0 || j->h <= 0) {
+            fprintf(stderr, "%s:%d: se esperaba 'archivo profundidad ancho alto salida'\n",
+                    filename, lineno);
+            exit(1);
+        }
+        j->file = strdup(file);
+        j->out = strdup(out);
+        n++;
+    }
+    if (fp != stdin)
+        fclose(fp);
+    *njobs = n;
+    return jobs;
+}
+
+/**
+ * Escribe la imagen en el destino del trabajo. Con '-' la imagen se envía
+ * a stdout como PPM; varias imágenes seguidas forman un flujo PPM válido.
+ * Devuelve 0 si todo fue bien.
+ */
+int save(Job *j, Image *im) {
+    int err;
+
+    if (strcmp(j->out, "-") == 0) {
+        #pragma omp critical(stdout)
+        {
+            err = writeppm(im, stdout);
+            fflush(stdout);
+        }
+        return err;
+    }
+
+    FILE *fp = fopen(j->out, "wb");
+    if (fp == NULL) {
+        perror(j->out);
+        return -1;
+    }
+    size_t n = strlen(j->out);
+    if (n >= 4 && strcmp(j->out + n - 4, ".png") == 0)
+        err = writepng(im, fp);
+    else
+        err = writeppm(im, fp);
+    if (fclose(fp) != 0)
+        err = -1;
+    return err;
+}
+
+/**
+ * Comprueba un trabajo antes de empezar: que el archivo sea regular y se
+ * pueda leer, que la definición no tenga errores y que growth() prevea
+ * que sus generaciones caben en memoria. Deja el sistema en j->ls, o NULL
+ * tras explicar en stderr por qué se descarta el trabajo.
+ */
+void admit(Job *j) {
+    char why[256] = "";
+    struct stat st;
+
+    j->ls = catalog ? findsystem(catalog, j->file) : NULL;
+    j->own = j->ls == NULL;	// Los del catálogo se comparten entre trabajos
+    if (j->own) {
+        size_t len;
+        int mapped;
+        char *text = NULL;
+        if (stat(j->file, &st) != 0)
+            snprintf(why, sizeof why, "no existe");
+        else if (!S_ISREG(st.st_mode))
+            snprintf(why, sizeof why, "no es un archivo regular");
+        else if (access(j->file, R_OK) != 0 || (text = loadfile(j->file, &len, &mapped)) == NULL)
+            snprintf(why, sizeof why, "no se puede leer");
+        else {
+            j->ls = tryparse(j->file, text, len, NULL);
+            unloadfile(text, len, mapped);
+            if (j->ls == NULL)
+                snprintf(why, sizeof why, "la definición tiene errores");
+        }
+    }
+    if (j->ls) {
+        Growth g;
+        int packed = !j->ls->ctx && !j->ls->param;
+        growth(j->ls, j->depth, &g);
+        if (!growthfits(&g, packed))
+            snprintf(why, sizeof why, "la generación %d necesita %.1f MB y solo hay %.1f MB",
+                     j->depth, (packed ? g.pkbytes : g.bytes) / 1048576.0, memlimit() / 1048576.0);
+    }
+    if (*why == '\0')
+        return;
+    if (j->ls && j->own)
+        freelsystem(j->ls);
+    j->ls = NULL;
+    #pragma omp critical(stderr)
+    fprintf(stderr, "%s %d -> %s: se omite, %s\n", j->file, j->depth, j->out, why);
+}
+
+/**
+ * Dibuja un trabajo admitido: expande, interpreta con la tortuga y
+ * rasteriza. Cada trabajo es secuencial; el paralelismo está entre
+ * trabajos. Devuelve el número de segmentos dibujados.
+ */
+size_t render(Job *j, Image **im) {
+    Lsystem *ls = j->ls;
+    size_t nseg;
+    Seg *segs;
+
+    if (!ls->ctx && !ls->param) {
+        Arena *gens = mkpkarena(ls);	// Empaquetadas: más trabajos caben en memoria
+        for (int i = 0; i < j->depth; i++)
+            pknext(gens, ls, 1);
+        segs = turtlepk(ls, (uint64_t*)arenagen(gens), gens->len, 0, 0, &nseg, 1);
+        freearena(gens);
+    } else {	// pknext() no admite contexto ni parámetros
+        Arena *gens = mkarena(ls->axiom);
+        for (int i = 0; i < j->depth; i++)
+            arenanext(gens, ls, 1);
+        segs = turtle(ls, arenagen(gens), gens->len, 0, 0, &nseg, 1);
+        freearena(gens);
+    }
+
+    *im = mkimage(j->w, j->h);
+    rasterize(*im, segs, nseg);
+    free(segs);
+    if (j->own)
+        freelsystem(ls);
+    j->ls = NULL;
+    return nseg;
+}
+
+int main(int argc, char *argv[]) {
+    char *prog = argv[0];
+    char *catpath = NULL;
+    if (argc >= 3 && strcmp(argv[1], "-c") == 0) {	// -c: directorio o archivo con varios sistemas
+        catpath = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Uso: %s [-c catálogo] lista_de_trabajos [num_hilos]\n", prog);
+        return 1;
+    }
+    int threads = argc == 3 ? atoi(argv[2]) : omp_get_num_procs();
+    if (catpath) {
+        double t0 = omp_get_wtime();
+        catalog = loadcatalog(catpath, threads);
+        fprintf(stderr, "%s: %zu sistemas cargados en %f segundos\n", catpath, catalog->n,
+                omp_get_wtime() - t0);
+    }
+    int njobs, failed = 0;
+    Job *jobs = readjobs(argv[1], &njobs);
+
+    // Un trabajo imposible se descarta aquí en vez de detener todo el lote
+    #pragma omp parallel for num_threads(threads) schedule(dynamic, 1) reduction(+:failed)
+    for (int i = 0; i < njobs; i++) {
+        admit(&jobs[i]);
+        if (jobs[i].ls == NULL)
+            failed++;
+    }
+
+    // Los trabajos son independientes: cada hilo toma el siguiente libre
+    #pragma omp parallel for num_threads(threads) schedule(dynamic, 1) reduction(+:failed)
+    for (int i = 0; i < njobs; i++) {
+        struct timeval inicio, fin;
+        Image *im;
+
+        if (jobs[i].ls == NULL)
+            continue;
+        gettimeofday(&inicio, NULL);
+        size_t nseg = render(&jobs[i], &im);
+        int err = save(&jobs[i], im);
+        freeimage(im);
+        gettimeofday(&fin, NULL);
+
+        double tiempo = (fin.tv_sec - inicio.tv_sec) + (fin.tv_usec - inicio.tv_usec) / 1000000.0;
+        if (err)
+            failed++;
+        // El progreso se informa según terminan los trabajos
+        #pragma omp critical(stderr)
+        fprintf(stderr, "%s %d -> %s: %zu segmentos en %f segundos%s\n",
+                jobs[i].file, jobs[i].depth, jobs[i].out, nseg, tiempo,
+                err ? " (error al escribir)" : "");
+    }
+
+    for (int i = 0; i < njobs; i++) {
+        free(jobs[i].file);
+        free(jobs[i].out);
+    }
+    free(jobs);
+    if (catalog)
+        freecatalog(catalog);
+    return failed ? 1 : 0;
+}
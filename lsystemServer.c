@@ -0,0 +1,483 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <omp.h>
+
+
+#include "a.h"
+
+#define LINESIZE 4096	// Longitud máxima de una petición
+#define IDLE 10			// Segundos que se espera a un cliente antes de cerrar su conexión
+
+/**
+ * Definición de un L-system ya parseada, identificada por el hash de su
+ * texto: si el archivo cambia, es otro sistema.
+ */
+typedef struct Sys Sys;
+struct Sys
+{
+	uint64_t	hash;     // FNV-1a del texto de la definición
+	Lsystem*	ls;
+	int	refs;             // Entradas de la caché que lo usan
+	Sys*	next;
+};
+
+/**
+ * Generación guardada en la caché, con la geometría que se haya pedido.
+ *
+ * Las entradas forman una lista en orden de uso: la cabeza es la más
+ * reciente y se desaloja por la cola.
+ */
+typedef struct Entry Entry;
+struct Entry
+{
+	Sys*	sys;
+	int	depth;            // Número de la generación
+	char*	gen;          // Generación (bigalloc(), terminada en '\0')
+	size_t	len;
+	double*	par;          // Parámetros (sistemas paramétricos), o NULL
+	size_t	stride;       // Distancia entre los arrays de par
+	Seg*	segs;         // Segmentos de la tortuga, o NULL si no se han pedido
+	size_t	nseg;
+	size_t	bytes;        // Memoria que ocupa la entrada
+	Entry	*prev, *next;
+};
+
+static Sys *systems;
+static Entry *head, *tail;
+static size_t used, limit = (size_t)512 << 20;	// Memoria de la caché y su máximo (-m)
+static int threads;
+static unsigned long hits, partial, misses;
+static volatile sig_atomic_t stop;
+
+double now(void) {
+    return omp_get_wtime();
+}
+
+/**
+ * fnv - Hash FNV-1a de 64 bits de un texto.
+ */
+uint64_t fnv(const char *s, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * load - Sistema de un archivo, parseado solo la primera vez que se ve su
+ * texto. Devuelve NULL si no es un archivo regular, no se puede leer o no
+ * es un L-system válido.
+ *
+ * El archivo se abre sin bloquear y se comprueba antes de leerlo: una FIFO
+ * o un dispositivo dejarían el servidor esperando. Se lee del mismo
+ * descriptor, así que no se puede cambiar por otro entre la comprobación y
+ * la lectura. Un texto nuevo se
+ * parsea con tryparse(), así que un archivo mal escrito no tira el
+ * servidor.
+ */
+Sys* load(const char *file) {
+    struct stat st;
+    int fd = open(file, O_RDONLY | O_NONBLOCK);
+    if (fd < 0)
+        return NULL;
+    size_t len;
+    int mapped;
+    char *text = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))	// Se lee el mismo archivo que se ha comprobado
+        text = loadfd(fd, file, &len, &mapped);
+    close(fd);
+    if (text == NULL)
+        return NULL;
+    uint64_t h = fnv(text, len);
+
+    Sys *s;
+    for (s = systems; s; s = s->next)
+        if (s->hash == h)
+            break;
+    if (s == NULL) {
+        Lsystem *ls = tryparse(file, text, len, NULL);
+        if (ls) {
+            s = emalloc(sizeof(Sys));
+            s->hash = h;
+            s->ls = ls;
+            s->next = systems;
+            systems = s;
+        }
+    }
+    unloadfile(text, len, mapped);
+    return s;
+}
+
+/**
+ * release - Suelta una referencia a un sistema y lo libera con la última.
+ */
+void release(Sys *s) {
+    if (--s->refs > 0)
+        return;
+    for (Sys **p = &systems; *p; p = &(*p)->next)
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    freelsystem(s->ls);
+    free(s);
+}
+
+/**
+ * unlinkentry / touch - Quitan una entrada de la lista o la ponen la primera.
+ */
+void unlinkentry(Entry *e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+void touch(Entry *e) {
+    if (head == e)
+        return;
+    if (e->prev || e->next || tail == e)
+        unlinkentry(e);
+    e->next = head;
+    if (head)
+        head->prev = e;
+    head = e;
+    if (tail == NULL)
+        tail = e;
+}
+
+/**
+ * freeentry - Saca una entrada de la caché y la libera. El sistema se
+ * libera con su última entrada.
+ */
+void freeentry(Entry *e) {
+    unlinkentry(e);
+    used -= e->bytes;
+    bigfree(e->gen);
+    bigfree(e->par);
+    free(e->segs);
+    release(e->sys);
+    free(e);
+}
+
+/**
+ * evict - Desaloja las entradas menos usadas hasta que la caché cabe en
+ * limit, sin tocar keep (la que se está sirviendo).
+ */
+void evict(Entry *keep) {
+    for (Entry *e = tail, *p; e && used > limit; e = p) {
+        p = e->prev;
+        if (e != keep)
+            freeentry(e);
+    }
+}
+
+/**
+ * generation - Entrada de la generación depth de un sistema.
+ *
+ * Si no está en la caché se expande desde la generación más profunda que
+ * haya del mismo sistema por debajo de depth (o desde el axioma), así que
+ * las peticiones crecientes solo pagan las generaciones nuevas. Ni la
+ * generación de partida ni la que queda en la Arena se copian.
+ *
+ * Devuelve NULL si la expansión pasa de limit (sin reglas deterministas
+ * growth() solo da una cota, así que el límite se vigila generación a
+ * generación) o si no hay memoria para la entrada.
+ */
+Entry* generation(Sys *s, int depth) {
+    Entry *best = NULL;
+    for (Entry *e = head; e; e = e->next)
+        if (e->sys == s && e->depth <= depth && (best == NULL || e->depth > best->depth))
+            best = e;
+    if (best && best->depth == depth) {
+        hits++;
+        touch(best);
+        return best;
+    }
+
+    Lsystem *ls = s->ls;
+    Arena *a;
+    if (best) {
+        // La primera pasada lee la generación de la entrada sin copiarla: su
+        // búfer se presta a la Arena y se retira antes de que arenanext()
+        // pueda reutilizarlo como destino
+        partial++;
+        a = emalloc(sizeof(Arena));
+        a->buf[0] = best->gen;
+        a->cap[0] = best->stride;
+        a->par[0] = best->par;
+        a->len = best->len;
+        a->depth = best->depth;
+        touch(best);
+    } else {
+        misses++;
+        a = mkarena(ls->axiom);
+    }
+    while (a->depth < depth) {
+        int from = a->cur;
+        arenanext(a, ls, threads);
+        if (best && a->buf[from] == best->gen) {
+            a->buf[from] = NULL;
+            a->par[from] = NULL;
+            a->cap[from] = 0;
+        }
+        if (a->peak > limit) {
+            freearena(a);
+            return NULL;
+        }
+    }
+
+    double *par = a->par[a->cur];
+    size_t stride = a->cap[a->cur];
+    if (ls->param && par == NULL) {	// Generación 0: los del axioma
+        par = bigalloc(ls->npar * stride * sizeof(double));
+        if (par == NULL) {
+            freearena(a);
+            return NULL;
+        }
+        memcpy(par, ls->axpar, ls->npar * stride * sizeof(double));
+    }
+    Entry *e = emalloc(sizeof(Entry));
+    e->sys = s;
+    e->depth = depth;
+    e->len = a->len;
+    e->gen = a->buf[a->cur];
+    e->par = par;
+    e->stride = stride;
+    e->bytes = sizeof(Entry) + e->stride + (ls->param ? ls->npar * e->stride * sizeof(double) : 0);
+    a->buf[a->cur] = NULL;
+    a->par[a->cur] = NULL;
+    freearena(a);
+
+    s->refs++;
+    used += e->bytes;
+    touch(e);
+    evict(e);
+    return e;
+}
+
+/**
+ * geometry - Segmentos de la tortuga de una entrada, calculados una vez.
+ */
+void geometry(Entry *e) {
+    if (e->segs)
+        return;
+    e->segs = turtle(e->sys->ls, e->gen, e->len, 0, 0, &e->nseg, threads);
+    e->bytes += e->nseg * sizeof(Seg);
+    used += e->nseg * sizeof(Seg);
+    evict(e);
+}
+
+/**
+ * reply - Envía "OK bytes\n" seguido de la respuesta.
+ */
+int reply(int fd, const char *buf, size_t n) {
+    char hdr[64];
+    int h = snprintf(hdr, sizeof hdr, "OK %zu\n", n);
+    return writeall(fd, hdr, h) != 0 || writeall(fd, buf, n) != 0 ? -1 : 0;
+}
+
+int fail(int fd, const char *msg) {
+    char buf[LINESIZE];
+    int n = snprintf(buf, sizeof buf, "ERR %s\n", msg);
+    return writeall(fd, buf, n);
+}
+
+/**
+ * serve - Atiende una petición; devuelve -1 si no se pudo responder.
+ *
+ * Peticiones (una por línea):
+ *     archivo profundidad len          longitud de la generación
+ *     archivo profundidad gen          la generación como texto
+ *     archivo profundidad segs         segmentos de la tortuga (Seg binarios)
+ *     archivo profundidad ppm|png w h  imagen de w × h píxeles
+ *     stats                            estado de la caché
+ */
+int serve(int fd, char *line) {
+    char file[LINESIZE], kind[16], buf[LINESIZE];
+    int depth, w = 0, h = 0;
+
+    if (strncmp(line, "stats", 5) == 0) {
+        size_t ne = 0;
+        for (Entry *e = head; e; e = e->next)
+            ne++;
+        int n = snprintf(buf, sizeof buf,
+                         "entries %zu used %zu limit %zu hits %lu partial %lu misses %lu\n",
+                         ne, used, limit, hits, partial, misses);
+        return reply(fd, buf, n);
+    }
+    int nf = sscanf(line, "%s %d %15s %d %d", file, &depth, kind, &w, &h);
+    int image = nf >= 3 && (strcmp(kind, "ppm") == 0 || strcmp(kind, "png") == 0);
+    if (nf < 3 || depth < 0 || (image && (nf != 5 || w <= 0 || h <= 0)))
+        return fail(fd, "se esperaba 'archivo profundidad len|gen|segs|ppm|png [ancho alto]'");
+    if (!image && strcmp(kind, "len") != 0 && strcmp(kind, "gen") != 0 && strcmp(kind, "segs") != 0)
+        return fail(fd, "tipo de salida desconocido");
+
+    Sys *s = load(file);
+    if (s == NULL)
+        return fail(fd, "no se puede leer o no es un L-system válido");
+    s->refs++;	// Que no se libere si se desalojan sus entradas mientras tanto
+
+    // Un D0L se mide sin expandirlo: la longitud sale de la matriz de
+    // crecimiento y lo que no cabría en la caché se rechaza antes de empezar
+    Growth g;
+    growth(s->ls, depth, &g);
+    if (g.exact && strcmp(kind, "len") == 0 && !g.sat) {
+        int n = snprintf(buf, sizeof buf, "%llu", (unsigned long long)g.len);
+        release(s);
+        return reply(fd, buf, n);
+    }
+    if (g.exact && (g.bytes > limit || !growthfits(&g, 0))) {
+        snprintf(buf, sizeof buf, "la generación necesita %.1f MB y la caché admite %.1f MB",
+                 g.bytes / 1048576.0, limit / 1048576.0);
+        release(s);
+        return fail(fd, buf);
+    }
+    Entry *e = generation(s, depth);
+    if (e == NULL) {
+        snprintf(buf, sizeof buf, "la generación no cabe en memoria o pasa de los %.1f MB que admite la caché",
+                 limit / 1048576.0);
+        release(s);
+        return fail(fd, buf);
+    }
+    Lsystem *ls = s->ls;
+    int err = 0;
+
+    if (strcmp(kind, "len") == 0) {
+        int n = snprintf(buf, sizeof buf, "%zu", e->len);
+        err = reply(fd, buf, n);
+    } else if (strcmp(kind, "gen") == 0 && !ls->param) {
+        err = reply(fd, e->gen, e->len);
+    } else if (strcmp(kind, "gen") == 0) {
+        // Módulos con sus parámetros, como los escribe exportgen()
+        size_t n = 0, cap = e->len * 4 + MAXMODULE;
+        char *out = malloc(cap);
+        for (size_t i = 0; out && i < e->len; i++) {
+            if (cap - n < MAXMODULE) {
+                char *p = realloc(out, cap *= 2);
+                if (p == NULL)
+                    free(out);
+                out = p;
+                if (out == NULL)
+                    break;
+            }
+            n += fmtmodule(ls, e->gen[i], e->par, e->stride, i, out + n);
+        }
+        err = out ? reply(fd, out, n) : fail(fd, "sin memoria");
+        free(out);
+    } else {
+        geometry(e);
+        if (strcmp(kind, "segs") == 0)
+            err = reply(fd, (const char*)e->segs, e->nseg * sizeof(Seg));
+        else {
+            Image *im = mkimage(w, h);
+            rasterize(im, e->segs, e->nseg);
+            char *out;
+            size_t n;
+            FILE *fp = open_memstream(&out, &n);
+            int bad = strcmp(kind, "png") == 0 ? writepng(im, fp) : writeppm(im, fp);
+            if (fclose(fp) != 0)
+                bad = -1;
+            err = bad ? fail(fd, "no se pudo codificar la imagen") : reply(fd, out, n);
+            free(out);
+            freeimage(im);
+        }
+    }
+
+    release(s);	// Se libera aquí si se desalojaron todas sus entradas
+    return err;
+}
+
+void onsignal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    threads = omp_get_num_procs();
+    while ((opt = getopt(argc, argv, "m:t:")) != -1) {
+        switch (opt) {
+        case 'm':
+            limit = (size_t)atol(optarg) << 20;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Uso: %s [-m MB_de_caché] [-t num_hilos] socket\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: ruta demasiado larga\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof addr) != 0 || listen(sock, 16) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    // Un cliente que cierra antes de leer la respuesta no debe tirar el servidor
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa = { .sa_handler = onsignal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    fprintf(stderr, "%s: escuchando (caché de %zu MB, %d hilos)\n", path, limit >> 20, threads);
+
+    // Las peticiones se atienden de una en una; cada una expande con todos los hilos
+    while (!stop) {
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+        // Un cliente que no pide ni lee nada no puede bloquear a los demás
+        struct timeval idle = { .tv_sec = IDLE };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof idle);
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof idle);
+        FILE *in = fdopen(fd, "r");
+        char line[LINESIZE];
+        while (!stop && fgets(line, sizeof line, in)) {
+            double t0 = now();
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            int err = serve(fd, line);
+            fprintf(stderr, "%s: %f segundos%s\n", line, now() - t0, err ? " (cliente perdido)" : "");
+            if (err)
+                break;
+        }
+        fclose(in);
+    }
+
+    while (head)
+        freeentry(head);
+    close(sock);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "a.h"
+
+#define HUGEPAGE (2 << 20)	// Tamaño de página enorme en x86-64
+#define PAGE 4096
+
+static int numa = -1;		// LSYSTEM_NUMA: fijar hilos y primer contacto
+static int thp;				// LSYSTEM_THP: páginas enormes para búferes grandes
+static int *order;			// CPU de cada hilo en orden de topología
+static int ncpus;
+static __thread int pinned = -1;	// Número de hilo al que está fijado este, o -1
+#ifdef __linux__
+static cpu_set_t affinity;	// Afinidad del proceso antes de fijar nada
+#endif
+
+/**
+ * cpuinfo - Lee un entero de /sys/devices/system/cpu/cpuN/...; -1 si falla.
+ */
+static int cpuinfo(int cpu, const char *what) {
+	char path[128];
+	int v = -1;
+	snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/%s", cpu, what);
+	FILE *fp = fopen(path, "r");
+	if (fp) {
+		if (fscanf(fp, "%d", &v) != 1)
+			v = -1;
+		fclose(fp);
+	}
+	return v;
+}
+
+/**
+ * cpunode - Nodo NUMA de una CPU (0 si no se puede saber).
+ */
+static int cpunode(int cpu) {
+	char path[128];
+	for (int n = 0; n < 64; n++) {
+		snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/node%d", cpu, n);
+		FILE *fp = fopen(path, "r");
+		if (fp) {
+			fclose(fp);
+			return n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Clave de orden de una CPU: primero el nodo, después los núcleos físicos
+ * (el primer hilo de cada núcleo antes que sus hermanos) y por último el
+ * número de CPU, para que el orden sea estable entre ejecuciones.
+ */
+typedef struct
+{
+	int	node, smt, core, cpu;
+} Cpu;
+
+static int cmpcpu(const void *a, const void *b) {
+	const Cpu *x = a, *y = b;
+	if (x->node != y->node)
+		return x->node - y->node;
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+/**
+ * numainit - Lee la configuración y calcula el orden de las CPU una vez.
+ *
+ * Se puede llamar desde cualquier hilo: numa se publica con release
+ * después de escribir thp, affinity, order y ncpus, así que quien lo lee
+ * con acquire distinto de -1 puede leer el resto sin sincronizar.
+ */
+static void numainit(void) {
+	if (__atomic_load_n(&numa, __ATOMIC_ACQUIRE) >= 0)
+		return;
+#ifdef _OPENMP
+	#pragma omp critical(numainit)
+#endif
+	if (numa < 0) {
+		const char *e = getenv("LSYSTEM_THP");
+		thp = e && strcmp(e, "0") != 0;
+		e = getenv("LSYSTEM_NUMA");
+		int on = e && strcmp(e, "0") != 0;
+#ifdef __linux__
+		cpu_set_t set;
+		if (on && sched_getaffinity(0, sizeof set, &set) == 0) {
+			Cpu *cpus = emalloc(CPU_SETSIZE * sizeof(Cpu));
+			for (int c = 0; c < CPU_SETSIZE; c++) {
+				if (!CPU_ISSET(c, &set))
+					continue;
+				Cpu *k = &cpus[ncpus++];
+				k->cpu = c;
+				k->node = cpunode(c);
+				k->core = cpuinfo(c, "topology/core_id");
+				k->core += 4096 * cpuinfo(c, "topology/physical_package_id");
+				// Un hilo hermano no es el primero de su lista de hermanos
+				k->smt = cpuinfo(c, "topology/thread_siblings_list") != c;
+			}
+			qsort(cpus, ncpus, sizeof(Cpu), cmpcpu);
+			affinity = set;
+			order = emalloc(ncpus * sizeof(int));
+			for (int i = 0; i < ncpus; i++)
+				order[i] = cpus[i].cpu;
+			free(cpus);
+		}
+#endif
+		__atomic_store_n(&numa, on && ncpus > 0, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * numapin - Fija el hilo de OpenMP número t a su CPU en el orden de topología.
+ *
+ * Se llama al principio de cada región paralela de la expansión; solo hace
+ * la llamada al sistema la primera vez que un hilo recibe ese número. Los
+ * hilos del equipo de OpenMP se quedan fijados entre regiones; el que abre
+ * la región debe llamar a numaunpin() al terminarla.
+ */
+void numapin(int t) {
+	numainit();
+	if (!numa || pinned == t)
+		return;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(order[t % ncpus], &set);
+	sched_setaffinity(0, sizeof set, &set);
+#endif
+	pinned = t;
+}
+
+/**
+ * numaunpin - Devuelve el hilo que llama a la afinidad que tenía el proceso.
+ *
+ * El hilo que abre una región paralela es su hilo 0 y numapin() lo fija a
+ * una sola CPU; sin esto el resto del programa (la parte secuencial, o las
+ * regiones de otro tamaño) seguiría atado a ella.
+ */
+void numaunpin(void) {
+	if (pinned < 0)
+		return;
+#ifdef __linux__
+	sched_setaffinity(0, sizeof affinity, &affinity);
+#endif
+	pinned = -1;
+}
+
+/**
+ * numaon - 1 si está activo el modo NUMA (LSYSTEM_NUMA).
+ */
+int numaon(void) {
+	numainit();
+	return numa;
+}
+
+/**
+ * bigalloc - Reserva un búfer de generación de n bytes sin inicializar.
+ *
+ * Con LSYSTEM_THP los búferes de varias páginas enormes se alinean a 2 MB y
+ * se marcan con MADV_HUGEPAGE, lo que reduce los fallos de TLB de las
+ * pasadas en streaming. Con LSYSTEM_OOC los grandes se proyectan desde un
+ * archivo (oocalloc()), así que una generación puede ser mayor que la
+ * memoria física. Se liberan con bigfree(). Devuelve NULL si no hay memoria.
+ */
+void* bigalloc(size_t n) {
+	void *p = oocalloc(n);
+	if (p)
+		return p;
+	numainit();
+#ifdef __linux__
+	if (thp && n >= 4 * (size_t)HUGEPAGE) {
+		size_t size = (n + HUGEPAGE - 1) / HUGEPAGE * HUGEPAGE;
+		if (posix_memalign(&p, HUGEPAGE, size) != 0)
+			return NULL;
+		madvise(p, size, MADV_HUGEPAGE);
+		return p;
+	}
+#endif
+	return malloc(n);
+}
+
+/**
+ * bigfree - Libera un búfer de bigalloc(), en memoria o proyectado.
+ */
+void bigfree(void *p) {
+	if (!oocfree(p))
+		free(p);
+}
+
+/**
+ * firsttouch - Toca las páginas de un búfer nuevo desde los hilos que lo usarán.
+ *
+ * @buf: Búfer recién reservado (sin páginas asignadas todavía).
+ * @nt: Número de hilos.
+ * @nb: Número de bloques.
+ * @off: Suma de prefijos de los bytes de cada bloque (nb + 1 entradas).
+ *
+ * Linux coloca cada página en el nodo del hilo que la escribe primero. Cada
+ * hilo, ya fijado a su CPU, escribe un byte por página del rango que le da
+ * el reparto inicial de schedule(), así que los bloques que no se roban se
+ * escriben en memoria local.
+ */
+void firsttouch(char *buf, int nt, size_t nb, const size_t *off) {
+	if (!numaon() || nt <= 1)
+		return;
+#ifdef _OPENMP
+	#pragma omp parallel num_threads(nt)
+	{
+		int t = omp_get_thread_num();
+		size_t first, last;
+		numapin(t);
+		initrange(nt, nb, off, t, &first, &last);
+		// Cada página la toca el hilo cuyo rango contiene su primer byte:
+		// se recorren los comienzos de página, no off[first] + k * PAGE
+		size_t i = off[first];
+		if (first == 0 && off[last] > 0)
+			buf[0] = 0;	// Su página empieza antes del búfer
+		for (i += -(uintptr_t)(buf + i) & (PAGE - 1); i < off[last]; i += PAGE)
+			buf[i] = 0;
+	}
+	numaunpin();
+#endif
+}
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+
+#include "a.h"
+
+#define OOCMIN (1 << 20)	// Búferes menores se quedan en memoria
+#define PAGE 4096
+
+/**
+ * Búfer de generación proyectado desde un archivo temporal.
+ *
+ * El archivo se borra nada más crearlo: el espacio en disco se libera al
+ * cerrar fd, también si el programa termina sin llamar a oocfree().
+ */
+typedef struct Map Map;
+struct Map
+{
+	char*	p;            // Dirección de la proyección
+	size_t	len;          // Bytes proyectados (múltiplo de PAGE)
+	int	fd;               // Archivo que respalda la proyección (-1: oocmap())
+	Map*	next;
+};
+
+static char *dir;			// LSYSTEM_OOC: directorio de los archivos
+static int ooc = -1;		// -1 sin leer todavía
+static Map *maps;			// Proyecciones vivas (pocas: dos por Arena)
+
+/**
+ * oocon - 1 si las generaciones grandes van a disco (LSYSTEM_OOC=directorio).
+ */
+int oocon(void) {
+#ifdef _OPENMP
+	#pragma omp critical(ooc)
+#endif
+	if (ooc < 0) {
+		const char *e = getenv("LSYSTEM_OOC");
+		dir = e && *e && strcmp(e, "0") != 0 ? strdup(e) : NULL;
+		ooc = dir != NULL;
+	}
+	return ooc;
+}
+
+/**
+ * oocspace - Bytes libres en el directorio de LSYSTEM_OOC (0 si no está activo).
+ */
+uint64_t oocspace(void) {
+	struct statvfs st;
+	if (!oocon() || statvfs(dir, &st) != 0)
+		return 0;
+	return (uint64_t)st.f_bavail * st.f_frsize;
+}
+
+/**
+ * oocalloc - Reserva n bytes en un archivo temporal proyectado en memoria.
+ *
+ * @return: Búfer, o NULL si el modo no está activo, n es pequeño o no se
+ *          pudo crear el archivo (quien llama reserva entonces en memoria).
+ *
+ * El archivo se crea disperso con ftruncate(), así que solo ocupa disco lo
+ * que se escribe. La proyección es compartida: el núcleo puede escribir a
+ * disco y descartar las páginas de la generación que ya no caben en
+ * memoria, y MADV_SEQUENTIAL le dice que lea por delante y libere por
+ * detrás, que es como las dos pasadas de la expansión recorren los búferes.
+ */
+void* oocalloc(size_t n) {
+	if (!oocon() || n < OOCMIN)
+		return NULL;
+	size_t len = (n + PAGE - 1) / PAGE * PAGE;
+
+	char path[4096];
+	snprintf(path, sizeof path, "%s/lsystem.XXXXXX", dir);
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	unlink(path);
+	if (ftruncate(fd, len) != 0) {
+		perror("oocalloc");
+		close(fd);
+		return NULL;
+	}
+	char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		perror("oocalloc");
+		close(fd);
+		return NULL;
+	}
+	madvise(p, len, MADV_SEQUENTIAL);
+
+	Map *m = emalloc(sizeof(Map));
+	m->p = p;
+	m->len = len;
+	m->fd = fd;
+#ifdef _OPENMP
+	#pragma omp critical(ooc)
+#endif
+	{
+		m->next = maps;
+		maps = m;
+	}
+	return p;
+}
+
+/**
+ * oocmap - Proyecta len bytes de fd desde off como un búfer de generación.
+ *
+ * @return: Búfer (liberable con bigfree()), o NULL si no se pudo proyectar.
+ *
+ * La proyección es privada y de escritura: el búfer se puede reutilizar para
+ * otra generación sin tocar el archivo, cuyas páginas se leen solo cuando
+ * se usan. off debe ser múltiplo de PAGE; no depende de LSYSTEM_OOC.
+ */
+void* oocmap(int fd, size_t off, size_t len) {
+	len = (len + PAGE - 1) / PAGE * PAGE;
+	char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, off);
+	if (p == MAP_FAILED) {
+		perror("oocmap");
+		return NULL;
+	}
+	madvise(p, len, MADV_SEQUENTIAL);
+
+	Map *m = emalloc(sizeof(Map));
+	m->p = p;
+	m->len = len;
+	m->fd = -1;
+#ifdef _OPENMP
+	#pragma omp critical(ooc)
+#endif
+	{
+		m->next = maps;
+		maps = m;
+	}
+	return p;
+}
+
+/**
+ * unlinkmap - Quita de la lista la proyección de p, o devuelve NULL.
+ */
+static Map* unlinkmap(void *p) {
+	Map *m = NULL;
+#ifdef _OPENMP
+	#pragma omp critical(ooc)
+#endif
+	for (Map **q = &maps; *q; q = &(*q)->next)
+		if ((*q)->p == p) {
+			m = *q;
+			*q = m->next;
+			break;
+		}
+	return m;
+}
+
+/**
+ * oocfree - Libera un búfer de oocalloc() u oocmap(); devuelve 0 si p no lo es.
+ */
+int oocfree(void *p) {
+	if (p == NULL || maps == NULL)
+		return 0;
+	Map *m = unlinkmap(p);
+	if (m == NULL)
+		return 0;
+	munmap(m->p, m->len);
+	if (m->fd >= 0)
+		close(m->fd);
+	free(m);
+	return 1;
+}
+
+/**
+ * oocdrop - Descarta el contenido de un búfer de oocalloc() que se va a
+ * reescribir entero.
+ *
+ * La generación que tenía ya no hace falta: se perfora el archivo para que
+ * sus páginas sucias no se escriban a disco y su espacio quede libre antes
+ * de escribir la siguiente. Si el sistema de archivos no lo permite, basta
+ * con soltar las páginas de la proyección.
+ */
+void oocdrop(void *p) {
+	if (ooc <= 0 || p == NULL)
+		return;
+	Map *m = NULL;
+#ifdef _OPENMP
+	#pragma omp critical(ooc)
+#endif
+	for (Map *q = maps; q; q = q->next)
+		if (q->p == p)
+			m = q;
+	if (m == NULL)
+		return;
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (m->fd >= 0 && fallocate(m->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, m->len) == 0)
+		return;
+#endif
+	madvise(m->p, m->len, MADV_DONTNEED);
+}
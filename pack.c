@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+/**
+ * Escritor de códigos empaquetados a partir de una posición cualquiera.
+ *
+ * Las palabras que el tramo llena por completo son suyas y se guardan
+ * directamente. La primera y la última pueden compartirse con los tramos
+ * vecinos, así que se combinan con un OR atómico sobre una palabra que se
+ * pone a cero antes de la escritura en paralelo.
+ */
+typedef struct
+{
+	uint64_t*	w;        // Palabra actual
+	uint64_t	acc;      // Códigos acumulados de la palabra actual
+	int	slot;             // Siguiente hueco libre en acc
+	int	first;            // 1 hasta volcar la primera palabra
+} Writer;
+
+static inline void wrflush(Writer *wr) {
+	if (wr->first)
+		__atomic_fetch_or(wr->w, wr->acc, __ATOMIC_RELAXED);
+	else
+		*wr->w = wr->acc;
+	wr->first = 0;
+	wr->acc = 0;
+	wr->slot = 0;
+	wr->w++;
+}
+
+static inline void wrput(Writer *wr, unsigned code, int bits, int per) {
+	wr->acc |= (uint64_t)code << (wr->slot * bits);
+	if (++wr->slot == per)
+		wrflush(wr);
+}
+
+static inline void wrend(Writer *wr) {
+	if (wr->slot > 0)	// Última palabra incompleta: compartida con el siguiente tramo
+		__atomic_fetch_or(wr->w, wr->acc, __ATOMIC_RELAXED);
+}
+
+/**
+ * pkwords - Palabras de 64 bits que ocupan n símbolos empaquetados.
+ */
+size_t pkwords(Lsystem *ls, size_t n) {
+	int per = 64 / ls->bits;
+	return (n + per - 1) / per;
+}
+
+/**
+ * pack - Empaqueta n símbolos de s en w (que debe tener pkwords(ls, n) palabras).
+ */
+void pack(Lsystem *ls, const char *s, size_t n, uint64_t *w) {
+	int bits = ls->bits, per = 64 / bits;
+	Writer wr = { w, 0, 0, 0 };
+
+	for (size_t i = 0; i < n; i++)
+		wrput(&wr, ls->code[(unsigned char)s[i]], bits, per);
+	if (wr.slot > 0)
+		*wr.w = wr.acc;
+}
+
+/**
+ * unpack - Desempaqueta n símbolos desde la posición start en out.
+ */
+void unpack(Lsystem *ls, const uint64_t *w, size_t start, size_t n, char *out) {
+	Reader rd;
+
+	rdinit(&rd, w, start, ls->bits);
+	for (size_t i = 0; i < n; i++)
+		out[i] = ls->sym[rdnext(&rd)];
+}
+
+/**
+ * mkpkarena - Crea búferes de generación empaquetados con el axioma.
+ *
+ * Usa la misma estructura Arena que arenanext(); len cuenta símbolos y cap
+ * bytes, pero el contenido son palabras de ls->bits bits por símbolo.
+ * Cada búfer tiene una palabra de más para que rdinit() pueda leer la
+ * palabra siguiente aunque esté justo al final de la generación.
+ */
+Arena* mkpkarena(Lsystem *ls) {
+	Arena *a = emalloc(sizeof(Arena));
+	a->len = strlen(ls->axiom);
+	a->cap[0] = (pkwords(ls, a->len) + 1) * sizeof(uint64_t);
+	a->buf[0] = malloc(a->cap[0]);
+	if (a->buf[0] == NULL) {
+		fprintf(stderr, "mkpkarena: sin memoria\n");
+		exit(EXIT_FAILURE);
+	}
+	pack(ls, ls->axiom, a->len, (uint64_t*)a->buf[0]);
+	a->cur = 0;
+	a->peak = a->cap[0];
+	return a;
+}
+
+/**
+ * Reparto de una generación empaquetada en bloques, como Split en expand.c.
+ * off[b] es el desplazamiento en símbolos de la salida del bloque b.
+ */
+typedef struct
+{
+	Lsystem*	ls;
+	const uint64_t*	in;   // Generación de entrada
+	size_t	len;          // Símbolos de la entrada
+	int	depth;            // Número de la generación de entrada
+	size_t	grain;        // Símbolos por bloque
+	size_t*	off;          // nb + 1 desplazamientos de salida
+	size_t*	clen;         // Longitud del sucesor de cada código
+	uint64_t*	out;      // Búfer de salida (segunda pasada)
+} Pksplit;
+
+/**
+ * pkcount - Primera pasada de un bloque empaquetado: su longitud de salida.
+ */
+static void pkcount(void *arg, size_t b) {
+	Pksplit *sp = arg;
+	Lsystem *ls = sp->ls;
+	size_t start = b * sp->grain;
+	size_t end = start + sp->grain < sp->len ? start + sp->grain : sp->len;
+	size_t n = 0;
+	Reader rd;
+	rdinit(&rd, sp->in, start, ls->bits);
+	if (ls->stoch)	// La longitud depende de la alternativa elegida
+		for (size_t i = start; i < end; i++)
+			n += choose(ls, lookup(ls, ls->sym[rdnext(&rd)]), sp->depth, i)->len;
+	else
+		for (size_t i = start; i < end; i++)
+			n += sp->clen[rdnext(&rd)];
+	sp->off[b + 1] = n;
+}
+
+/**
+ * pkwrite - Segunda pasada de un bloque: escribe sus códigos en su
+ * desplazamiento. Las palabras de sus bordes se combinan con OR.
+ */
+static void pkwrite(void *arg, size_t b) {
+	Pksplit *sp = arg;
+	Lsystem *ls = sp->ls;
+	int bits = ls->bits, per = 64 / bits;
+	size_t start = b * sp->grain;
+	size_t end = start + sp->grain < sp->len ? start + sp->grain : sp->len;
+	Writer wr = { &sp->out[sp->off[b] / per], 0, sp->off[b] % per, 1 };
+	Reader rd;
+	rdinit(&rd, sp->in, start, bits);
+	for (size_t i = start; i < end; i++) {
+		unsigned c = rdnext(&rd);
+		Prod *p = choose(ls, lookup(ls, ls->sym[c]), sp->depth, i);
+		if (p->ident)
+			wrput(&wr, c, bits, per);
+		else
+			for (size_t j = 0; j < p->len; j++)
+				wrput(&wr, ls->code[(unsigned char)p->succ[j]], bits, per);
+	}
+	wrend(&wr);
+}
+
+/**
+ * pknext - Expande una generación empaquetada en el otro búfer y los alterna.
+ *
+ * @a: Búferes creados con mkpkarena().
+ * @ls: L-system con la tabla de reglas y el alfabeto.
+ * @threads: Número de hilos.
+ * @return: Longitud en símbolos de la nueva generación.
+ *
+ * Sigue el mismo esquema de contar, sumar prefijos y escribir que
+ * arenanext(), pero leyendo y escribiendo códigos empaquetados: la
+ * generación nunca se desempaqueta. Los bloques se reparten igual, con
+ * schedule() y según lo que escriben en la segunda pasada, y en modo NUMA
+ * cada hilo toca primero las páginas de salida de sus bloques.
+ */
+size_t pknext(Arena *a, Lsystem *ls, int threads) {
+	if (ls->ctx || ls->param) {	// Contexto y parámetros se leen de la cadena sin empaquetar
+		fprintf(stderr, "pknext: las reglas con contexto o paramétricas no admiten generaciones empaquetadas\n");
+		exit(EXIT_FAILURE);
+	}
+	int per = 64 / ls->bits;
+	int nt = threads < 1 ? 1 : threads;
+
+	// Longitud del sucesor de cada código
+	size_t clen[256];
+	for (int c = 0; c < ls->nsyms; c++)
+		clen[c] = lookup(ls, ls->sym[c])->len;
+
+	Pksplit sp = { .ls = ls, .in = (const uint64_t*)a->buf[a->cur], .len = a->len,
+	               .depth = a->depth, .grain = grainsize(a->len, nt), .clen = clen };
+	size_t nb = sp.len ? (sp.len + sp.grain - 1) / sp.grain : 1;
+	sp.off = emalloc((nb + 1) * sizeof(size_t));
+
+	// Primera pasada: longitud de salida de cada bloque
+	Mark m;
+	profstart(&m);
+	schedule(nt, nb, NULL, pkcount, &sp, P_COUNT);
+	profstop(P_COUNT, &m, 1);
+	profstart(&m);
+	sp.off[0] = 0;
+	for (size_t b = 0; b < nb; b++)
+		sp.off[b + 1] += sp.off[b];
+	profstop(P_SCAN, &m, 1);
+
+	// Búfer libre con sitio para la salida (sin relleno a ceros)
+	size_t total = sp.off[nb];
+	int nxt = !a->cur;
+	size_t need = (pkwords(ls, total) + 1) * sizeof(uint64_t);
+	if (a->cap[nxt] < need) {
+		size_t cap = a->cap[nxt] + a->cap[nxt] / 2;
+		if (cap < need)
+			cap = need;
+		bigfree(a->buf[nxt]);
+		a->buf[nxt] = bigalloc(cap);
+		if (a->buf[nxt] == NULL) {
+			fprintf(stderr, "pknext: no hay memoria para %zu bytes\n", cap);
+			exit(EXIT_FAILURE);
+		}
+		a->cap[nxt] = cap;
+		if (numaon()) {	// firsttouch() necesita los desplazamientos en bytes
+			size_t *boff = emalloc((nb + 1) * sizeof(size_t));
+			for (size_t b = 0; b <= nb; b++)
+				boff[b] = sp.off[b] / per * sizeof(uint64_t);
+			firsttouch(a->buf[nxt], nt, nb, boff);
+			free(boff);
+		}
+	} else
+		oocdrop(a->buf[nxt]);	// Solo con LSYSTEM_OOC
+	sp.out = (uint64_t*)a->buf[nxt];
+
+	// Las palabras de los bordes de cada bloque se combinan con OR: a cero
+	profstart(&m);
+	for (size_t b = 0; b < nb; b++)
+		if (sp.off[b + 1] > sp.off[b]) {
+			sp.out[sp.off[b] / per] = 0;
+			sp.out[(sp.off[b + 1] - 1) / per] = 0;
+		}
+
+	// Segunda pasada: cada bloque escribe sus códigos en su desplazamiento
+	schedule(nt, nb, sp.off, pkwrite, &sp, P_WRITE);
+	profstop(P_WRITE, &m, 1);
+
+	a->len = total;
+	a->cur = nxt;
+	a->depth++;
+	if (a->cap[0] + a->cap[1] > a->peak)
+		a->peak = a->cap[0] + a->cap[1];
+	free(sp.off);
+	return total;
+}
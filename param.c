@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+/**
+ * setarity - Comprueba que el símbolo c lleva siempre n parámetros.
+ */
+static void setarity(Lsystem *ls, char *seen, char c, int n) {
+	unsigned char u = c;
+	if (n > MAXPAR) {
+		fprintf(stderr, "module %c has more than %d parameters\n", c, MAXPAR);
+		parsefail();
+	}
+	if (seen[u] && ls->arity[u] != n) {
+		fprintf(stderr, "module %c used with %d and %d parameters\n", c, ls->arity[u], n);
+		parsefail();
+	}
+	seen[u] = 1;
+	ls->arity[u] = n;
+	if (n > ls->npar)
+		ls->npar = n;
+}
+
+/**
+ * split - Separa una lista "a,b(c,d),e" por las comas de primer nivel.
+ *
+ * @return: Número de elementos; args recibe copias de cada uno en parsetmp().
+ */
+static int split(const char *s, size_t n, char **args) {
+	int k = 0, depth = 0;
+	size_t start = 0;
+	if (n == 0)
+		return 0;
+	for (size_t i = 0; i <= n; i++) {
+		if (i == n || (s[i] == ',' && depth == 0)) {
+			if (k == MAXPAR)
+				return MAXPAR + 1;
+			args[k++] = pstrdup(parsetmp(), s + start, i - start);
+			start = i + 1;
+		} else if (s[i] == '(')
+			depth++;
+		else if (s[i] == ')')
+			depth--;
+	}
+	return k;
+}
+
+/**
+ * modules - Separa una cadena de módulos "F(t*0.7)[+A(t-1)]" en sus
+ * símbolos ("F[+A]") y los textos de sus argumentos, en orden.
+ *
+ * @np: Recibe, por módulo, cuántos argumentos lleva.
+ * @args, @nargs: Reciben los argumentos de todos los módulos seguidos.
+ *
+ * Todo lo que devuelve está en parsetmp(): no hay que liberarlo.
+ */
+static char* modules(const char *s, unsigned char **np, char ***args, int *nargs) {
+	size_t len = strlen(s);
+	Pool *tmp = parsetmp();
+	char *sym = palloc(tmp, len + 1);
+	*np = palloc(tmp, len + 1);
+	*args = palloc(tmp, (len + 1) * MAXPAR * sizeof(char*));
+	*nargs = 0;
+
+	size_t n = 0;
+	for (size_t i = 0; i < len; ) {
+		sym[n] = s[i++];
+		if (s[i] == '(') {
+			size_t j = ++i;
+			for (int depth = 1; j < len; j++) {
+				depth += s[j] == '(' ? 1 : s[j] == ')' ? -1 : 0;
+				if (depth == 0)
+					break;
+			}
+			if (j == len) {
+				fprintf(stderr, "unbalanced '(' in '%s'\n", s);
+				parsefail();
+			}
+			int k = split(s + i, j - i, *args + *nargs);
+			if (k > MAXPAR) {
+				fprintf(stderr, "module %c has more than %d parameters\n", sym[n], MAXPAR);
+				parsefail();
+			}
+			(*np)[n] = k;
+			*nargs += k;
+			i = j + 1;
+		}
+		n++;
+	}
+	sym[n] = '\0';
+	return sym;
+}
+
+/**
+ * replace - Sustituye la cadena *dst por una copia de s.
+ *
+ * En un L-system de un catálogo la cadena vieja es de su memoria y la
+ * nueva se copia a ella.
+ */
+static void replace(Lsystem *ls, char **dst, const char *s) {
+	if (!ls->pool)
+		free(*dst);
+	*dst = pstrdup(ls->pool, s, strlen(s));
+}
+
+/**
+ * isparametric - 1 si el axioma o alguna regla usa parámetros o condiciones.
+ */
+int isparametric(Lsystem *ls) {
+	if (strchr(ls->axiom, '('))
+		return 1;
+	for (Rule *r = ls->rules; r; r = r->next)
+		if (r->formal || r->cond || strchr(r->succ, '('))
+			return 1;
+	return 0;
+}
+
+/**
+ * mkparams - Compila un sistema paramétrico al terminar de parsearlo.
+ *
+ * Los sucesores y el axioma pasan a tener solo símbolos, un carácter por
+ * módulo, para que el resto del programa (alfabeto, tortuga, salida) los
+ * trate igual que siempre. Las condiciones y los argumentos se compilan a
+ * código con mkexpr(), con los nombres de los parámetros del predecesor
+ * como variables, y los parámetros del axioma se calculan ya. Cada símbolo
+ * debe llevar siempre el mismo número de parámetros.
+ */
+void mkparams(Lsystem *ls) {
+	char seen[256] = { 0 };
+	unsigned char *np;
+	char **args;
+	int nargs;
+
+	ls->param = 1;
+	for (Rule *r = ls->rules; r; r = r->next) {
+		if (r->weight > 0 || r->left || r->right) {
+			fprintf(stderr, "parametric rules cannot have a weight or context\n");
+			parsefail();
+		}
+		Prule *pr = r->pr = emalloc(sizeof(Prule));
+
+		// Parámetros formales del predecesor: A(t,s)
+		char *formals[MAXPAR + 1];
+		int nf = r->formal ? split(r->formal, strlen(r->formal), formals) : 0;
+		setarity(ls, seen, r->pred, nf);
+		if (r->cond)
+			pr->cond = mkexpr(r->cond, formals, nf);
+
+		char *sym = modules(r->succ, &np, &args, &nargs);
+		pr->args = emalloc((nargs + 1) * sizeof(Expr*));
+		pr->nargs = nargs;
+		for (int k = 0; k < nargs; k++)
+			pr->args[k] = mkexpr(args[k], formals, nf);
+		for (size_t i = 0; sym[i]; i++)
+			setarity(ls, seen, sym[i], np[i]);
+		replace(ls, &r->succ, sym);
+	}
+
+	// Axioma: argumentos constantes, guardados como estructura de arrays
+	char *sym = modules(ls->axiom, &np, &args, &nargs);
+	size_t len = strlen(sym);
+	for (size_t i = 0; i < len; i++)
+		setarity(ls, seen, sym[i], np[i]);
+	if (ls->npar == 0)
+		ls->npar = 1;	// Siempre hay al menos un array, aunque no se use
+	ls->axpar = emalloc(ls->npar * (len + 1) * sizeof(double));
+	int a = 0;
+	for (size_t i = 0; i < len; i++)
+		for (int k = 0; k < np[i]; k++) {
+			Expr *e = mkexpr(args[a++], NULL, 0);
+			ls->axpar[k * (len + 1) + i] = eval(e, NULL);
+			freeexpr(e);
+		}
+	replace(ls, &ls->axiom, sym);
+}
+
+/**
+ * paramrules - Copia a la tabla las reglas paramétricas de cada símbolo, en
+ * el orden del archivo; compile() la llama.
+ */
+void paramrules(Lsystem *ls) {
+	if (!ls->param)
+		return;
+	for (Rule *r = ls->rules; r; r = r->next)
+		lookup(ls, r->pred)->nprule++;
+	for (int c = 0; c < 256; c++) {
+		Prod *p = &ls->table[c];
+		if (p->nprule == 0)
+			continue;
+		p->prule = emalloc(p->nprule * sizeof(Prule));
+		int k = p->nprule;
+		for (Rule *r = ls->rules; r; r = r->next)
+			if ((unsigned char)r->pred == c) {
+				Prule *pr = &p->prule[--k];
+				*pr = *r->pr;
+				pr->prod.succ = r->succ;
+				pr->prod.len = strlen(r->succ);
+			}
+	}
+}
+
+/**
+ * freeprule - Libera la regla compilada de una Rule.
+ */
+void freeprule(Prule *pr) {
+	if (pr == NULL)
+		return;
+	freeexpr(pr->cond);
+	for (int k = 0; k < pr->nargs; k++)
+		freeexpr(pr->args[k]);
+	free(pr->args);
+	free(pr);
+}
+
+/**
+ * pmatch - Primera regla de c (en el orden del archivo) cuya condición se
+ * cumple con los parámetros par, o NULL si no se aplica ninguna.
+ */
+Prule* pmatch(Lsystem *ls, char c, const double *par) {
+	Prod *p = lookup(ls, c);
+	for (int k = 0; k < p->nprule; k++)
+		if (p->prule[k].cond == NULL || eval(p->prule[k].cond, par) != 0)
+			return &p->prule[k];
+	return NULL;
+}
+
+/**
+ * getpar - Copia los parámetros del módulo i de una generación en par.
+ */
+static inline void getpar(Lsystem *ls, char c, const double *in, size_t stride, size_t i,
+                          double *par) {
+	int n = ls->arity[(unsigned char)c];
+	for (int k = 0; k < n; k++)
+		par[k] = in[k * stride + i];
+}
+
+/**
+ * pmcount - Primera pasada paramétrica: módulos que produce gen[start, end).
+ *
+ * @in, @stride: Parámetros de la generación (estructura de arrays).
+ */
+size_t pmcount(Lsystem *ls, const char *gen, const double *in, size_t stride,
+              size_t start, size_t end) {
+	double par[MAXPAR];
+	size_t n = 0;
+	for (size_t i = start; i < end; i++) {
+		if (lookup(ls, gen[i])->nprule == 0) {
+			n++;
+			continue;
+		}
+		getpar(ls, gen[i], in, stride, i, par);
+		Prule *r = pmatch(ls, gen[i], par);
+		n += r ? r->prod.len : 1;
+	}
+	return n;
+}
+
+/**
+ * pmwrite - Segunda pasada paramétrica: escribe los módulos de gen[start, end)
+ * a partir de la posición pos de out, con sus parámetros en opar.
+ *
+ * La regla se vuelve a elegir igual que en pmcount(); los argumentos del
+ * sucesor se evalúan con los parámetros del módulo reescrito. Un módulo sin
+ * regla aplicable se copia con sus parámetros.
+ */
+void pmwrite(Lsystem *ls, const char *gen, const double *in, size_t stride, size_t start,
+            size_t end, char *out, double *opar, size_t ostride, size_t pos) {
+	double par[MAXPAR];
+	for (size_t i = start; i < end; i++) {
+		char c = gen[i];
+		getpar(ls, c, in, stride, i, par);
+		Prule *r = lookup(ls, c)->nprule ? pmatch(ls, c, par) : NULL;
+		if (r == NULL) {
+			out[pos] = c;
+			for (int k = 0; k < ls->arity[(unsigned char)c]; k++)
+				opar[k * ostride + pos] = par[k];
+			pos++;
+			continue;
+		}
+		Expr **arg = r->args;
+		for (size_t j = 0; j < r->prod.len; j++, pos++) {
+			char m = r->prod.succ[j];
+			out[pos] = m;
+			for (int k = 0; k < ls->arity[(unsigned char)m]; k++)
+				opar[k * ostride + pos] = eval(*arg++, par);
+		}
+	}
+}
+
+/**
+ * fmtmodule - Escribe en buf el módulo i como texto, p. ej. "F(1.5,2)".
+ *
+ * @return: Caracteres escritos (buf debe tener sitio para MAXMODULE).
+ */
+size_t fmtmodule(Lsystem *ls, char c, const double *par, size_t stride, size_t i, char *buf) {
+	int n = ls->arity[(unsigned char)c];
+	size_t w = 0;
+	buf[w++] = c;
+	for (int k = 0; k < n; k++)
+		w += sprintf(buf + w, "%c%.9g", k ? ',' : '(', par[k * stride + i]);
+	if (n)
+		buf[w++] = ')';
+	return w;
+}
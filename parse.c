@@ -2,17 +2,51 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "a.h"
 
-#define BUFSIZE 1024
+#define NUMSIZE 64	// Caracteres de un número
+
+/**
+ * Token: trozo del texto de entrada, sin copiar ni terminar en '\0'.
+ */
+typedef struct
+{
+    const char*	s;    // Primer carácter
+    size_t	n;        // Longitud (0 al final del texto)
+} Tok;
+
+/**
+ * Lector de una definición ya cargada en memoria (loadfile()).
+ */
+typedef struct
+{
+    const char*	p;    // Siguiente carácter por leer
+    const char*	end;  // Final del texto
+    const char*	file; // Archivo de origen (para los errores)
+} Lexer;
 
 // Declaración de funciones auxiliares
-Rule* mkrule(char pred, char *succ);
-void skipws(FILE *f);
-char* next(FILE *f);
-char* readstring(FILE *f);
-char* readnumber(FILE *f, int real);
+Rule* mkrule(Lsystem *ls);
+void alphabet(Lsystem *ls);
+void stochastic(Lsystem *ls);
+static void syntax(Lexer *lx, const char *fmt, ...);
+static void skipws(Lexer *lx);
+static Tok next(Lexer *lx);
+static Tok readstring(Lexer *lx);
+static char* readnumber(Lexer *lx, int real, char *buf);
+
+#define tokis(t, lit) ((t).n == sizeof(lit) - 1 && memcmp((t).s, lit, (t).n) == 0)
+
+static __thread jmp_buf *recover;	// Vuelta a tryparse() tras un error, o NULL
+static __thread Lsystem *partial;	// L-system que parsetext() está construyendo
+static __thread Pool *scratch;	// Temporales de partial (parsetmp()), o NULL
 
 
 /**
@@ -21,235 +55,645 @@ char* readnumber(FILE *f, int real);
  * @filename: Ruta al archivo de entrada.
  * @return: Estructura Lsystem* completamente construida a partir del archivo.
  * 
- * El archivo debe contener tokens como:
+ * El archivo se proyecta en memoria y se lee sin copiarlo (parsetext()).
+ */
+Lsystem* parse(char *filename) {
+    Mark m;
+    size_t len;
+    int mapped;
+
+    profstart(&m);
+    char *text = loadfile(filename, &len, &mapped);
+    if (text == NULL)
+        exit(1);
+    Lsystem *ls = parsetext(filename, text, len, NULL);
+    unloadfile(text, len, mapped);
+    profstop(P_PARSE, &m, 1);
+    return ls;
+}
+
+/**
+ * loadfile - Carga un archivo entero en memoria para parsearlo.
+ *
+ * @path: Archivo de entrada.
+ * @len: Recibe su longitud.
+ * @mapped: Recibe 1 si el texto está proyectado y 0 si se ha leído.
+ * @return: Texto del archivo, sin '\0' final; se libera con unloadfile().
+ *          NULL si no se puede leer (un directorio, por ejemplo), tras
+ *          explicarlo en stderr.
+ *
+ * Los archivos regulares se proyectan con mmap() y no se copian: el
+ * parser lee los tokens directamente de las páginas del archivo. Las
+ * tuberías y los archivos vacíos se leen en un búfer.
+ */
+char* loadfile(const char *path, size_t *len, int *mapped) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    char *text = loadfd(fd, path, len, mapped);
+    close(fd);
+    return text;
+}
+
+/**
+ * loadfd - Como loadfile(), pero con un archivo que ya ha abierto (y
+ * comprobado) quien llama; no lo cierra. @path solo se usa en los mensajes.
+ */
+char* loadfd(int fd, const char *path, size_t *len, int *mapped) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            *len = st.st_size;
+            *mapped = 1;
+            return p;
+        }
+    }
+
+    size_t n = 0, cap = 4096;
+    char *buf = emalloc(cap);
+    ssize_t r;
+    while ((r = read(fd, buf + n, cap - n)) != 0) {
+        if (r < 0) {
+            perror(path);
+            free(buf);
+            return NULL;
+        }
+        n += r;
+        if (n == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (buf == NULL) {
+                fprintf(stderr, "loadfile: sin memoria\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    *len = n;
+    *mapped = 0;
+    return buf;
+}
+
+/**
+ * unloadfile - Libera el texto de loadfile().
+ */
+void unloadfile(char *text, size_t len, int mapped) {
+    if (mapped)
+        munmap(text, len);
+    else
+        free(text);
+}
+
+/**
+ * parsetext - Parsea la definición de un L-system que ya está en memoria.
+ *
+ * @file: Nombre del origen, para los mensajes de error.
+ * @text, @len: Texto de la definición (no hace falta '\0' final).
+ * @pool: Memoria para el L-system (con su tabla), nombres, reglas y cadenas,
+ *        o NULL para reservar cada uno por separado (los libera freelsystem()).
+ * @return: L-system ya compilado.
+ *
+ * Los tokens son trozos del propio texto: solo se copian al L-system las
+ * cadenas que se guardan, con su longitud exacta, sin límite de tamaño.
+ * El texto debe tener tokens como:
  * - name 'Nombre'
  * - axiom F+F+F
  * - rule F → F-F++
+ * - rule F 0.3 → F[+F]  (regla estocástica: peso antes de la flecha)
+ * - seed 42             (semilla de las reglas estocásticas)
+ * - rule A < F > B → FA  (regla con contexto; cualquiera de los dos lados)
+ * - ignore +-            (símbolos que no cuentan como contexto)
+ * - skip-branches 1      (el contexto salta las ramas entre corchetes)
+ * - axiom A(4)           (módulos con parámetros: sistema paramétrico)
+ * - rule A(t) : t>2 → F(t*0.7)[+A(t-1)]  (condición opcional tras ':';
+ *                        expresiones sin espacios)
  * - line-length 10
  * - initial-angle 90
  * - left-angle 45
  * - right-angle 45
  */
-Lsystem* parse(char *filename) {
+Lsystem* parsetext(const char *file, const char *text, size_t len, Pool *pool) {
     Lsystem *ls;
     Rule *r;
-    FILE *fp;
-    char *s, c;
-
-    // Abrir el archivo de entrada
-    fp = fopen(filename, "r");
-    if (fp == NULL) {
-        perror("fopen");
-        exit(1);
-    }
+    Tok s;
+    char num[NUMSIZE];
+    Lexer lx = { text, text + len, file };
 
-    // Reservar memoria para el sistema L
-    ls = emalloc(sizeof(Lsystem));
+    // Reservar memoria para el sistema L (con su tabla, en pool si la hay)
+    ls = partial = palloc(pool, sizeof(Lsystem));
+    ls->pool = pool;
 
     while (1) {
-        skipws(fp);
-        s = next(fp);
-        if (strlen(s) == 0) {
-            free(s);
+        skipws(&lx);
+        s = next(&lx);
+        if (s.n == 0)
             break;
-        }
         // Análisis del contenido del archivo dependiendo del token leído
-        if (strcmp(s, "name") == 0) { // Leer nombre del sistema
-            free(s);
-            skipws(fp);
-            ls->name = readstring(fp);
-
-        } else if (strcmp(s, "axiom") == 0) { // Leer axioma inicial
-            free(s);
-            skipws(fp);
-            ls->axiom = next(fp);
-
-        } else if (strcmp(s, "rule") == 0) { // Leer regla
-            free(s);
-            skipws(fp);
-            s = next(fp);
-            c = s[0]; // Leer el símbolo predicado
-            free(s);
-            skipws(fp);
-            s = next(fp);
-            if (strcmp(s, "->") != 0) {
-                fprintf(stderr, "expected '->' but got '%s'\n", s);
-                exit(1);
+        if (tokis(s, "name")) { // Leer nombre del sistema
+            skipws(&lx);
+            s = readstring(&lx);
+            ls->name = pstrdup(pool, s.s, s.n);
+
+        } else if (tokis(s, "axiom")) { // Leer axioma inicial
+            skipws(&lx);
+            s = next(&lx);
+            ls->axiom = pstrdup(pool, s.s, s.n);
+
+        } else if (tokis(s, "rule")) { // Leer regla
+            // La regla se enlaza ya vacía: si hay un error, freelsystem() libera lo leído
+            r = mkrule(ls);
+            skipws(&lx);
+            s = next(&lx);
+            skipws(&lx);
+            Tok t = next(&lx);
+            if (tokis(t, "<")) { // Contexto izquierdo: A < F
+                r->left = pstrdup(pool, s.s, s.n);
+                skipws(&lx);
+                s = next(&lx);
+                skipws(&lx);
+                t = next(&lx);
+            }
+            if (s.n == 0)
+                syntax(&lx, "expected a rule");
+            r->pred = s.s[0]; // Leer el símbolo predicado
+            if (s.n > 1 && s.s[1] == '(') { // Parámetros formales: A(t,s)
+                if (s.s[s.n - 1] != ')')
+                    syntax(&lx, "expected ')' at the end of '%.*s'", (int)s.n, s.s);
+                r->formal = pstrdup(pool, s.s + 2, s.n - 3);
+            }
+            s = t;
+            if (tokis(s, ">")) { // Contexto derecho: F > B
+                skipws(&lx);
+                s = next(&lx);
+                r->right = pstrdup(pool, s.s, s.n);
+                skipws(&lx);
+                s = next(&lx);
+            }
+            if (tokis(s, ":")) { // Condición de una regla paramétrica
+                skipws(&lx);
+                s = next(&lx);
+                r->cond = pstrdup(pool, s.s, s.n);
+                skipws(&lx);
+                s = next(&lx);
             }
-            free(s);
-            skipws(fp);
-            s = next(fp); // Leer el sucesor de la regla
-            r = mkrule(c, s); // Crear la regla
-            r->next = ls->rules; //Enlaza la nueva regla con el resto de la lista
-            ls->rules = r;// Insertarla al inicio de la lista de reglas
-
-        } else if (strcmp(s, "line-length") == 0) {// Leer longitud de línea
-            free(s);
-            skipws(fp);
-            s = readnumber(fp, 0);
-            ls->linelen = atoi(s);
-            free(s);
-
-        } else if (strcmp(s, "initial-angle") == 0) {// Leer ángulo inicial
-            free(s);
-            skipws(fp);
-            s = readnumber(fp, 1);
-            ls->initangle = atof(s);
-            free(s);
-
-        } else if (strcmp(s, "left-angle") == 0) {// Leer ángulo de giro a la izquierda
-            free(s);
-            skipws(fp);
-            s = readnumber(fp, 1);
-            ls->leftangle = atof(s);
-            free(s);
-
-        } else if (strcmp(s, "right-angle") == 0) {// Leer ángulo de giro a la derecha
-            free(s);
-            skipws(fp);
-            s = readnumber(fp, 1);
-            ls->rightangle = atof(s);
-            free(s);
+            double w = 0;
+            if (!tokis(s, "->")) { // Peso opcional de una regla estocástica
+                char *end;
+                if (s.n < NUMSIZE) {
+                    memcpy(num, s.s, s.n);
+                    num[s.n] = '\0';
+                    w = strtod(num, &end);
+                }
+                if (s.n >= NUMSIZE || end == num || *end != '\0' || !(w > 0))
+                    syntax(&lx, "expected '->' or a positive weight but got '%.*s'", (int)s.n, s.s);
+                skipws(&lx);
+                s = next(&lx);
+            }
+            if (!tokis(s, "->"))
+                syntax(&lx, "expected '->' but got '%.*s'", (int)s.n, s.s);
+            if (w > 0 && (r->left || r->right))
+                syntax(&lx, "context-sensitive rules cannot have a weight");
+            skipws(&lx);
+            s = next(&lx); // Leer el sucesor de la regla
+            r->succ = pstrdup(pool, s.s, s.n);
+            r->weight = w;
+
+        } else if (tokis(s, "seed")) {// Leer semilla de las reglas estocásticas
+            skipws(&lx);
+            ls->seed = strtoull(readnumber(&lx, 0, num), NULL, 10);
+
+        } else if (tokis(s, "ignore")) {// Leer símbolos que no cuentan como contexto
+            skipws(&lx);
+            s = next(&lx);
+            for (size_t i = 0; i < s.n; i++)
+                ls->ignore[(unsigned char)s.s[i]] = 1;
+
+        } else if (tokis(s, "skip-branches")) {// Leer si el contexto salta las ramas
+            skipws(&lx);
+            ls->skipbranch = atoi(readnumber(&lx, 0, num)) != 0;
+
+        } else if (tokis(s, "line-length")) {// Leer longitud de línea
+            skipws(&lx);
+            ls->linelen = atoi(readnumber(&lx, 0, num));
+
+        } else if (tokis(s, "initial-angle")) {// Leer ángulo inicial
+            skipws(&lx);
+            ls->initangle = atof(readnumber(&lx, 1, num));
+
+        } else if (tokis(s, "left-angle")) {// Leer ángulo de giro a la izquierda
+            skipws(&lx);
+            ls->leftangle = atof(readnumber(&lx, 1, num));
+
+        } else if (tokis(s, "right-angle")) {// Leer ángulo de giro a la derecha
+            skipws(&lx);
+            ls->rightangle = atof(readnumber(&lx, 1, num));
 
         } else {
-            fprintf(stderr, "unexpected token '%s'\n", s);
-            exit(1);
+            syntax(&lx, "unexpected token '%.*s'", (int)s.n, s.s);
         }
     }
     // Verificaciones finales para asegurar que el sistema esté completo
     if (ls->name == NULL)
-        fprintf(stderr, "missing lsystem name\n"), exit(1);
+        syntax(&lx, "missing lsystem name");
     if (ls->axiom == NULL)
-        fprintf(stderr, "no axiom defined\n"), exit(1);
+        syntax(&lx, "no axiom defined");
     if (ls->rules == NULL)
-        fprintf(stderr, "no rules defined\n"), exit(1);
-	
-
-    fclose(fp);
+        syntax(&lx, "no rules defined");
+
+    // LSYSTEM_SEED cambia la semilla sin editar el archivo (variantes de una planta)
+    const char *e = getenv("LSYSTEM_SEED");
+    if (e != NULL && *e)
+        ls->seed = strtoull(e, NULL, 10);
+
+    if (isparametric(ls))
+        mkparams(ls);
+    compile(ls);
+    freepool(scratch);
+    scratch = NULL;
+    partial = NULL;
     return ls;
 }
 
 /**
- * mkrule - Crea una nueva regla de producción para el L-system.
+ * parsetmp - Memoria para los temporales del L-system que se está
+ * parseando (como los trozos de mkparams()).
  *
- * @pred: Carácter que se desea reemplazar.
- * @succ: Cadena con la sustitución correspondiente.
- * @return: Puntero a la regla creada.
+ * Se libera entera al terminar parsetext() o, tras un error, en
+ * tryparse(), así que quien reserva en ella no tiene que liberar nada
+ * aunque parsefail() no vuelva.
  */
-Rule*
-mkrule(char pred, char *succ)
-{
-	Rule *r = emalloc(sizeof(Rule));
-	r->pred = pred;
-	r->succ = strdup(succ);
-	r->next = NULL;
-	return r;
+Pool* parsetmp(void) {
+    if (scratch == NULL)
+        scratch = mkpool();
+    return scratch;
 }
 
 /**
- * skipws - Omite espacios en blanco en el búfer de entrada.
+ * tryparse - Como parsetext(), pero ante un error de sintaxis devuelve NULL
+ * (tras explicarlo en stderr) en vez de terminar el programa.
  *
- * @f: Puntero al búfer de entrada.
+ * Los errores se detectan en muchos sitios (syntax(), mkparams(),
+ * mkexpr()); todos llaman a parsefail(), que vuelve aquí con longjmp() y
+ * se libera lo que ya se había construido: todo lo que se reserva está
+ * ya enlazado a partial o en parsetmp() antes de que algo pueda fallar. Cada hilo tiene su propio punto
+ * de vuelta, así que se puede usar desde varios hilos a la vez.
  */
+Lsystem* tryparse(const char *file, const char *text, size_t len, Pool *pool) {
+    jmp_buf env, *outer = recover;
+    if (setjmp(env)) {
+        recover = outer;
+        freelsystem(partial);
+        freepool(scratch);
+        scratch = NULL;
+        partial = NULL;
+        return NULL;
+    }
+    recover = &env;
+    Lsystem *ls = parsetext(file, text, len, pool);
+    recover = outer;
+    return ls;
+}
 
+/**
+ * parsefail - Abandona la definición que se está parseando: vuelve a
+ * tryparse() si se parsea con ella y, si no, termina el programa.
+ */
+void parsefail(void) {
+    if (recover)
+        longjmp(*recover, 1);
+    exit(1);
+}
 
-void skipws(FILE *f) {
-    int c;
-    while ((c = fgetc(f)) != EOF) {
-        if (!isspace(c)) {
-            ungetc(c, f);
-            break;
-        }
+/**
+ * sysend - Final de la definición que empieza en text, dentro de un archivo
+ * con varias seguidas (un catálogo).
+ *
+ * @return: Posición del segundo 'name' a partir de text, que empieza la
+ *          definición siguiente, o end si no hay más.
+ *
+ * Solo cuenta un 'name' que empieza una directiva: se saltan los argumentos
+ * de cada una, así que un axioma o un sucesor que se escriba "name" no
+ * parte la definición. Si a una regla le falta la flecha, la definición
+ * acaba en el siguiente name 'Nombre' y solo esa se pierde.
+ */
+const char* sysend(const char *file, const char *text, const char *end) {
+    Lexer lx = { text, end, file };
+    int named = 0;
+
+    for (;;) {
+        skipws(&lx);
+        Tok s = next(&lx);
+        if (s.n == 0)
+            return end;
+        skipws(&lx);
+        if (tokis(s, "name")) {
+            if (named)
+                return s.s;
+            named = 1;
+            if (lx.p < end && *lx.p == '\'')
+                readstring(&lx);	// El nombre puede tener espacios
+            else
+                next(&lx);	// Mal escrito: ya lo dirá el parser
+        } else if (tokis(s, "rule")) {	// Hasta la flecha, y el sucesor
+            Tok t;
+            do {
+                t = next(&lx);
+                // Una regla sin flecha no se come la definición siguiente
+                if (named && tokis(t, "name") && lx.p < end && isspace((unsigned char)*lx.p)) {
+                    skipws(&lx);
+                    if (lx.p < end && *lx.p == '\'')
+                        return t.s;
+                }
+                skipws(&lx);
+            } while (t.n > 0 && !tokis(t, "->"));
+            next(&lx);
+        } else
+            next(&lx);	// Las demás directivas llevan un solo argumento
     }
 }
 
 /**
- * next - Lee el siguiente token desde el búfer.
+ * compile - Construye la tabla de reglas compilada del L-system.
+ *
+ * @ls: L-system con la lista de reglas ya leída.
+ *
+ * Cada una de las 256 entradas guarda el sucesor, su longitud, si el símbolo
+ * es identidad y la acción de la tortuga, para que la expansión y el dibujo
+ * resuelvan cada símbolo con un solo acceso a memoria. Si hay varias reglas
+ * para el mismo símbolo gana la primera de la lista (la última del archivo),
+ * igual que al recorrer la lista.
  *
- * @f: Puntero al búfer.
- * @return: Cadena con el token leído.
+ * Si alguna de las reglas de un símbolo tiene peso, todas ellas (peso 1 las
+ * que no lo indican) pasan a ser alternativas en el orden del archivo, cada
+ * una con su probabilidad acumulada sobre 2^32 para que choose() elija con
+ * una comparación de enteros. Las reglas con contexto se compilan aparte
+ * (contextual()); la entrada guarda la regla sin contexto para cuando no
+ * coincide ninguna, y lo mismo las paramétricas (paramrules()).
  */
+void compile(Lsystem *ls) {
+    for (int c = 0; c < 256; c++) {
+        free(ls->table[c].alt);
+        free(ls->table[c].ctx);
+        free(ls->table[c].prule);
+    }
+    ls->stoch = 0;
+    for (int c = 0; c < 256; c++) {
+        ls->self[c] = (char)c;
+        ls->table[c].succ = &ls->self[c];
+        ls->table[c].len = 1;
+        ls->table[c].ident = 1;
+        ls->table[c].op = T_NONE;
+        ls->table[c].nalt = 0;
+        ls->table[c].alt = NULL;
+        ls->table[c].nctx = 0;
+        ls->table[c].ctx = NULL;
+        ls->table[c].nprule = 0;
+        ls->table[c].prule = NULL;
+    }
 
+    for (Rule *r = ls->rules; r; r = r->next) {
+        Prod *p = lookup(ls, r->pred);
+        if (!p->ident || r->left || r->right)
+            continue;
+        p->succ = r->succ;
+        p->len = strlen(r->succ);
+        p->ident = 0;
+    }
+    stochastic(ls);
+    contextual(ls);
+    paramrules(ls);
+
+    ls->table['F'].op = T_FORWARD;
+    ls->table['G'].op = T_FORWARD;
+    ls->table['-'].op = T_LEFT;
+    ls->table['+'].op = T_RIGHT;
+    ls->table['['].op = T_PUSH;
+    ls->table[']'].op = T_POP;
+
+    alphabet(ls);
+    free(ls->simd);
+    ls->simd = mksimd(ls);
+}
 
-char* next(FILE *f) {
-    char buf[BUFSIZE];
-    int c, n = 0;
+/**
+ * stochastic - Compila las alternativas de los símbolos con reglas con peso.
+ */
+void stochastic(Lsystem *ls) {
+    double total[256] = { 0 };
+    int weighted[256] = { 0 };
+
+    for (Rule *r = ls->rules; r; r = r->next) {
+        unsigned char c = r->pred;
+        Prod *p = lookup(ls, c);
+        if (r->left || r->right)
+            continue;
+        total[c] += r->weight > 0 ? r->weight : 1;
+        weighted[c] |= r->weight > 0;
+        p->nalt++;
+    }
 
-    while ((c = fgetc(f)) != EOF) {
-        if (isspace(c)) {
-            ungetc(c, f);
-            break;
+    for (int c = 0; c < 256; c++) {
+        Prod *p = &ls->table[c];
+        if (!weighted[c]) {
+            p->nalt = 0;
+            continue;
         }
-        if (n < BUFSIZE - 1)
-            buf[n++] = c;
+        // La lista está al revés que el archivo: se llena desde el final, y
+        // rest es el peso de la alternativa y de todas las anteriores
+        p->alt = emalloc(p->nalt * sizeof(Prod));
+        int k = p->nalt;
+        double rest = total[c];
+        for (Rule *r = ls->rules; r; r = r->next)
+            if ((unsigned char)r->pred == c && !r->left && !r->right) {
+                Prod *a = &p->alt[--k];
+                a->succ = r->succ;
+                a->len = strlen(r->succ);
+                a->cut = k == p->nalt - 1 ? (uint64_t)1 << 32
+                       : (uint64_t)(rest / total[c] * 4294967296.0);
+                rest -= r->weight > 0 ? r->weight : 1;
+            }
+        ls->stoch = 1;
     }
-
-    buf[n] = '\0';
-    return strdup(buf);
 }
 
 /**
- * readstring - Lee una cadena entre comillas simples.
+ * alphabet - Asigna códigos densos a los símbolos que usa el L-system.
  *
- * @f: Puntero al búfer.
- * @return: Cadena leída (sin las comillas).
+ * @ls: L-system con la tabla de reglas ya compilada.
+ *
+ * Solo pueden aparecer en una generación los símbolos del axioma y de los
+ * sucesores; se numeran en orden de valor y se elige el menor ancho de
+ * 2, 3 o 4 bits que los represente (8 si hay más de 16).
  */
+void alphabet(Lsystem *ls) {
+    char used[256] = { 0 };
+
+    for (char *s = ls->axiom; *s; s++)
+        used[(unsigned char)*s] = 1;
+    for (Rule *r = ls->rules; r; r = r->next) {
+        used[(unsigned char)r->pred] = 1;
+        for (char *s = r->succ; *s; s++)
+            used[(unsigned char)*s] = 1;
+    }
 
+    ls->nsyms = 0;
+    memset(ls->code, 0, sizeof ls->code);
+    for (int c = 0; c < 256; c++)
+        if (used[c]) {
+            ls->code[c] = ls->nsyms;
+            ls->sym[ls->nsyms++] = (char)c;
+        }
 
-char* readstring(FILE *f) {
-    char buf[BUFSIZE];
-    int c, n = 0;
+    if (ls->nsyms <= 4)
+        ls->bits = 2;
+    else if (ls->nsyms <= 8)
+        ls->bits = 3;
+    else if (ls->nsyms <= 16)
+        ls->bits = 4;
+    else
+        ls->bits = 8;
+}
 
-    c = fgetc(f);
-    if (c != '\'') {
-        fprintf(stderr, "expected ' but got %c\n", c);
-        exit(1);
+/**
+ * freelsystem - Libera un L-system creado con parse() y todas sus reglas.
+ *
+ * La estructura, las cadenas y las reglas de un L-system de un catálogo son
+ * de la memoria del catálogo y se liberan con ella (freecatalog()).
+ */
+void freelsystem(Lsystem *ls) {
+    Rule *r, *n;
+    for (r = ls->rules; r; r = n) {
+        n = r->next;
+        freeprule(r->pr);
+        if (ls->pool)
+            continue;
+        free(r->succ);
+        free(r->left);
+        free(r->right);
+        free(r->formal);
+        free(r->cond);
+        free(r);
     }
-
-    while ((c = fgetc(f)) != EOF) {
-        if (c == '\'')
-            break;
-        if (!isalnum(c) && c != ' ') {
-            fprintf(stderr, "unexpected character %c in string\n", c);
-            exit(1);
-        }
-        if (n < BUFSIZE - 1)
-            buf[n++] = c;
+    for (int c = 0; c < 256; c++) {
+        free(ls->table[c].alt);
+        free(ls->table[c].ctx);
+        free(ls->table[c].prule);
     }
+    if (!ls->pool) {
+        free(ls->name);
+        free(ls->axiom);
+    }
+    free(ls->axpar);
+    free(ls->simd);
+    if (!ls->pool)
+        free(ls);
+}
 
-    buf[n] = '\0';
-    return strdup(buf);
+/**
+ * mkrule - Crea una regla de producción vacía al principio de la lista.
+ *
+ * @ls: L-system al que pertenece; la regla se reserva en su pool, si la tiene.
+ * @return: Puntero a la regla creada, que parsetext() rellena.
+ */
+Rule*
+mkrule(Lsystem *ls)
+{
+	Rule *r = palloc(ls->pool, sizeof(Rule));
+	r->next = ls->rules;	// Enlaza la nueva regla con el resto de la lista
+	ls->rules = r;
+	return r;
+}
+
+/**
+ * syntax - Informa de un error en el archivo de entrada y abandona el
+ * parseo (parsefail()).
+ */
+static void syntax(Lexer *lx, const char *fmt, ...) {
+    va_list ap;
+
+    fprintf(stderr, "%s: ", lx->file);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    parsefail();
 }
 
 /**
- * readnumber - Lee un número (entero o real) del búfer.
+ * skipws - Omite espacios en blanco en el texto de entrada.
  *
- * @f: Puntero al búfer.
- * @real: Si es 1, permite punto decimal.
- * @return: Cadena con el número leído.
+ * @lx: Lector del texto.
  */
+static void skipws(Lexer *lx) {
+    while (lx->p < lx->end && isspace((unsigned char)*lx->p))
+        lx->p++;
+}
 
+/**
+ * next - Lee el siguiente token del texto.
+ *
+ * @lx: Lector del texto.
+ * @return: Token leído, que apunta al propio texto (n = 0 al final).
+ */
+static Tok next(Lexer *lx) {
+    Tok t = { lx->p, 0 };
 
-char* readnumber(FILE *f, int real) {
-    char buf[BUFSIZE];
-    int c, n = 0, d = 0;
+    while (lx->p < lx->end && !isspace((unsigned char)*lx->p))
+        lx->p++;
+    t.n = lx->p - t.s;
+    return t;
+}
 
-    while ((c = fgetc(f)) != EOF) {
-        if (isspace(c))
-            break;
-        if (isdigit(c) ||
+/**
+ * readstring - Lee una cadena entre comillas simples.
+ *
+ * @lx: Lector del texto.
+ * @return: Cadena leída (sin las comillas).
+ */
+static Tok readstring(Lexer *lx) {
+    if (lx->p == lx->end || *lx->p != '\'')
+        syntax(lx, "expected ' but got %c", lx->p == lx->end ? ' ' : *lx->p);
+
+    Tok t = { ++lx->p, 0 };
+    while (lx->p < lx->end && *lx->p != '\'') {
+        if (!isalnum((unsigned char)*lx->p) && *lx->p != ' ')
+            syntax(lx, "unexpected character %c in string", *lx->p);
+        lx->p++;
+    }
+    t.n = lx->p - t.s;
+    if (lx->p < lx->end)
+        lx->p++;	// Comilla de cierre
+    return t;
+}
+
+/**
+ * readnumber - Lee un número (entero o real) del texto.
+ *
+ * @lx: Lector del texto.
+ * @real: Si es 1, permite punto decimal.
+ * @buf: Búfer de NUMSIZE caracteres donde se copia.
+ * @return: buf, con el número terminado en '\0'.
+ */
+static char* readnumber(Lexer *lx, int real, char *buf) {
+    int n = 0, d = 0;
+
+    for (; lx->p < lx->end && !isspace((unsigned char)*lx->p); lx->p++) {
+        char c = *lx->p;
+        if (isdigit((unsigned char)c) ||
             (n == 0 && (c == '-' || c == '+')) ||
             (real && c == '.' && !d)) {
             if (c == '.')
                 d = 1;
-            if (n < BUFSIZE - 1)
-                buf[n++] = c;
-        } else {
-            fprintf(stderr, "unexpected %c in number\n", c);
-            exit(1);
-        }
+            if (n == NUMSIZE - 1)
+                syntax(lx, "number too long");
+            buf[n++] = c;
+        } else
+            syntax(lx, "unexpected %c in number", c);
     }
 
     buf[n] = '\0';
-    return strdup(buf);
+    return buf;
 }
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "a.h"
+
+#define MAXTHREADS 256		// Hilos con contabilidad propia de ocupado/ocioso
+
+static const char *names[NPHASES] = {
+	"parse", "conteo", "prefijos", "escritura", "tortuga", "sdl"
+};
+
+static const char *evnames[NEVENTS] = {
+	"ciclos", "instrucciones", "fallos_cache", "fallos_salto"
+};
+
+/**
+ * Totales de una fase. El tiempo es de reloj, medido por el hilo que llama;
+ * los contadores suman los de todos los hilos que trabajan en la fase.
+ */
+typedef struct
+{
+	uint64_t	calls;            // Veces que se ejecutó
+	uint64_t	ns;               // Tiempo total en nanosegundos
+	uint64_t	ev[NEVENTS];      // Eventos de hardware
+} Phase;
+
+int profiling = -1;					// 1 con LSYSTEM_PROF; -1 sin leer todavía
+static Phase phases[NPHASES];
+static uint64_t busy[MAXTHREADS];	// Nanosegundos con trabajo, por hilo
+static uint64_t idle[MAXTHREADS];	// Nanosegundos esperando a los demás
+static int hwok[NEVENTS];			// 1 si algún hilo pudo abrir el contador
+
+static __thread int fds[NEVENTS];	// Contadores del hilo (0 sin abrir, -1 si fallan)
+
+static uint64_t nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * evopen - Abre los contadores de hardware del hilo que llama.
+ *
+ * Cada contador se abre por separado (sin grupo) para aprovechar los que
+ * haya aunque el sistema no ofrezca todos; solo se cuenta en modo usuario.
+ */
+static void evopen(void) {
+	static const uint64_t config[NEVENTS] = {
+#ifdef __linux__
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+#endif
+	};
+
+	for (int e = 0; e < NEVENTS; e++) {
+		fds[e] = -1;
+#ifdef __linux__
+		struct perf_event_attr a;
+		memset(&a, 0, sizeof a);
+		a.size = sizeof a;
+		a.type = PERF_TYPE_HARDWARE;
+		a.config = config[e];
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		int fd = syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+		fds[e] = fd < 0 ? -1 : fd;
+		if (fd >= 0)
+			hwok[e] = 1;
+#endif
+	}
+}
+
+static void evread(uint64_t *ev) {
+	if (fds[0] == 0)
+		evopen();
+	for (int e = 0; e < NEVENTS; e++)
+		if (fds[e] < 0 || read(fds[e], &ev[e], sizeof ev[e]) != sizeof ev[e])
+			ev[e] = 0;
+}
+
+/**
+ * profreport - Escribe en stderr el resumen por fase y por hilo.
+ *
+ * Se registra con atexit() al activar la instrumentación, así que todos los
+ * binarios lo imprimen al terminar sin más cambios.
+ */
+void profreport(void) {
+	fprintf(stderr, "fase,llamadas,tiempo_s");
+	for (int e = 0; e < NEVENTS; e++)
+		fprintf(stderr, ",%s", evnames[e]);
+	fprintf(stderr, ",ipc\n");
+	for (int p = 0; p < NPHASES; p++) {
+		Phase *ph = &phases[p];
+		if (ph->calls == 0)
+			continue;
+		fprintf(stderr, "%s,%llu,%.6f", names[p], (unsigned long long)ph->calls, ph->ns / 1e9);
+		for (int e = 0; e < NEVENTS; e++)
+			if (hwok[e])
+				fprintf(stderr, ",%llu", (unsigned long long)ph->ev[e]);
+			else
+				fprintf(stderr, ",-");	// El sistema no ofrece este contador
+		if (hwok[0] && hwok[1] && ph->ev[0])
+			fprintf(stderr, ",%.2f\n", (double)ph->ev[1] / ph->ev[0]);
+		else
+			fprintf(stderr, ",-\n");
+	}
+
+	int any = 0;
+	for (int t = 0; t < MAXTHREADS; t++)
+		any |= busy[t] || idle[t];
+	if (!any)
+		return;
+	fprintf(stderr, "hilo,ocupado_s,ocioso_s\n");
+	for (int t = 0; t < MAXTHREADS; t++)
+		if (busy[t] || idle[t])
+			fprintf(stderr, "%d,%.6f,%.6f\n", t, busy[t] / 1e9, idle[t] / 1e9);
+}
+
+/**
+ * profinit - Lee LSYSTEM_PROF una vez y registra el informe final.
+ */
+int profinit(void) {
+#ifdef _OPENMP
+	#pragma omp critical(profinit)
+#endif
+	if (profiling < 0) {
+		const char *e = getenv("LSYSTEM_PROF");
+		if (e && strcmp(e, "0") != 0)
+			atexit(profreport);
+		profiling = e && strcmp(e, "0") != 0;
+	}
+	return profiling;
+}
+
+/**
+ * profstart - Empieza a medir una fase desde el hilo que llama.
+ */
+void profstart(Mark *m) {
+	if (!profon())
+		return;
+	evread(m->ev);
+	m->ns = nsnow();
+}
+
+/**
+ * profstop - Acumula en la fase el tiempo y los eventos desde profstart().
+ *
+ * @wall: 1 si el tiempo cuenta como duración de la fase (hilo que la lanza),
+ *        0 si solo se suman los eventos (hilos que trabajan dentro).
+ */
+void profstop(int phase, Mark *m, int wall) {
+	if (!profon())
+		return;
+	uint64_t ns = nsnow() - m->ns;
+	uint64_t ev[NEVENTS];
+	evread(ev);
+
+	Phase *ph = &phases[phase];
+	if (wall) {
+		__atomic_fetch_add(&ph->calls, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ph->ns, ns, __ATOMIC_RELAXED);
+	}
+	for (int e = 0; e < NEVENTS; e++)
+		__atomic_fetch_add(&ph->ev[e], ev[e] - m->ev[e], __ATOMIC_RELAXED);
+}
+
+/**
+ * profthread - Suma al hilo t su tiempo ocupado y el que esperó a los demás.
+ */
+void profthread(int t, uint64_t busyns, uint64_t idlens) {
+	if (!profon() || t < 0 || t >= MAXTHREADS)
+		return;
+	__atomic_fetch_add(&busy[t], busyns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&idle[t], idlens, __ATOMIC_RELAXED);
+}
+
+/**
+ * profclock - Reloj monótono en nanosegundos (para profthread()).
+ */
+uint64_t profclock(void) {
+	return nsnow();
+}
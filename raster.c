@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+#define MARGIN 0.05	// Margen alrededor del dibujo (fracción del tamaño)
+
+/**
+ * mkimage - Crea una imagen en escala de grises de w × h píxeles, en blanco.
+ */
+Image* mkimage(int w, int h) {
+	Image *im = emalloc(sizeof(Image));
+	im->w = w;
+	im->h = h;
+	im->px = malloc((size_t)w * h);
+	if (im->px == NULL) {
+		fprintf(stderr, "mkimage: no hay memoria para %dx%d\n", w, h);
+		exit(EXIT_FAILURE);
+	}
+	memset(im->px, 255, (size_t)w * h);
+	return im;
+}
+
+/**
+ * freeimage - Libera una imagen creada con mkimage().
+ */
+void freeimage(Image *im) {
+	free(im->px);
+	free(im);
+}
+
+/**
+ * line - Dibuja una línea negra entre dos píxeles (algoritmo de Bresenham).
+ * Los píxeles fuera de la imagen se descartan.
+ */
+static void line(Image *im, int x0, int y0, int x1, int y1) {
+	int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+	int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+	int err = dx + dy;
+
+	while (1) {
+		if (x0 >= 0 && x0 < im->w && y0 >= 0 && y0 < im->h)
+			im->px[(size_t)y0 * im->w + x0] = 0;
+		if (x0 == x1 && y0 == y1)
+			break;
+		int e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+/**
+ * rasterize - Dibuja los segmentos escalados para ocupar toda la imagen.
+ *
+ * @im: Imagen destino.
+ * @segs: Segmentos en coordenadas de pantalla (como los de turtle()).
+ * @n: Número de segmentos.
+ *
+ * Calcula la caja que contiene el dibujo y la escala de forma uniforme,
+ * centrada y con un pequeño margen, de modo que cualquier generación entra
+ * completa en la miniatura.
+ */
+void rasterize(Image *im, Seg *segs, size_t n) {
+	if (n == 0)
+		return;
+
+	float minx = segs[0].x0, maxx = minx, miny = segs[0].y0, maxy = miny;
+	for (size_t i = 0; i < n; i++) {
+		minx = fminf(minx, fminf(segs[i].x0, segs[i].x1));
+		maxx = fmaxf(maxx, fmaxf(segs[i].x0, segs[i].x1));
+		miny = fminf(miny, fminf(segs[i].y0, segs[i].y1));
+		maxy = fmaxf(maxy, fmaxf(segs[i].y0, segs[i].y1));
+	}
+
+	double w = maxx - minx, h = maxy - miny;
+	double sx = w > 0 ? im->w * (1 - 2 * MARGIN) / w : 1;
+	double sy = h > 0 ? im->h * (1 - 2 * MARGIN) / h : 1;
+	double sc = sx < sy ? sx : sy;
+	double ox = (im->w - w * sc) / 2 - minx * sc;	// Centra el dibujo
+	double oy = (im->h - h * sc) / 2 - miny * sc;
+
+	for (size_t i = 0; i < n; i++)
+		line(im, lround(segs[i].x0 * sc + ox), lround(segs[i].y0 * sc + oy),
+		         lround(segs[i].x1 * sc + ox), lround(segs[i].y1 * sc + oy));
+}
+
+/**
+ * writeppm - Escribe la imagen en formato PPM binario (P6).
+ *
+ * @return: 0 si todo fue bien, -1 si falló la escritura.
+ */
+int writeppm(Image *im, FILE *fp) {
+	unsigned char *row = emalloc((size_t)im->w * 3);
+
+	fprintf(fp, "P6\n%d %d\n255\n", im->w, im->h);
+	for (int y = 0; y < im->h; y++) {
+		unsigned char *p = &im->px[(size_t)y * im->w];
+		for (int x = 0; x < im->w; x++)
+			row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = p[x];
+		fwrite(row, 3, im->w, fp);
+	}
+	free(row);
+	return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * Estado de escritura de un chunk PNG: el CRC se calcula sobre la marcha.
+ */
+typedef struct
+{
+	FILE*	fp;
+	uint32_t	crc;
+} Png;
+
+static uint32_t crctab[256];
+
+/**
+ * mkcrctab - Tabla del CRC-32 de PNG (polinomio 0xedb88320).
+ */
+static void mkcrctab(void) {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		crctab[n] = c;
+	}
+}
+
+static void pngput(Png *p, const void *buf, size_t n) {
+	const unsigned char *b = buf;
+	for (size_t i = 0; i < n; i++)
+		p->crc = crctab[(p->crc ^ b[i]) & 0xff] ^ (p->crc >> 8);
+	fwrite(buf, 1, n, p->fp);
+}
+
+static void put32(unsigned char *b, uint32_t v) {
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >> 8;
+	b[3] = v;
+}
+
+static void pngbegin(Png *p, const char *type, uint32_t len) {
+	unsigned char b[4];
+	put32(b, len);
+	fwrite(b, 1, 4, p->fp);
+	p->crc = 0xffffffffu;
+	pngput(p, type, 4);
+}
+
+static void pngend(Png *p) {
+	unsigned char b[4];
+	put32(b, p->crc ^ 0xffffffffu);
+	fwrite(b, 1, 4, p->fp);
+}
+
+/**
+ * writepng - Escribe la imagen como PNG en escala de grises de 8 bits.
+ *
+ * @return: 0 si todo fue bien, -1 si falló la escritura.
+ *
+ * Para no depender de zlib, los datos van en bloques deflate sin comprimir
+ * (tipo 0); cualquier lector de PNG los acepta. Cada fila lleva el filtro 0.
+ */
+int writepng(Image *im, FILE *fp) {
+	static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	static int once;
+	unsigned char b[13];
+	Png p = { fp, 0 };
+
+#ifdef _OPENMP
+	#pragma omp critical(crctab)
+#endif
+	if (!once) {
+		mkcrctab();
+		once = 1;
+	}
+
+	fwrite(sig, 1, 8, fp);
+
+	put32(b, im->w);
+	put32(b + 4, im->h);
+	b[8] = 8;	// Bits por muestra
+	b[9] = 0;	// Escala de grises
+	b[10] = b[11] = b[12] = 0;
+	pngbegin(&p, "IHDR", 13);
+	pngput(&p, b, 13);
+	pngend(&p);
+
+	// Filas precedidas del byte de filtro
+	size_t stride = (size_t)im->w + 1, raw = stride * im->h;
+	unsigned char *data = emalloc(raw);
+	for (int y = 0; y < im->h; y++)
+		memcpy(&data[y * stride + 1], &im->px[(size_t)y * im->w], im->w);
+
+	// Flujo zlib: cabecera, bloques almacenados de hasta 65535 bytes y Adler-32
+	size_t nblocks = (raw + 65534) / 65535;
+	pngbegin(&p, "IDAT", 2 + nblocks * 5 + raw + 4);
+	pngput(&p, "\x78\x01", 2);
+	for (size_t i = 0; i < raw; i += 65535) {
+		size_t n = raw - i < 65535 ? raw - i : 65535;
+		b[0] = (i + n == raw);	// BFINAL en el último bloque
+		b[1] = n & 0xff;
+		b[2] = n >> 8;
+		b[3] = ~n & 0xff;
+		b[4] = (~n >> 8) & 0xff;
+		pngput(&p, b, 5);
+		pngput(&p, &data[i], n);
+	}
+
+	uint32_t s1 = 1, s2 = 0;
+	for (size_t i = 0; i < raw; i++) {
+		s1 = (s1 + data[i]) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	free(data);
+	put32(b, (s2 << 16) | s1);
+	pngput(&p, b, 4);
+	pngend(&p);
+
+	pngbegin(&p, "IEND", 0);
+	pngend(&p);
+	return ferror(fp) ? -1 : 0;
+}
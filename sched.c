@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "a.h"
+
+#ifdef _OPENMP
+/**
+ * Cola de bloques de un hilo: el rango [head, tail) de índices de bloque.
+ *
+ * head y tail van juntos en una palabra de 64 bits para que el dueño (que
+ * toma por delante) y los ladrones (que toman por detrás) se coordinen con
+ * una sola comparación e intercambio. Cada cola ocupa su propia línea de
+ * caché para que los hilos no se estorben al tomar bloques.
+ */
+typedef struct
+{
+	uint64_t	range;    // head en los 32 bits bajos, tail en los altos
+	char	pad[56];      // Relleno hasta 64 bytes
+} Deque;
+
+#define HEAD(r) ((uint32_t)(r))
+#define TAIL(r) ((uint32_t)((r) >> 32))
+#define RANGE(h, t) ((uint64_t)(t) << 32 | (h))
+
+/**
+ * take - Toma un bloque de la cola, por delante (dueño) o por detrás (ladrón).
+ *
+ * @return: 1 si consiguió un bloque, 0 si la cola está vacía.
+ */
+static int take(Deque *q, int back, size_t *b) {
+	uint64_t r = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+	while (HEAD(r) < TAIL(r)) {
+		uint64_t n = back ? RANGE(HEAD(r), TAIL(r) - 1) : RANGE(HEAD(r) + 1, TAIL(r));
+		if (__atomic_compare_exchange_n(&q->range, &r, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*b = back ? TAIL(r) - 1 : HEAD(r);
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif
+
+#define GRAIN 16384	// Símbolos de entrada por bloque de trabajo
+
+/**
+ * grainsize - Símbolos por bloque al repartir len símbolos entre nt hilos.
+ *
+ * Bloques de GRAIN símbolos, pero con varios hilos al menos 8 por hilo para
+ * que el robo de trabajo pueda equilibrar; con uno solo basta un bloque.
+ * Nunca salen más de UINT32_MAX bloques, lo que admiten las colas.
+ */
+size_t grainsize(size_t len, int nt) {
+	size_t grain = GRAIN;
+	if (nt <= 1 || len == 0)
+		grain = len ? len : 1;
+	else if (len / GRAIN < 8 * (size_t)nt)
+		grain = len / (8 * nt) + 1;
+	if (len / grain >= UINT32_MAX)
+		grain = len / UINT32_MAX + 1;
+	return grain;
+}
+
+/**
+ * initrange - Reparto inicial de schedule(): bloques [first, last) del hilo t.
+ *
+ * Son bloques contiguos con un coste de aproximadamente total / nt según la
+ * suma de prefijos weight, o nb / nt bloques si weight es NULL.
+ */
+void initrange(int nt, size_t nb, const size_t *weight, int t, size_t *first, size_t *last) {
+	size_t b = 0;
+	for (int i = 0; i <= t; i++) {
+		*first = b;
+		if (i == nt - 1)
+			b = nb;
+		else if (weight) {
+			size_t goal = weight[nb] / nt * (i + 1) + weight[nb] % nt * (i + 1) / nt;
+			while (b < nb && weight[b + 1] <= goal)
+				b++;
+		} else
+			b = slicebound(nb, i + 1, nt);
+	}
+	*last = b;
+}
+
+/**
+ * schedule - Ejecuta task(arg, b) para los bloques 0..nb-1 con robo de trabajo.
+ *
+ * @nt: Número de hilos.
+ * @nb: Número de bloques.
+ * @weight: Suma de prefijos del coste de los bloques (nb + 1 entradas), o
+ *          NULL si todos cuestan lo mismo.
+ * @task: Trabajo de un bloque; bloques distintos deben ser independientes.
+ *
+ * Los índices de bloque de las colas son de 32 bits: nb no puede pasar de
+ * UINT32_MAX (grainsize() agranda los bloques para que no ocurra).
+ *
+ * Cada hilo empieza con un rango contiguo de bloques de coste parecido
+ * (según weight) y los recorre en orden, por delante. Un hilo que acaba su
+ * rango roba bloques del final de los rangos de los demás, así que un
+ * reparto inicial desequilibrado solo retrasa a los hilos hasta que roban.
+ * Como no se crean bloques nuevos, cuando todas las colas están vacías el
+ * trabajo ha terminado.
+ *
+ * Con la instrumentación activa cada hilo suma sus eventos a la fase phase
+ * (los del hilo principal ya los mide quien llama) y se anota cuánto estuvo
+ * trabajando y cuánto esperando a que acabaran los demás.
+ */
+void schedule(int nt, size_t nb, const size_t *weight, void (*task)(void*, size_t), void *arg,
+              int phase) {
+#ifdef _OPENMP
+	if (nt > 1 && nb > 1) {
+		if (nb > UINT32_MAX) {
+			fprintf(stderr, "schedule: %zu bloques no caben en las colas de 32 bits\n", nb);
+			exit(EXIT_FAILURE);
+		}
+		Deque *q;
+		if (posix_memalign((void**)&q, 64, nt * sizeof(Deque)) != 0) {
+			fprintf(stderr, "schedule: sin memoria\n");
+			exit(EXIT_FAILURE);
+		}
+
+		// Reparto inicial: bloques contiguos con coste total / nt por hilo
+		for (int t = 0; t < nt; t++) {
+			size_t first, last;
+			initrange(nt, nb, weight, t, &first, &last);
+			q[t].range = RANGE(first, last);
+		}
+
+		#pragma omp parallel num_threads(nt)
+		{
+			int me = omp_get_thread_num();
+			size_t blk;
+			Mark m;
+			uint64_t t0 = 0;
+
+			numapin(me);	// Solo con LSYSTEM_NUMA
+			if (profon()) {
+				t0 = profclock();
+				if (me != 0)
+					profstart(&m);
+			}
+
+			while (take(&q[me], 0, &blk))
+				task(arg, blk);
+
+			// Sin trabajo propio: roba recorriendo las demás colas (también
+			// las de hilos que el sistema no llegara a crear)
+			for (int i = 1; i < nt; i++) {
+				Deque *v = &q[(me + i) % nt];
+				while (take(v, 1, &blk))
+					task(arg, blk);
+			}
+
+			if (profon()) {
+				uint64_t t1 = profclock();
+				if (me != 0)
+					profstop(phase, &m, 0);
+				#pragma omp barrier
+				profthread(me, t1 - t0, profclock() - t1);
+			}
+		}
+		numaunpin();
+		free(q);
+		return;
+	}
+#endif
+	for (size_t b = 0; b < nb; b++)
+		task(arg, b);
+}
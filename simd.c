@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/**
+ * Datos de los núcleos vectoriales, derivados de la tabla de reglas.
+ *
+ * Un símbolo c < 128 tiene regla si lo[c & 15] & hi[c >> 4] no es cero:
+ * lo guarda, para cada nibble bajo, un bit por cada nibble alto con regla.
+ * Así se clasifican 16, 32 o 64 símbolos con dos pshufb y un AND.
+ */
+struct Simd
+{
+	Lsystem*	ls;
+	uint8_t	lo[16];       // Bits de nibble alto con regla, por nibble bajo
+	uint8_t	hi[16];       // 1 << nibble alto (0 para los bytes >= 128)
+	int	lanes;            // 1 si las longitudes por carril se calculan en vector
+	int	nrules;           // Reglas (si lanes)
+	uint8_t	pred[8];      // Predecesores (si lanes)
+	uint8_t	extra[8];     // Longitud del sucesor menos 1 (si lanes)
+	char	pad[256][64];   // Sucesores copiados con relleno para escribirlos de golpe
+};
+
+static size_t (*kcount)(Simd*, const char*, size_t, size_t);
+static void (*kwrite)(Simd*, const char*, size_t, size_t, char*, char*, const char*);
+static const char *kname = "escalar";
+
+/**
+ * Núcleos para un ancho de vector W. CLS(p, k, extra) clasifica W símbolos:
+ * devuelve la máscara de carriles con regla y, si extra no es NULL, suma en
+ * *extra la longitud de salida que añaden esos carriles (sucesor menos 1).
+ * COPY(dst, src) copia W bytes con una carga y un almacenamiento sin alinear.
+ *
+ * La escritura copia las tiradas de símbolos sin regla y los sucesores con un
+ * almacenamiento de W bytes aunque sean más cortos: lo que sobra lo pisan las
+ * escrituras siguientes. Solo se hace si no se sale del tramo de salida (que
+ * es de este hilo) ni de la generación de entrada; si no, se usa memcpy.
+ */
+#define KERNELS(SUF, ISA, W, CLS, COPY)                                              \
+__attribute__((target(ISA)))                                                         \
+static size_t count_##SUF(Simd *k, const char *gen, size_t start, size_t end) {      \
+	size_t n = 0, i = start;                                                         \
+	for (; i + W <= end; i += W) {                                                   \
+		size_t e = 0;                                                                \
+		uint64_t m = CLS(gen + i, k, k->lanes ? &e : NULL);                          \
+		if (!k->lanes)                                                               \
+			for (; m; m &= m - 1)                                                    \
+				e += lookup(k->ls, gen[i + __builtin_ctzll(m)])->len - 1;            \
+		n += W + e;                                                                  \
+	}                                                                                \
+	for (; i < end; i++)                                                             \
+		n += lookup(k->ls, gen[i])->len;                                             \
+	return n;                                                                        \
+}                                                                                    \
+                                                                                     \
+__attribute__((target(ISA)))                                                         \
+static inline char* run_##SUF(char *out, const char *src, size_t n,                  \
+                              char *outend, const char *genend) {                    \
+	if (out + W <= outend && src + W <= genend)                                      \
+		COPY(out, src);                                                              \
+	else                                                                             \
+		memcpy(out, src, n);                                                         \
+	return out + n;                                                                  \
+}                                                                                    \
+                                                                                     \
+__attribute__((target(ISA)))                                                         \
+static void write_##SUF(Simd *k, const char *gen, size_t start, size_t end,          \
+                        char *out, char *outend, const char *genend) {               \
+	size_t i = start;                                                                \
+	for (; i + W <= end; i += W) {                                                   \
+		uint64_t m = CLS(gen + i, k, NULL);                                          \
+		size_t p = 0;                                                                \
+		for (; m; m &= m - 1) {                                                      \
+			size_t r = __builtin_ctzll(m);                                           \
+			unsigned char c = gen[i + r];                                            \
+			Prod *pr = lookup(k->ls, c);                                             \
+			if (r > p)                                                               \
+				out = run_##SUF(out, gen + i + p, r - p, outend, genend);            \
+			if (pr->len <= W && out + W <= outend)                                   \
+				COPY(out, k->pad[c]);                                                \
+			else                                                                     \
+				memcpy(out, pr->succ, pr->len);                                      \
+			out += pr->len;                                                          \
+			p = r + 1;                                                               \
+		}                                                                            \
+		if (p < W)                                                                   \
+			out = run_##SUF(out, gen + i + p, W - p, outend, genend);                \
+	}                                                                                \
+	for (; i < end; i++) {                                                           \
+		Prod *pr = lookup(k->ls, gen[i]);                                            \
+		memcpy(out, pr->succ, pr->len);                                              \
+		out += pr->len;                                                              \
+	}                                                                                \
+}
+
+// SSE4.1: 16 símbolos por vector
+
+__attribute__((target("sse4.1")))
+static inline uint64_t cls16(const char *p, Simd *k, size_t *extra) {
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i nib = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+	__m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)k->lo), _mm_and_si128(v, nib));
+	__m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)k->hi),
+	                              _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+	uint64_t m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) & 0xffff;
+	if (extra && m) {
+		__m128i e = zero;
+		for (int r = 0; r < k->nrules; r++)
+			e = _mm_add_epi8(e, _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(k->pred[r])),
+			                                  _mm_set1_epi8(k->extra[r])));
+		e = _mm_sad_epu8(e, zero);
+		*extra += _mm_cvtsi128_si64(e) + _mm_extract_epi64(e, 1);
+	}
+	return m;
+}
+
+#define COPY16(d, s) _mm_storeu_si128((__m128i*)(d), _mm_loadu_si128((const __m128i*)(s)))
+KERNELS(sse4, "sse4.1", 16, cls16, COPY16)
+
+// AVX2: 32 símbolos por vector
+
+__attribute__((target("avx2")))
+static inline uint64_t cls32(const char *p, Simd *k, size_t *extra) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	__m256i nib = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)k->lo)),
+	                                 _mm256_and_si256(v, nib));
+	__m256i hi = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)k->hi)),
+	                                 _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+	uint64_t m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero));
+	m &= 0xffffffffu;
+	if (extra && m) {
+		__m256i e = zero;
+		for (int r = 0; r < k->nrules; r++)
+			e = _mm256_add_epi8(e, _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(k->pred[r])),
+			                                        _mm256_set1_epi8(k->extra[r])));
+		e = _mm256_sad_epu8(e, zero);
+		__m128i s = _mm_add_epi64(_mm256_castsi256_si128(e), _mm256_extracti128_si256(e, 1));
+		*extra += _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+	}
+	return m;
+}
+
+#define COPY32(d, s) _mm256_storeu_si256((__m256i*)(d), _mm256_loadu_si256((const __m256i*)(s)))
+KERNELS(avx2, "avx2", 32, cls32, COPY32)
+
+// AVX-512BW: 64 símbolos por vector, con registros de máscara
+
+__attribute__((target("avx512f,avx512bw")))
+static inline uint64_t cls64(const char *p, Simd *k, size_t *extra) {
+	__m512i v = _mm512_loadu_si512(p);
+	__m512i nib = _mm512_set1_epi8(0x0f);
+	__m512i lo = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)k->lo)),
+	                                 _mm512_and_si512(v, nib));
+	__m512i hi = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)k->hi)),
+	                                 _mm512_and_si512(_mm512_srli_epi16(v, 4), nib));
+	uint64_t m = _mm512_test_epi8_mask(lo, hi);
+	if (extra && m) {
+		__m512i e = _mm512_setzero_si512();
+		for (int r = 0; r < k->nrules; r++)
+			e = _mm512_mask_add_epi8(e, _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(k->pred[r])),
+			                         e, _mm512_set1_epi8(k->extra[r]));
+		*extra += _mm512_reduce_add_epi64(_mm512_sad_epu8(e, _mm512_setzero_si512()));
+	}
+	return m;
+}
+
+#define COPY64(d, s) _mm512_storeu_si512((d), _mm512_loadu_si512((s)))
+KERNELS(avx512, "avx512f,avx512bw", 64, cls64, COPY64)
+
+/**
+ * simdchoose - Elige el núcleo según la CPU (CPUID).
+ *
+ * La variable de entorno LSYSTEM_SIMD (scalar, sse4, avx2 o avx512) fuerza
+ * un núcleo concreto, por ejemplo para comparar rendimientos; con otro
+ * valor se avisa y se elige como si no estuviera.
+ */
+static void simdchoose(void) {
+	const char *want = getenv("LSYSTEM_SIMD");
+	if (want && strcmp(want, "scalar") != 0 && strcmp(want, "sse4") != 0 &&
+	    strcmp(want, "avx2") != 0 && strcmp(want, "avx512") != 0) {
+		fprintf(stderr, "LSYSTEM_SIMD=%s no es scalar, sse4, avx2 ni avx512: se elige según la CPU\n", want);
+		want = NULL;
+	}
+	__builtin_cpu_init();
+	int avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+	int avx2 = __builtin_cpu_supports("avx2");
+	int sse4 = __builtin_cpu_supports("sse4.1");
+
+	if (want && strcmp(want, "scalar") == 0)
+		return;
+	if (avx512 && (!want || strcmp(want, "avx512") == 0)) {
+		kcount = count_avx512, kwrite = write_avx512, kname = "avx512";
+	} else if (avx2 && (!want || strcmp(want, "avx512") == 0 || strcmp(want, "avx2") == 0)) {
+		kcount = count_avx2, kwrite = write_avx2, kname = "avx2";
+	} else if (sse4) {
+		kcount = count_sse4, kwrite = write_sse4, kname = "sse4";
+	}
+}
+
+/**
+ * simdpick - Elige el núcleo la primera vez que se pide, desde cualquier hilo.
+ *
+ * picked se publica con release después de escribir kcount, kwrite y
+ * kname, así que quien lo lee a 1 con acquire ve la elección completa.
+ */
+static void simdpick(void) {
+	static int picked;
+	if (__atomic_load_n(&picked, __ATOMIC_ACQUIRE))
+		return;
+#ifdef _OPENMP
+	#pragma omp critical(simdpick)
+#endif
+	if (!picked) {
+		simdchoose();
+		__atomic_store_n(&picked, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * mksimd - Prepara los núcleos vectoriales para un L-system.
+ *
+ * @return: Datos de los núcleos, o NULL si no hay ninguno utilizable (CPU
+ *          sin SSE4.1, LSYSTEM_SIMD=scalar o reglas para bytes >= 128).
+ */
+Simd* mksimd(Lsystem *ls) {
+	simdpick();
+	if (kcount == NULL || ls->stoch || ls->ctx || ls->param)	// Reglas que se eligen símbolo a símbolo
+		return NULL;
+
+	Simd *k = emalloc(sizeof(Simd));
+	k->ls = ls;
+	k->lanes = 1;
+	for (int c = 0; c < 8; c++)
+		k->hi[c] = 1 << c;
+
+	for (int c = 0; c < 256; c++) {
+		Prod *p = &ls->table[c];
+		if (p->ident)
+			continue;
+		if (c >= 128) {
+			free(k);
+			return NULL;
+		}
+		k->lo[c & 15] |= 1 << (c >> 4);
+		memcpy(k->pad[c], p->succ, p->len < 64 ? p->len : 64);
+		if (k->nrules == 8 || p->len - 1 > 255)
+			k->lanes = 0;
+		else {
+			k->pred[k->nrules] = c;
+			k->extra[k->nrules++] = p->len - 1;
+		}
+	}
+	return k;
+}
+
+/**
+ * simdcount - Longitud de salida de gen[start, end) con el núcleo vectorial.
+ */
+size_t simdcount(Simd *k, const char *gen, size_t start, size_t end) {
+	return kcount(k, gen, start, end);
+}
+
+/**
+ * simdwrite - Escribe las producciones de gen[start, end) en out.
+ *
+ * @outend: Final del tramo de salida de este hilo.
+ * @genend: Final de la generación de entrada (límite de lectura).
+ */
+void simdwrite(Simd *k, const char *gen, size_t start, size_t end,
+               char *out, char *outend, const char *genend) {
+	kwrite(k, gen, start, end, out, outend, genend);
+}
+
+/**
+ * simdname - Nombre del núcleo elegido ("avx512", "avx2", "sse4" o "escalar").
+ */
+const char* simdname(void) {
+	simdpick();
+	return kname;
+}
+
+#else
+
+// Sin x86 no hay núcleos vectoriales: la expansión usa siempre el bucle escalar
+
+Simd* mksimd(Lsystem *ls) {
+	return NULL;
+}
+
+size_t simdcount(Simd *k, const char *gen, size_t start, size_t end) {
+	return 0;
+}
+
+void simdwrite(Simd *k, const char *gen, size_t start, size_t end,
+               char *out, char *outend, const char *genend) {
+}
+
+const char* simdname(void) {
+	return "escalar";
+}
+
+#endif
@@ -0,0 +1,327 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Posición y orientación de la tortuga, o transformación rígida relativa.
+ *
+ * Se trabaja con el eje y hacia arriba y se invierte al emitir segmentos.
+ * Componer (aplicar t sobre p) es asociativo, así que la pose tras un tramo
+ * de la cadena se puede calcular por separado y componer después.
+ */
+typedef struct
+{
+	double	x, y;     // Posición (o desplazamiento relativo)
+	double	a;        // Ángulo en grados (o giro relativo)
+} Pose;
+
+/**
+ * Resumen de un tramo de la cadena respecto de la pose con la que empieza.
+ *
+ * Un tramo puede cerrar corchetes abiertos en tramos anteriores (pops) y
+ * dejar corchetes abiertos para tramos posteriores (stack). Tras el último
+ * cierre la tortuga vuelve a una pose de fuera del tramo, así que cur y
+ * stack son relativas a esa pose (o a la de entrada si pops es 0).
+ */
+typedef struct
+{
+	size_t	pops;     // Cierres ']' sin su '[' dentro del tramo
+	Pose*	stack;    // Aperturas '[' sin cerrar, relativas a la base
+	size_t	nstack;   // Número de aperturas sin cerrar
+	size_t	cap;      // Capacidad de stack
+	Pose	cur;      // Pose final relativa a la base
+	size_t	nseg;     // Segmentos que dibuja el tramo
+} Chunk;
+
+/**
+ * compose - Aplica la transformación t partiendo de la pose p.
+ */
+static Pose compose(Pose p, Pose t) {
+	double r = p.a * M_PI / 180.0;
+	double c = cos(r), s = sin(r);
+	Pose q = { p.x + t.x * c - t.y * s, p.y + t.x * s + t.y * c, p.a + t.a };
+	return q;
+}
+
+/**
+ * walk - Interpreta un tramo de la cadena desde la pose cur.
+ *
+ * @gen, @pk: Generación como cadena, o empaquetada si pk no es NULL.
+ * @ch: Resumen del tramo; se rellena su pila, pops, cur y nseg.
+ * @cur: Pose de entrada (la identidad en la primera pasada).
+ * @popped: Poses absolutas a las que vuelven los cierres sin apertura
+ *          dentro del tramo, o NULL en la primera pasada.
+ * @out: Donde escribir los segmentos, o NULL para solo contarlos.
+ */
+static void walk(Lsystem *ls, const char *gen, const uint64_t *pk, size_t start, size_t end,
+                 Chunk *ch, Pose cur, Pose *popped, Seg *out) {
+	double lasta = NAN, c = 0, s = 0;
+	Reader rd = { 0 };
+
+	if (pk)
+		rdinit(&rd, pk, start, ls->bits);
+
+	ch->pops = 0;
+	ch->nstack = 0;
+	ch->nseg = 0;
+	for (size_t i = start; i < end; i++) {
+		char sym = pk ? ls->sym[rdnext(&rd)] : gen[i];
+		switch (lookup(ls, sym)->op) {
+			case T_FORWARD:
+				if (cur.a != lasta) {	// Solo recalcula seno y coseno al girar
+					lasta = cur.a;
+					c = cos(cur.a * M_PI / 180.0);
+					s = sin(cur.a * M_PI / 180.0);
+				}
+				double x1 = cur.x + ls->linelen * c;
+				double y1 = cur.y + ls->linelen * s;
+				if (out) {
+					Seg *sg = &out[ch->nseg];
+					sg->x0 = cur.x;
+					sg->y0 = -cur.y;
+					sg->x1 = x1;
+					sg->y1 = -y1;
+				}
+				ch->nseg++;
+				cur.x = x1;
+				cur.y = y1;
+				break;
+			case T_LEFT:
+				cur.a += ls->leftangle;
+				break;
+			case T_RIGHT:
+				cur.a += ls->rightangle;
+				break;
+			case T_PUSH:
+				if (ch->nstack == ch->cap) {
+					ch->cap = ch->cap ? 2 * ch->cap : 64;
+					ch->stack = realloc(ch->stack, ch->cap * sizeof(Pose));
+					if (ch->stack == NULL) {
+						fprintf(stderr, "turtle: sin memoria para la pila\n");
+						exit(EXIT_FAILURE);
+					}
+				}
+				ch->stack[ch->nstack++] = cur;
+				break;
+			case T_POP:
+				if (ch->nstack > 0)
+					cur = ch->stack[--ch->nstack];
+				else if (popped)
+					cur = popped[ch->pops++];
+				else {	// Vuelve a una pose anterior al tramo: la nueva base
+					Pose id = { 0, 0, 0 };
+					cur = id;
+					ch->pops++;
+				}
+				break;
+		}
+	}
+	ch->cur = cur;
+}
+
+/**
+ * Reparto de una generación en bloques para la tortuga, como Split en
+ * expand.c. off[b] es el primer segmento del bloque b.
+ */
+typedef struct
+{
+	Lsystem*	ls;
+	const char*	gen;      // Generación como cadena, o NULL
+	const uint64_t*	pk;   // Generación empaquetada, o NULL
+	size_t	len;          // Longitud de la generación
+	size_t	grain;        // Símbolos por bloque
+	Chunk*	ch;           // Resumen de cada bloque
+	Pose*	entry;        // Pose absoluta de entrada de cada bloque
+	Pose**	popped;       // Poses a las que vuelven los cierres de cada bloque
+	size_t*	off;          // nb + 1 desplazamientos de segmentos
+	Seg*	segs;         // Salida (tercera fase)
+} Tsplit;
+
+/**
+ * sumtask - Fase 1 de un bloque: su resumen respecto de la identidad.
+ */
+static void sumtask(void *arg, size_t b) {
+	Tsplit *sp = arg;
+	size_t start = b * sp->grain;
+	size_t end = start + sp->grain < sp->len ? start + sp->grain : sp->len;
+	Pose id = { 0, 0, 0 };
+	walk(sp->ls, sp->gen, sp->pk, start, end, &sp->ch[b], id, NULL, NULL);
+}
+
+/**
+ * drawtask - Fase 3 de un bloque: sus segmentos desde su pose absoluta.
+ */
+static void drawtask(void *arg, size_t b) {
+	Tsplit *sp = arg;
+	size_t start = b * sp->grain;
+	size_t end = start + sp->grain < sp->len ? start + sp->grain : sp->len;
+	walk(sp->ls, sp->gen, sp->pk, start, end, &sp->ch[b], sp->entry[b], sp->popped[b],
+	     sp->segs + sp->off[b]);
+}
+
+/**
+ * interp - Genera en paralelo los segmentos que dibuja una generación.
+ *
+ * @ls: L-system compilado (acciones, longitud de línea y ángulos).
+ * @gen: Generación a interpretar (o NULL si se da empaquetada).
+ * @pk: Generación empaquetada, o NULL.
+ * @len: Longitud de gen.
+ * @x, @y: Posición inicial en pantalla; el ángulo inicial es ls->initangle.
+ * @nseg: Recibe el número de segmentos generados.
+ * @threads: Número de hilos (se ignora sin OpenMP).
+ * @return: Array de segmentos en el orden en que se dibujan.
+ *
+ * La generación se divide en bloques de grainsize() símbolos y se hace en
+ * tres fases, como expand():
+ * 1. Cada bloque se interpreta partiendo de la identidad y da la
+ *    transformación del bloque, los corchetes sin emparejar y sus segmentos.
+ * 2. Una pasada secuencial sobre los resúmenes compone las transformaciones
+ *    y empareja los corchetes entre bloques, dando la pose absoluta de
+ *    entrada de cada bloque y las poses a las que vuelven sus cierres.
+ * 3. Cada bloque se vuelve a interpretar desde su pose absoluta y escribe
+ *    los segmentos en su desplazamiento del array de salida.
+ * Las fases 1 y 3 reparten los bloques con schedule(); la 3 según los
+ * segmentos que escribe cada uno. Un ']' sin '[' vuelve a la pose inicial.
+ *
+ * Con un solo bloque (un hilo) las cuentas son las de la tortuga
+ * secuencial. Con varios, componer las transformaciones de los bloques
+ * redondea de otra forma y las coordenadas pueden diferir en los últimos
+ * bits.
+ */
+static Seg* interp(Lsystem *ls, const char *gen, const uint64_t *pk, size_t len,
+                   double x, double y, size_t *nseg, int threads) {
+	int nt = threads < 1 ? 1 : threads;
+	Tsplit sp = { .ls = ls, .gen = gen, .pk = pk, .len = len, .grain = grainsize(len, nt) };
+	size_t nb = len ? (len + sp.grain - 1) / sp.grain : 1;
+	Mark m;
+
+	profstart(&m);
+	sp.ch = emalloc(nb * sizeof(Chunk));
+	sp.entry = emalloc(nb * sizeof(Pose));
+	sp.popped = emalloc(nb * sizeof(Pose*));
+	sp.off = emalloc((nb + 1) * sizeof(size_t));
+
+	// Fase 1: resumen de cada bloque respecto de la identidad
+	schedule(nt, nb, NULL, sumtask, &sp, P_TURTLE);
+
+	// Fase 2: composición secuencial de los resúmenes con una pila global
+	Chunk *ch = sp.ch;
+	Pose init = { x, -y, ls->initangle };
+	Pose cur = init;
+	Chunk g = { 0 };	// Pila global de poses absolutas
+	sp.off[0] = 0;
+	for (size_t b = 0; b < nb; b++) {
+		sp.entry[b] = cur;
+		sp.popped[b] = emalloc((ch[b].pops + 1) * sizeof(Pose));
+		Pose base = cur;
+		for (size_t j = 0; j < ch[b].pops; j++)
+			base = sp.popped[b][j] = g.nstack ? g.stack[--g.nstack] : init;
+		for (size_t j = 0; j < ch[b].nstack; j++) {
+			if (g.nstack == g.cap) {
+				g.cap = g.cap ? 2 * g.cap : 64;
+				g.stack = realloc(g.stack, g.cap * sizeof(Pose));
+				if (g.stack == NULL) {
+					fprintf(stderr, "turtle: sin memoria para la pila\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			g.stack[g.nstack++] = compose(base, ch[b].stack[j]);
+		}
+		cur = compose(base, ch[b].cur);
+		sp.off[b + 1] = sp.off[b] + ch[b].nseg;
+	}
+	free(g.stack);
+
+	size_t total = sp.off[nb];
+	sp.segs = malloc((total ? total : 1) * sizeof(Seg));
+	if (sp.segs == NULL) {
+		fprintf(stderr, "turtle: no hay memoria para %zu segmentos\n", total);
+		exit(EXIT_FAILURE);
+	}
+
+	// Fase 3: cada bloque escribe sus segmentos desde su pose absoluta
+	schedule(nt, nb, sp.off, drawtask, &sp, P_TURTLE);
+
+	for (size_t b = 0; b < nb; b++) {
+		free(ch[b].stack);
+		free(sp.popped[b]);
+	}
+	free(sp.ch);
+	free(sp.entry);
+	free(sp.popped);
+	free(sp.off);
+	*nseg = total;
+	profstop(P_TURTLE, &m, 1);
+	return sp.segs;
+}
+
+/**
+ * turtle - Genera los segmentos de una generación guardada como cadena.
+ */
+Seg* turtle(Lsystem *ls, const char *gen, size_t len, double x, double y, size_t *nseg, int threads) {
+	return interp(ls, gen, NULL, len, x, y, nseg, threads);
+}
+
+/**
+ * turtlepk - Igual que turtle(), pero leyendo una generación empaquetada.
+ *
+ * Cada tramo lee sus códigos directamente de las palabras empaquetadas,
+ * así que nunca hace falta la cadena de bytes de la generación.
+ */
+Seg* turtlepk(Lsystem *ls, const uint64_t *w, size_t len, double x, double y, size_t *nseg, int threads) {
+	return interp(ls, NULL, w, len, x, y, nseg, threads);
+}
+
+/**
+ * mkpoly - Agrupa segmentos consecutivos y conectados en polilíneas.
+ *
+ * @segs: Segmentos en el orden en que los dibuja la tortuga.
+ * @n: Número de segmentos.
+ * @return: Polilíneas listas para enviarse de golpe al renderizador.
+ *
+ * Un segmento continúa la polilínea anterior si empieza donde acabó el
+ * anterior; tras un ']' la tortuga salta y empieza una polilínea nueva.
+ * Así cada punto compartido se guarda y se envía una sola vez.
+ */
+Poly* mkpoly(Seg *segs, size_t n) {
+	Poly *p = emalloc(sizeof(Poly));
+	p->xy = malloc((2 * n + 1) * 2 * sizeof(float));
+	p->runs = malloc((n + 1) * sizeof(size_t));
+	if (p->xy == NULL || p->runs == NULL) {
+		fprintf(stderr, "mkpoly: no hay memoria para %zu segmentos\n", n);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t k = 0, r = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (i == 0 || segs[i].x0 != segs[i - 1].x1 || segs[i].y0 != segs[i - 1].y1) {
+			p->runs[r++] = k;
+			p->xy[2 * k] = segs[i].x0;
+			p->xy[2 * k + 1] = segs[i].y0;
+			k++;
+		}
+		p->xy[2 * k] = segs[i].x1;
+		p->xy[2 * k + 1] = segs[i].y1;
+		k++;
+	}
+	p->runs[r] = k;
+	p->npts = k;
+	p->nruns = r;
+	return p;
+}
+
+/**
+ * freepoly - Libera unas polilíneas creadas con mkpoly().
+ */
+void freepoly(Poly *p) {
+	free(p->xy);
+	free(p->runs);
+	free(p);
+}